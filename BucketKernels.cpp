@@ -0,0 +1,175 @@
+////////////////////////////////////////////////////////////////////////////////
+/// DISCLAIMER
+///
+/// Copyright 2014-2021 ArangoDB GmbH, Cologne, Germany
+/// Copyright 2004-2014 triAGENS GmbH, Cologne, Germany
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     http://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+///
+/// Copyright holder is ArangoDB GmbH, Cologne, Germany
+////////////////////////////////////////////////////////////////////////////////
+
+#include "BucketKernels.h"
+
+#include <cstdlib>
+#include <cstring>
+
+// The loops below are written once and compiled three times, inlined into
+// functions with different target attributes. Only this file is built with
+// auto-vectorization, see CMakeLists.txt.
+
+#define BASELINE_TARGET
+#define AVX2_TARGET __attribute__((target("avx2,fma")))
+#define AVX512_TARGET __attribute__((target("avx512f,avx512bw,avx512dq,avx512vl,avx2,fma")))
+#define KERNEL_INLINE inline __attribute__((always_inline))
+
+namespace {
+
+template<typename T> struct Bits;
+template<> struct Bits<double> {
+  using type = uint64_t;
+  static constexpr int mantissa = 52;
+  static constexpr type mask = 0x7ff;
+  static constexpr int32_t bias = 1023;
+};
+template<> struct Bits<float> {
+  using type = uint32_t;
+  static constexpr int mantissa = 23;
+  static constexpr type mask = 0xff;
+  static constexpr int32_t bias = 127;
+};
+
+template<typename T>
+KERNEL_INLINE int32_t exponentOf(T x) {
+  typename Bits<T>::type y;
+  memcpy(&y, &x, sizeof(T));
+  return static_cast<int32_t>((y >> Bits<T>::mantissa) & Bits<T>::mask) - Bits<T>::bias;
+}
+
+template<typename T>
+KERNEL_INLINE void log2roughLoop(T const* values, size_t n, int32_t* out) {
+  for (size_t i = 0; i < n; ++i) {
+    out[i] = exponentOf(values[i]);
+  }
+}
+
+// exponent of the predecessor of x, see logr_scale_t::log2below
+template<typename T>
+KERNEL_INLINE int32_t exponentBelow(T x) {
+  typename Bits<T>::type y;
+  memcpy(&y, &x, sizeof(T));
+  return static_cast<int32_t>(((y - 1) >> Bits<T>::mantissa) & Bits<T>::mask) - Bits<T>::bias;
+}
+
+// (max(v, inFirst) - low) * mul >= 2^div * 3/4 > 1, so the exponent is
+// never negative and Div is a constant the compiler turns into a
+// multiplication
+template<typename T, uint32_t Div>
+KERNEL_INLINE void logrLoop(LogrParams<T> const& p, T const* values, size_t n, uint32_t* out) {
+  for (size_t i = 0; i < n; ++i) {
+    T t = (values[i] < p.inFirst) ? p.inFirst : values[i];
+    uint32_t l = static_cast<uint32_t>(exponentBelow((t - p.low) * p.mul)) / Div;
+    out[i] = (l < p.last) ? l : p.last;
+  }
+}
+
+template<typename T>
+KERNEL_INLINE void logrLoop(LogrParams<T> const& p, T const* values, size_t n, uint32_t* out) {
+  if (p.div == 1) {
+    logrLoop<T, 1>(p, values, n, out);
+  } else {
+    logrLoop<T, 3>(p, values, n, out);
+  }
+}
+
+#define KERNELS(NAME, TARGET)                                                      \
+  TARGET void NAME##Log2roughDouble(double const* v, size_t n, int32_t* out) {     \
+    log2roughLoop(v, n, out);                                                      \
+  }                                                                                \
+  TARGET void NAME##Log2roughFloat(float const* v, size_t n, int32_t* out) {       \
+    log2roughLoop(v, n, out);                                                      \
+  }                                                                                \
+  TARGET void NAME##LogrDouble(LogrParams<double> const& p, double const* v,      \
+                               size_t n, uint32_t* out) {                          \
+    logrLoop(p, v, n, out);                                                        \
+  }                                                                                \
+  TARGET void NAME##LogrFloat(LogrParams<float> const& p, float const* v,         \
+                              size_t n, uint32_t* out) {                           \
+    logrLoop(p, v, n, out);                                                        \
+  }                                                                                \
+  BucketKernels const NAME##Kernels = {CpuLevel::NAME, NAME##Log2roughDouble,      \
+                                       NAME##Log2roughFloat, NAME##LogrDouble,     \
+                                       NAME##LogrFloat};
+
+KERNELS(Baseline, BASELINE_TARGET)
+#if defined(__x86_64__)
+KERNELS(AVX2, AVX2_TARGET)
+KERNELS(AVX512, AVX512_TARGET)
+#endif
+
+CpuLevel detect() {
+  CpuLevel level = CpuLevel::Baseline;
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    level = CpuLevel::AVX2;
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") &&
+        __builtin_cpu_supports("avx512dq") && __builtin_cpu_supports("avx512vl")) {
+      level = CpuLevel::AVX512;
+    }
+  }
+#endif
+  char const* cap = getenv("METRICS_CPU");
+  if (cap != nullptr) {
+    if (strcmp(cap, "baseline") == 0) {
+      level = CpuLevel::Baseline;
+    } else if (strcmp(cap, "avx2") == 0 && level > CpuLevel::AVX2) {
+      level = CpuLevel::AVX2;
+    }
+  }
+  return level;
+}
+
+// select before main, not on the first histogram count
+BucketKernels const& selected = bucketKernels();
+
+}  // namespace
+
+CpuLevel cpuLevel() {
+  static CpuLevel const level = detect();
+  return level;
+}
+
+char const* cpuLevelName(CpuLevel level) {
+  switch (level) {
+    case CpuLevel::AVX2: return "avx2";
+    case CpuLevel::AVX512: return "avx512";
+    default: return "baseline";
+  }
+}
+
+BucketKernels const& bucketKernelsFor(CpuLevel level) {
+#if defined(__x86_64__)
+  switch (level) {
+    case CpuLevel::AVX2: return AVX2Kernels;
+    case CpuLevel::AVX512: return AVX512Kernels;
+    default: break;
+  }
+#endif
+  return BaselineKernels;
+}
+
+BucketKernels const& bucketKernels() {
+  static BucketKernels const& kernels = bucketKernelsFor(cpuLevel());
+  return kernels;
+}
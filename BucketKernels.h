@@ -0,0 +1,86 @@
+////////////////////////////////////////////////////////////////////////////////
+/// DISCLAIMER
+///
+/// Copyright 2014-2021 ArangoDB GmbH, Cologne, Germany
+/// Copyright 2004-2014 triAGENS GmbH, Cologne, Germany
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     http://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+///
+/// Copyright holder is ArangoDB GmbH, Cologne, Germany
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef ARANGODB_REST_SERVER_BUCKET_KERNELS_H
+#define ARANGODB_REST_SERVER_BUCKET_KERNELS_H 1
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief instruction set levels of the batch bucketing kernels
+ *
+ * Baseline is what the binary is compiled for, AVX2 adds avx2 and fma,
+ * AVX512 adds avx512f/bw/dq/vl.
+ */
+enum class CpuLevel { Baseline = 0, AVX2 = 1, AVX512 = 2 };
+
+/**
+ * @brief the best level this CPU supports
+ *
+ * METRICS_CPU=baseline|avx2|avx512 in the environment caps it, e.g. to
+ * compare the levels on one machine.
+ */
+CpuLevel cpuLevel();
+
+char const* cpuLevelName(CpuLevel level);
+
+/**
+ * @brief logr_scale_t parameters, see logr_scale_t::pos
+ */
+template<typename T>
+struct LogrParams {
+  T low;
+  T mul;
+  T inFirst;
+  int32_t div;
+  uint32_t last;
+};
+
+/**
+ * @brief batch bucketing kernels of one instruction set level
+ *
+ * Each computes the scalar function (log2rough, logr_scale_t::pos) for n
+ * values at once. All levels produce identical results, they are compiled
+ * from the same loops with different target attributes.
+ */
+struct BucketKernels {
+  CpuLevel level;
+  void (*log2roughDouble)(double const* values, size_t n, int32_t* out);
+  void (*log2roughFloat)(float const* values, size_t n, int32_t* out);
+  void (*logrDouble)(LogrParams<double> const& p, double const* values, size_t n, uint32_t* out);
+  void (*logrFloat)(LogrParams<float> const& p, float const* values, size_t n, uint32_t* out);
+};
+
+/**
+ * @brief the kernels for cpuLevel()
+ *
+ * Selected once, at the latest during static initialization; a call costs
+ * an initialization guard check and then one indirect call per batch.
+ */
+BucketKernels const& bucketKernels();
+
+/**
+ * @brief the kernels of a given level, which must be supported
+ */
+BucketKernels const& bucketKernelsFor(CpuLevel level);
+
+#endif
@@ -27,7 +27,14 @@
 #include "Logger/Logger.h"
 #include "Basics/debugging.h"
 #endif
+#include <algorithm>
+#include <limits>
+#include <mutex>
+#include <thread>
 #include <type_traits>
+#include <unordered_map>
+
+#include <time.h>
 
 #if defined ARANGODB_BITS
 using namespace arangodb;
@@ -53,10 +60,78 @@ std::ostream& operator<< (std::ostream& o, Metrics::hist_type const& v) {
   return o;
 }
 
+namespace {
+struct StringTable {
+  std::mutex mutex;
+  std::unordered_map<std::string, size_t> strings;  // string, references
+};
+StringTable& stringTable() {
+  static StringTable table;
+  return table;
+}
+}  // namespace
+
+std::string const& MetricsStrings::intern(std::string const& s) {
+  auto& t = stringTable();
+  std::lock_guard<std::mutex> guard(t.mutex);
+  auto it = t.strings.try_emplace(s, 0).first;
+  ++it->second;
+  return it->first;
+}
+
+void MetricsStrings::release(std::string const& s) {
+  auto& t = stringTable();
+  std::lock_guard<std::mutex> guard(t.mutex);
+  auto it = t.strings.find(s);
+  TRI_ASSERT(it != t.strings.end() && &it->first == &s);
+  if (--it->second == 0) {
+    t.strings.erase(it);
+  }
+}
+
+size_t MetricsStrings::memory() {
+  auto& t = stringTable();
+  std::lock_guard<std::mutex> guard(t.mutex);
+  // node with hash and next pointer, plus the heap buffer beyond SSO
+  size_t m = t.strings.bucket_count() * sizeof(void*);
+  for (auto const& e : t.strings) {
+    m += sizeof(e) + 2 * sizeof(void*);
+    if (e.first.capacity() >= sizeof(std::string)) {
+      m += e.first.capacity() + 1;
+    }
+  }
+  return m;
+}
+
 Metric::Metric(std::string const& name, std::string const& help, std::string const& labels)
-  : _name(name), _help(help), _labels(labels) {};
+  : _name(MetricsStrings::intern(name)), _help(MetricsStrings::intern(help)),
+    _labels(MetricsStrings::intern(labels)) {};
 
-Metric::~Metric() = default;
+void Metric::toOpenMetrics(std::string& result) const {
+  std::string text;
+  toPrometheus(text);
+  size_t pos = 0;
+  while (pos < text.size()) {
+    size_t eol = text.find('\n', pos);
+    eol = (eol == std::string::npos) ? text.size() : eol;
+    std::string_view line(text.data() + pos, eol - pos);
+    pos = eol + 1;
+    if (line.empty()) {
+      continue;
+    }
+    if (line.substr(0, 6) == "#TYPE " || line.substr(0, 6) == "#HELP ") {
+      result.append("# ");
+      line.remove_prefix(1);
+    }
+    result.append(line).append("\n");
+  }
+}
+
+Metric::~Metric() {
+  MetricsStrings::release(_labels);
+  MetricsStrings::release(_help);
+  MetricsStrings::release(_name);
+}
 
 std::string const& Metric::help() const { return _help; }
 std::string const& Metric::name() const { return _name; }
@@ -106,13 +181,30 @@ void Counter::store(uint64_t const& n) {
 
 void Counter::toPrometheus(std::string& result) const {
   _b.push();
-  result += "\n#TYPE " + name() + " counter\n";
-  result += "#HELP " + name() + " " + help() + "\n";
-  result += name();
-  if (!labels().empty()) {
-    result += "{" + labels() + "}";
+  // appended in place, no temporaries per series
+  result.append("\n#TYPE ").append(_name).append(" counter\n");
+  result.append("#HELP ").append(_name).append(" ").append(_help).append("\n");
+  result.append(_name);
+  if (!_labels.empty()) {
+    result.append("{").append(_labels).append("}");
+  }
+  result.append(" ").append(std::to_string(load())).append("\n");
+}
+
+void Counter::toOpenMetrics(std::string& result) const {
+  _b.push();
+  // the family is named without the _total of its sample
+  std::string_view family(_name);
+  if (family.size() > 6 && family.substr(family.size() - 6) == "_total") {
+    family.remove_suffix(6);
   }
-  result += " " + std::to_string(load()) + "\n";
+  result.append("# TYPE ").append(family).append(" counter\n");
+  result.append("# HELP ").append(family).append(" ").append(_help).append("\n");
+  result.append(family).append("_total");
+  if (!_labels.empty()) {
+    result.append("{").append(_labels).append("}");
+  }
+  result.append(" ").append(std::to_string(load())).append("\n");
 }
 
 Counter::Counter(
@@ -122,3 +214,321 @@ Counter::Counter(
 
 Counter::~Counter() { _b.push(); }
 
+uint64_t HistogramSnapshot::count() const {
+  uint64_t sum = 0;
+  for (auto const& n : _counts) {
+    sum += n;
+  }
+  return sum;
+}
+
+void HistogramSnapshot::merge(HistogramSnapshot const& other) {
+  if (_counts.empty()) {
+    _counts.resize(other.size(), 0);
+  }
+  TRI_ASSERT(_counts.size() == other.size());
+  for (size_t i = 0; i < _counts.size(); ++i) {
+    _counts[i] += other[i];
+  }
+}
+
+void HistogramSnapshot::clear() {
+  std::fill(_counts.begin(), _counts.end(), 0);
+}
+
+Exemplars::Exemplars(size_t n, std::chrono::milliseconds interval)
+  : _n(n), _slots(new Slot[n]),
+    _interval(std::chrono::duration_cast<std::chrono::nanoseconds>(interval).count()) {
+  for (size_t i = 0; i < _n; ++i) {
+    Slot& s = _slots[i];
+    s.seq.store(0, std::memory_order_relaxed);
+    s.length.store(0, std::memory_order_relaxed);
+    s.due.store(0, std::memory_order_relaxed);
+    s.value.store(0, std::memory_order_relaxed);
+    s.timestamp.store(0, std::memory_order_relaxed);
+    for (auto& w : s.traceId) {
+      w.store(0, std::memory_order_relaxed);
+    }
+  }
+}
+
+int64_t Exemplars::ticks() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+void Exemplars::store(Slot& s, double value, std::string_view traceId) {
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  s.value.store(bits, std::memory_order_relaxed);
+  // rendered in milliseconds, the coarse clock is precise enough
+  timespec ts;
+  clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+  s.timestamp.store(static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec,
+                    std::memory_order_relaxed);
+  size_t const length = std::min(traceId.size(), maxTraceId);
+  s.length.store(static_cast<uint32_t>(length), std::memory_order_relaxed);
+  for (size_t i = 0; i * 8 < length; ++i) {
+    uint64_t w = 0;
+    memcpy(&w, traceId.data() + i * 8, std::min<size_t>(8, length - i * 8));
+    s.traceId[i].store(w, std::memory_order_relaxed);
+  }
+}
+
+bool Exemplars::load(size_t bucket, Exemplar& e) const {
+  Slot const& s = _slots[bucket];
+  for (int attempt = 0; attempt < 16; ++attempt) {
+    uint32_t const before = s.seq.load(std::memory_order_acquire);
+    if (before == 0) {
+      return false;
+    }
+    if ((before & 1) != 0) {
+      std::this_thread::yield();
+      continue;
+    }
+    uint64_t const bits = s.value.load(std::memory_order_relaxed);
+    int64_t const timestamp = s.timestamp.load(std::memory_order_relaxed);
+    size_t const length = std::min<size_t>(s.length.load(std::memory_order_relaxed), maxTraceId);
+    char id[maxTraceId];
+    for (size_t i = 0; i * 8 < length; ++i) {
+      uint64_t const w = s.traceId[i].load(std::memory_order_relaxed);
+      memcpy(id + i * 8, &w, 8);
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (s.seq.load(std::memory_order_relaxed) == before) {
+      memcpy(&e.value, &bits, sizeof(bits));
+      e.timestamp = static_cast<double>(timestamp) / 1e9;
+      e.traceId.assign(id, length);
+      return true;
+    }
+  }
+  return false;
+}
+
+void Exemplars::render(std::string& result, size_t bucket) const {
+  Exemplar e;
+  if (!load(bucket, e)) {
+    return;
+  }
+  result.append(" # {trace_id=\"");
+  for (char c : e.traceId) {
+    if (c == '\\' || c == '"') {
+      result += '\\';
+      result += c;
+    } else if (c == '\n') {
+      result += "\\n";
+    } else {
+      result += c;
+    }
+  }
+  char tail[64];
+  snprintf(tail, sizeof(tail), "\"} %.9g %.3f", e.value, e.timestamp);
+  result.append(tail);
+}
+
+Cardinality::Cardinality(unsigned precision, std::string const& name,
+                         std::string const& help, std::string const& labels)
+  : Metric(name, help, labels), _p(std::min(std::max(precision, 4u), 18u)),
+    _m(size_t(1) << _p), _registers(new std::atomic<uint8_t>[_m]) {
+  clear();
+}
+
+Cardinality::~Cardinality() = default;
+
+std::vector<uint8_t> Cardinality::registers() const {
+  std::vector<uint8_t> v(_m);
+  for (size_t i = 0; i < _m; ++i) {
+    v[i] = _registers[i].load(std::memory_order_relaxed);
+  }
+  return v;
+}
+
+std::vector<uint8_t> Cardinality::exchange() {
+  std::vector<uint8_t> v(_m);
+  for (size_t i = 0; i < _m; ++i) {
+    v[i] = _registers[i].exchange(0, std::memory_order_relaxed);
+  }
+  return v;
+}
+
+void Cardinality::clear() {
+  for (size_t i = 0; i < _m; ++i) {
+    _registers[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+void Cardinality::merge(Cardinality const& other) {
+  TRI_ASSERT(other.size() == _m);
+  std::vector<uint8_t> v = other.registers();
+  merge(v.data(), v.size());
+}
+
+void Cardinality::merge(uint8_t const* registers, size_t n) {
+  TRI_ASSERT(n == _m);
+  for (size_t i = 0; i < n; ++i) {
+    uint8_t cur = _registers[i].load(std::memory_order_relaxed);
+    while (registers[i] > cur &&
+           !_registers[i].compare_exchange_weak(cur, registers[i], std::memory_order_relaxed)) {
+    }
+  }
+}
+
+void Cardinality::mergeRegisters(uint8_t* __restrict into, uint8_t const* __restrict from,
+                                 size_t n) {
+  // fixed blocks of 64 without aliasing become packed byte max even with
+  // the cheap vectorizer cost model of -O2; n is a power of two >= 16
+  size_t i = 0;
+  for (; i + 64 <= n; i += 64) {
+    for (size_t j = 0; j < 64; ++j) {
+      into[i + j] = into[i + j] < from[i + j] ? from[i + j] : into[i + j];
+    }
+  }
+  for (; i < n; ++i) {
+    into[i] = into[i] < from[i] ? from[i] : into[i];
+  }
+}
+
+double Cardinality::estimate(uint8_t const* registers, size_t n) {
+  // linear counting thresholds of HLL++ for precision 4 .. 18
+  static double const threshold[] = {
+    10, 20, 40, 80, 220, 400, 900, 1800, 3100, 6500, 11500, 20000, 50000,
+    120000, 350000};
+  // a histogram of the ranks (at most 64 - 4 + 1) keeps the loop integer,
+  // four of them so that equal neighbouring ranks do not serialize
+  uint32_t part[4][64] = {{0}};
+  for (size_t i = 0; i + 4 <= n; i += 4) {
+    ++part[0][registers[i] & 63];
+    ++part[1][registers[i + 1] & 63];
+    ++part[2][registers[i + 2] & 63];
+    ++part[3][registers[i + 3] & 63];
+  }
+  uint32_t ranks[64];
+  for (size_t r = 0; r < 64; ++r) {
+    ranks[r] = part[0][r] + part[1][r] + part[2][r] + part[3][r];
+  }
+  double const m = static_cast<double>(n);
+  double sum = 0.;
+  for (int r = 63; r >= 0; --r) {
+    sum = sum * 0.5 + static_cast<double>(ranks[r]);
+  }
+  double alpha = (n == 16) ? 0.673 : (n == 32) ? 0.697 : (n == 64) ? 0.709
+    : 0.7213 / (1. + 1.079 / m);
+  double e = alpha * m * m / sum;
+  if (ranks[0] != 0) {
+    double lc = m * std::log(m / static_cast<double>(ranks[0]));
+    size_t p = 0;
+    while ((size_t(1) << p) < n) {
+      ++p;
+    }
+    // without the bias tables the raw estimate is off below 2.5m, where
+    // the original HyperLogLog switches to linear counting as well
+    if (lc <= threshold[std::min<size_t>(std::max<size_t>(p, 4), 18) - 4] ||
+        e <= 2.5 * m) {
+      return lc;
+    }
+  }
+  return e;
+}
+
+double Cardinality::estimate() const {
+  std::vector<uint8_t> v = registers();
+  return estimate(v.data(), v.size());
+}
+
+void Cardinality::toPrometheus(std::string& result) const {
+  result += "\n#TYPE " + name() + " gauge\n";
+  result += "#HELP " + name() + " " + help() + "\n" + name();
+  if (!labels().empty()) {
+    result += "{" + labels() + "}";
+  }
+  result += " " + std::to_string(std::llround(estimate())) + "\n";
+}
+
+Meter::Meter(std::string const& name, std::string const& help,
+             std::string const& labels, std::chrono::milliseconds interval)
+  : Metric(name, help, labels),
+    _interval(std::chrono::duration_cast<clock::duration>(interval).count()),
+    _due(clock::now().time_since_epoch().count() + _interval),
+    _ticked(0), _initialized(false) {
+  TRI_ASSERT(_interval > 0);
+  double const seconds = std::chrono::duration<double>(interval).count();
+  double const window[windows] = {1., 5., 15.};
+  for (size_t i = 0; i < windows; ++i) {
+    _alpha[i] = 1. - std::exp(-seconds / window[i]);
+    _rates[i].store(0., std::memory_order_relaxed);
+  }
+  for (auto& s : _shards) {
+    s.n.store(0, std::memory_order_relaxed);
+  }
+}
+
+Meter::~Meter() = default;
+
+void Meter::tick(clock::time_point now) {
+  int64_t const t = now.time_since_epoch().count();
+  int64_t due = _due.load(std::memory_order_acquire);
+  if (t < due) {
+    return;
+  }
+  // intervals elapsed, the winner of the exchange folds all of them. While
+  // it folds the due time is parked in the far future, so a tick of the
+  // next interval cannot start a second fold on the same rates; it is
+  // published with the rates once the fold is done.
+  int64_t const elapsed = (t - due) / _interval + 1;
+  if (!_due.compare_exchange_strong(due, std::numeric_limits<int64_t>::max(),
+                                    std::memory_order_acquire)) {
+    return;
+  }
+  uint64_t n = 0;
+  for (auto& s : _shards) {
+    // most shards are idle, a plain load spares their locked exchange
+    if (s.n.load(std::memory_order_relaxed) != 0) {
+      n += s.n.exchange(0, std::memory_order_relaxed);
+    }
+  }
+  _ticked.fetch_add(n, std::memory_order_relaxed);
+  // marks of missed intervals are spread evenly over them, which folds in
+  // closed form: r' = instant + (r - instant) * (1 - alpha)^elapsed
+  double const seconds = static_cast<double>(_interval * elapsed) *
+    clock::period::num / clock::period::den;
+  double const instant = static_cast<double>(n) / seconds;
+  bool const first = !_initialized.exchange(true, std::memory_order_relaxed);
+  for (size_t i = 0; i < windows; ++i) {
+    double r = instant;
+    if (!first) {
+      double decay = 1. - _alpha[i];
+      if (elapsed > 1) {
+        decay = std::pow(decay, static_cast<double>(elapsed));
+      }
+      r += (_rates[i].load(std::memory_order_relaxed) - instant) * decay;
+    }
+    _rates[i].store(r, std::memory_order_relaxed);
+  }
+  _due.store(due + elapsed * _interval, std::memory_order_release);
+}
+
+uint64_t Meter::count() const {
+  uint64_t n = _ticked.load(std::memory_order_relaxed);
+  for (auto const& s : _shards) {
+    n += s.n.load(std::memory_order_relaxed);
+  }
+  return n;
+}
+
+void Meter::toPrometheus(std::string& result) const {
+  static char const* const window[windows] = {"1s", "5s", "15s"};
+  result += "\n#TYPE " + name() + " gauge\n";
+  result += "#HELP " + name() + " " + help() + "\n";
+  std::string lbs = labels();
+  auto const separator = !lbs.empty() && lbs.back() != ',';
+  for (size_t i = 0; i < windows; ++i) {
+    char value[32];
+    snprintf(value, sizeof(value), "%g", rate(i));
+    result += name() + "{" + lbs;
+    if (separator) {
+      result += ",";
+    }
+    result += "window=\"" + std::string(window[i]) + "\"} " + value + "\n";
+  }
+}
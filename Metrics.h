@@ -24,12 +24,23 @@
 #ifndef ARANGODB_REST_SERVER_METRICS_H
 #define ARANGODB_REST_SERVER_METRICS_H 1
 
+#include <algorithm>
+#include <array>
 #include <atomic>
+#include <chrono>
 #include <cmath>
+#include <cstdio>
+#include <functional>
 #include <iostream>
 #include <limits>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <string_view>
 #include <string.h>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #if defined ARANGODB_BITS
@@ -43,8 +54,33 @@
 #define TRI_ASSERT(x) assert(x)
 #endif
 
+#include "BucketKernels.h"
 #include "counter.h"
 
+/**
+ * @brief process-wide table of metric names, help texts and label sets
+ *
+ * Series of one metric share name and help, many share label sets, so
+ * every Metric only holds references into this table. Entries are counted,
+ * every intern() takes a reference which release() gives back, and the last
+ * release removes the entry; until then its address is stable. A Metric
+ * releases its strings when destroyed, so dynamic label sets do not pile up.
+ */
+class MetricsStrings {
+ public:
+  static std::string const& intern(std::string const& s);
+
+  /**
+   * @brief give back a reference taken by intern(), s must be its result
+   */
+  static void release(std::string const& s);
+
+  /**
+   * @brief approximate bytes held by the table
+   */
+  static size_t memory();
+};
+
 class Metric {
  public:
   Metric(std::string const& name, std::string const& help, std::string const& labels);
@@ -53,17 +89,29 @@ class Metric {
   std::string const& name() const;
   std::string const& labels() const;
   virtual void toPrometheus(std::string& result) const = 0;
+
+  /**
+   * @brief OpenMetrics 1.0 text of this metric, without the final # EOF
+   *
+   * The default rewrites toPrometheus() with "# TYPE" and "# HELP" and
+   * without empty lines, which suits gauges. Counters add the _total
+   * suffix, histograms render cumulative buckets and their exemplars.
+   */
+  virtual void toOpenMetrics(std::string& result) const;
   void header(std::string& result) const;
  protected:
-  std::string const _name;
-  std::string const _help;
-  std::string const _labels;
+  std::string const& _name;
+  std::string const& _help;
+  std::string const& _labels;
 };
 
 struct Metrics {
   using counter_type = gcl::counter::simplex<uint64_t, gcl::counter::atomicity::full>;
   using hist_type = gcl::counter::simplex_array<uint64_t, gcl::counter::atomicity::full>;
   using buffer_type = gcl::counter::buffer<uint64_t, gcl::counter::atomicity::full, gcl::counter::atomicity::full>;
+  using numa_hist_type = gcl::counter::numa_simplex_array<uint64_t>;
+  using large_hist_type = gcl::counter::simplex_array<
+    uint64_t, gcl::counter::atomicity::full, gcl::counter::huge_page_allocator<uint64_t>>;
 };
 
 
@@ -87,6 +135,7 @@ class Counter : public Metric {
   void store(uint64_t const&);
   void push();
   virtual void toPrometheus(std::string&) const override;
+  virtual void toOpenMetrics(std::string&) const override;
  private:
   mutable Metrics::counter_type _c;
   mutable Metrics::buffer_type _b;
@@ -289,6 +338,10 @@ struct fixed_scale_t : public scale_t<T> {
       : scale_t<T>(low, high, list.size() + 1) {
     this->_delim = list;
   }
+  fixed_scale_t(T const& low, T const& high, std::vector<T> const& delims)
+      : scale_t<T>(low, high, delims.size() + 1) {
+    this->_delim = delims;
+  }
   virtual ~fixed_scale_t() = default;
   /**
    * @brief index for val
@@ -343,13 +396,22 @@ struct log_scale_t : public scale_t<T> {
    * @return    index
    */
   size_t pos(T const& val) const {
-    if (val < this->_delim.front()) {
+    auto const& d = this->_delim;
+    if (!(val > d.front())) {
       return 0;
-    } else if (val >= this->high()) {
-      return _n;
-    } else {
-      return static_cast<size_t>(1+std::floor((log(val - this->_low)-this->_div)/this->_lbase));
+    } else if (val > d.back()) {
+      return this->n() - 1;
     }
+    // bucket i is (delim[i-1], delim[i]], the logarithm is off by one on
+    // and next to the delimiters
+    double l = std::floor((log(val - this->_low) - this->_div) / this->_lbase);
+    size_t p = (l < 0.) ? 1 : std::min(static_cast<size_t>(l) + 1, this->n() - 1);
+    if (val <= d[p - 1]) {
+      --p;
+    } else if (p < this->n() - 1 && val > d[p]) {
+      ++p;
+    }
+    return p;
   }
 #if defined ARANGODB_BITS
   /**
@@ -415,14 +477,31 @@ struct logr_scale_t : public scale_t<T> {
     // In the end, we compute the bucket with this formula:
     //   log2rough((val - low) * _mul) / _div
     // where _div is 1 for base 2 and 3 for base 8.
-    // We only have to be careful for the boundaries.
+    // We only have to be careful for the boundaries: bucket i is
+    // (delim[i-1], delim[i]] like its le label, so pos() takes the
+    // exponent of the predecessor of the product, which puts a power of
+    // two into the bucket below. The product rounds, so each delimiter is
+    // then moved to the largest value whose product does not exceed its
+    // power of two, and pos() agrees with the delimiters exactly.
     _mul = static_cast<T>(
               std::pow((double) base, (double) n) / (double) (high - low));
+    _div = (base == 2) ? 1 : 3;
     for (size_t i = 0; i < n-1; ++i) {
-      this->_delim[i] = low + std::pow((double) base, (double) i+1) / _mul;
+      T d = low + std::pow((double) base, (double) i+1) / _mul;
+      if constexpr (std::is_floating_point<T>::value) {
+        T const limit = static_cast<T>(std::ldexp(1., _div * static_cast<int>(i + 1)));
+        T const inf = std::numeric_limits<T>::infinity();
+        while (product(d) > limit) {
+          d = std::nextafter(d, -inf);
+        }
+        while (product(std::nextafter(d, inf)) <= limit) {
+          d = std::nextafter(d, inf);
+        }
+      }
+      this->_delim[i] = d;
     }
-    _div = (base == 2) ? 1 : 3;
-    _inFirst = (this->_low + this->_delim[0]) / 2;
+    // the product is 2^_div * 3/4 here, safely above 1
+    _inFirst = this->_low + (this->_delim[0] - this->_low) * T(3) / T(4);
   }
   virtual ~logr_scale_t() = default;
   /**
@@ -433,11 +512,37 @@ struct logr_scale_t : public scale_t<T> {
 
   size_t pos(T const& val) const {
     T tmp = (val < this->_inFirst) ? this->_inFirst : val;
-    int32_t l = log2rough((tmp - this->_low) * _mul) / _div;
+    int32_t l = log2below(product(tmp)) / _div;
     size_t p = static_cast<size_t>(l);
     return (p < this->_n) ? p : this->_n - 1;
   }
 
+  /**
+   * @brief indexes for n values at once, out[i] == pos(values[i])
+   *
+   * double and float go through the kernels selected for this CPU at
+   * startup, see BucketKernels.h.
+   */
+  void pos(T const* values, size_t n, uint32_t* out) const {
+    if constexpr (std::is_same_v<T, double>) {
+      bucketKernels().logrDouble(params(), values, n, out);
+    } else if constexpr (std::is_same_v<T, float>) {
+      bucketKernels().logrFloat(params(), values, n, out);
+    } else {
+      for (size_t i = 0; i < n; ++i) {
+        out[i] = static_cast<uint32_t>(pos(values[i]));
+      }
+    }
+  }
+
+  /**
+   * @brief parameters for the batch kernels
+   */
+  LogrParams<T> params() const {
+    return LogrParams<T>{this->_low, _mul, _inFirst, _div,
+                         static_cast<uint32_t>(this->_n - 1)};
+  }
+
 #if defined ARANGODB_BITS
   /**
    * @brief Dump to builder
@@ -458,6 +563,26 @@ struct logr_scale_t : public scale_t<T> {
   }
 
  private:
+  T product(T val) const {
+    return (val - this->_low) * _mul;
+  }
+
+  /**
+   * @brief log2rough of the predecessor of x > 0
+   */
+  static int32_t log2below(T x) {
+    if constexpr (std::is_same<T, float>::value) {
+      uint32_t y;
+      memcpy(&y, &x, 4);
+      return static_cast<int32_t>(((y - 1) >> 23) & 0xff) - 127;
+    } else {
+      double d = static_cast<double>(x);
+      uint64_t y;
+      memcpy(&y, &d, 8);
+      return static_cast<int32_t>(((y - 1) >> 52) & 0x7ff) - 1023;
+    }
+  }
+
   T _base;
   T _mul;
   T _inFirst;
@@ -491,7 +616,22 @@ struct lin_scale_t : public scale_t<T> {
    * @return    index
    */
   size_t pos(T const& val) const {
-    return static_cast<size_t>(std::floor((val - this->_low)/ _div));
+    auto const& d = this->_delim;
+    if (!(val > d.front())) {
+      return 0;
+    } else if (val > d.back()) {
+      return this->_n - 1;
+    }
+    // bucket i is (delim[i-1], delim[i]], the delimiters are sums of _div
+    // and the quotient is off by one on and next to them
+    size_t p = static_cast<size_t>((val - this->_low) / _div);
+    p = std::min(std::max(p, size_t(1)), this->_n - 1);
+    if (val <= d[p - 1]) {
+      --p;
+    } else if (p < this->_n - 1 && val > d[p]) {
+      ++p;
+    }
+    return p;
   }
 
 #if defined ARANGODB_BITS
@@ -505,28 +645,567 @@ struct lin_scale_t : public scale_t<T> {
   T _base, _div;
 };
 
+/**
+ * @brief floor(x * n / range) for 0 <= x < range, without division
+ *
+ * Shifts when range / n is a power of two. Otherwise multiplies by the
+ * fixed-point reciprocal c = ceil(n * 2^L / range) and keeps the high bits,
+ * which is exact for L = 64 up to a range of 2^32 and for L = 128 beyond.
+ * Wide selects the two multiplication form that L = 128 needs; with a range
+ * up to 2^32 it is exact as well, just slower.
+ */
+class lin_reciprocal {
+ public:
+  lin_reciprocal(uint64_t range, size_t n)
+    : _range(range), _mulHi(0), _mulLo(0), _shift(-1) {
+    TRI_ASSERT(n > 0 && n <= range);
+    using u128 = unsigned __int128;
+    if (range % n == 0 && __builtin_popcountll(range / n) == 1) {
+      _shift = __builtin_ctzll(range / n);
+    } else if (range <= (uint64_t(1) << 32)) {
+      u128 num = static_cast<u128>(n) << 64;
+      _mulHi = static_cast<uint64_t>(num / range) + (num % range != 0 ? 1 : 0);
+    } else {
+      u128 num = static_cast<u128>(n) << 64;
+      u128 hi = num / range;
+      num = (num % range) << 64;
+      u128 c = (hi << 64) + num / range + (num % range != 0 ? 1 : 0);
+      _mulHi = static_cast<uint64_t>(c >> 64);
+      _mulLo = static_cast<uint64_t>(c);
+    }
+  }
+
+  uint64_t range() const { return _range; }
+
+  template<bool Wide>
+  size_t div(uint64_t x) const {
+    using u128 = unsigned __int128;
+    if (_shift >= 0) {
+      return static_cast<size_t>(x >> _shift);
+    }
+    if constexpr (Wide) {
+      u128 lo = (static_cast<u128>(x) * _mulLo) >> 64;
+      return static_cast<size_t>((static_cast<u128>(x) * _mulHi + lo) >> 64);
+    } else {
+      return static_cast<size_t>((static_cast<u128>(x) * _mulHi) >> 64);
+    }
+  }
+
+ private:
+  uint64_t _range;
+  uint64_t _mulHi, _mulLo;
+  int _shift;
+};
+
+/**
+ * @brief linear scale for integers, without division when counting
+ *
+ * Value v goes to bucket floor((v - low) * n / (high - low)), exactly, also
+ * when high - low is not a multiple of n. Values below low count into the
+ * first bucket, values from high on into the last. The delimiters are the
+ * largest value of each bucket, i.e. "le" bounds. pos() clamps with
+ * conditional moves and divides with a lin_reciprocal: a shift for power of
+ * two bucket widths, else one multiplication for 32 bit values and two for
+ * 64 bit values.
+ */
+template<typename T>
+struct int_lin_scale_t : public scale_t<T> {
+  static_assert(std::is_integral<T>::value && sizeof(T) <= 8,
+                "int_lin_scale_t is for integers up to 64 bits");
+ public:
+
+  using value_type = T;
+  static constexpr ScaleType scale_type = Linear;
+
+  int_lin_scale_t(T const& low, T const& high, size_t n) :
+    scale_t<T>(low, high, n),
+    _div(static_cast<uint64_t>(high) - static_cast<uint64_t>(low), n) {
+    TRI_ASSERT(low < high);
+    using u128 = unsigned __int128;
+    for (size_t i = 0; i < n - 1; ++i) {
+      u128 end = (static_cast<u128>(i + 1) * _div.range() + n - 1) / n;
+      this->_delim[i] = static_cast<T>(static_cast<uint64_t>(low) + static_cast<uint64_t>(end) - 1);
+    }
+  }
+  virtual ~int_lin_scale_t() = default;
+  /**
+   * @brief index for val
+   * @param val value
+   * @return    index
+   */
+  size_t pos(T const& val) const {
+    uint64_t x = static_cast<uint64_t>(val) - static_cast<uint64_t>(this->_low);
+    x = (val < this->_low) ? 0 : x;
+    x = (x < _div.range()) ? x : _div.range() - 1;
+    return _div.template div<(sizeof(T) > 4)>(x);
+  }
+
+#if defined ARANGODB_BITS
+  virtual void toVelocyPack(VPackBuilder& b) const override {
+    b.add("scale-type", VPackValue("linear"));
+    scale_t<T>::toVelocyPack(b);
+  }
+#endif
+
+ private:
+  lin_reciprocal _div;
+};
+
+/**
+ * @brief scale over given boundaries, counting with the fastest exact kernel
+ *
+ * pos(v) is the number of boundaries below v, as for fixed_scale_t: bucket
+ * i holds (b[i-1], b[i]]. make_scale() looks at the boundaries and picks
+ *   Linear    equidistant boundaries; integers divide with a lin_reciprocal
+ *             (a shift for power of two widths), floating point values
+ *             multiply by the inverse width
+ *   Exponent  boundaries b[0] * 2^(k*i) with b[0] > 0; the bucket follows
+ *             from the binary exponent of v
+ *   Compare   up to 16 other boundaries, padded to 16 and found with
+ *             four unrolled compare steps
+ *   Search    anything else, branchless binary search
+ * Unless the boundaries are exact powers of two the exponent kernel, like
+ * the floating point linear one, only guesses and then steps to the exact
+ * bucket by comparing with the neighbouring boundaries. The constructor checks the
+ * chosen kernel against a plain count on and next to every boundary and
+ * falls back to Search if it disagrees.
+ */
+template<typename T>
+struct auto_scale_t : public scale_t<T> {
+ public:
+
+  using value_type = T;
+  static constexpr ScaleType scale_type = Fixed;
+  static constexpr size_t compareMax = 16;
+
+  enum class Kernel { Linear, Exponent, Compare, Search };
+
+  explicit auto_scale_t(std::vector<T> const& bounds)
+    : scale_t<T>(nonEmpty(bounds).front(), bounds.back(), bounds.size() + 1),
+      _kernel(Kernel::Search), _div(1, 1), _inv(0), _e0(0), _kmul(0), _exact(false) {
+    TRI_ASSERT(std::is_sorted(bounds.begin(), bounds.end()));
+    this->_delim = bounds;
+    _cmp.fill(std::numeric_limits<T>::has_infinity ? std::numeric_limits<T>::infinity()
+                                                   : std::numeric_limits<T>::max());
+    if (linear() || exponent() || compare()) {
+      if (!verify()) {
+        _kernel = Kernel::Search;
+      }
+    }
+  }
+  virtual ~auto_scale_t() = default;
+
+  Kernel kernel() const { return _kernel; }
+
+  char const* kernelName() const {
+    switch (_kernel) {
+      case Kernel::Linear: return "linear";
+      case Kernel::Exponent: return "exponent";
+      case Kernel::Compare: return "compare";
+      default: return "search";
+    }
+  }
+
+  /**
+   * @brief index for val
+   * @param val value
+   * @return    index
+   */
+  size_t pos(T const& val) const {
+    switch (_kernel) {
+      case Kernel::Linear: return posLinear(val);
+      case Kernel::Exponent: return posExponent(val);
+      case Kernel::Compare: return posCompare(val);
+      default: return posSearch(val);
+    }
+  }
+
+  /**
+   * @brief reference: count of boundaries below val
+   */
+  size_t reference(T const& val) const {
+    return static_cast<size_t>(
+      std::lower_bound(this->_delim.begin(), this->_delim.end(), val) - this->_delim.begin());
+  }
+
+#if defined ARANGODB_BITS
+  virtual void toVelocyPack(VPackBuilder& b) const override {
+    b.add("scale-type", VPackValue("fixed"));
+    scale_t<T>::toVelocyPack(b);
+  }
+#endif
+
+ private:
+  static std::vector<T> const& nonEmpty(std::vector<T> const& bounds) {
+    TRI_ASSERT(!bounds.empty());
+    return bounds;
+  }
+
+  bool linear() {
+    auto const& b = this->_delim;
+    size_t const m = b.size();
+    if (m < 2 || !(b[0] < b[m - 1])) {
+      return false;
+    }
+    if constexpr (std::is_integral<T>::value) {
+      // widths in uint64_t like posLinear, they overflow a signed T
+      uint64_t const w = static_cast<uint64_t>(b[1]) - static_cast<uint64_t>(b[0]);
+      for (size_t i = 1; i < m; ++i) {
+        if (static_cast<uint64_t>(b[i]) - static_cast<uint64_t>(b[i - 1]) != w ||
+            b[i] <= b[i - 1]) {
+          return false;
+        }
+      }
+      using u128 = unsigned __int128;
+      u128 range = static_cast<u128>(static_cast<uint64_t>(b[m - 1]) - static_cast<uint64_t>(b[0])) +
+        w;
+      if (range > (sizeof(T) > 4 ? u128(UINT64_MAX) : u128(uint64_t(1) << 32))) {
+        return false;
+      }
+      _div = lin_reciprocal(static_cast<uint64_t>(range), m);
+    } else {
+      double const w = (static_cast<double>(b[m - 1]) - static_cast<double>(b[0])) / (m - 1);
+      for (size_t i = 1; i < m; ++i) {
+        double d = static_cast<double>(b[i]) - static_cast<double>(b[i - 1]);
+        // a rough guess is enough, pos() steps to the exact bucket
+        if (!(std::fabs(d - w) <= w * 1e-3)) {
+          return false;
+        }
+      }
+      _inv = static_cast<T>(1. / w);
+    }
+    _kernel = Kernel::Linear;
+    return true;
+  }
+
+  bool exponent() {
+    auto const& b = this->_delim;
+    size_t const m = b.size();
+    if (m < 2 || !(b[0] > T(0))) {
+      return false;
+    }
+    int k = 0;
+    _exact = isPow2(b[0]);
+    for (size_t i = 1; i < m; ++i) {
+      double r = std::log2(static_cast<double>(b[i]) / static_cast<double>(b[i - 1]));
+      int ki = static_cast<int>(std::lround(r));
+      if (ki < 1 || (k != 0 && ki != k) || !(std::fabs(r - ki) <= 1e-9)) {
+        return false;
+      }
+      if constexpr (std::is_integral<T>::value) {
+        if (static_cast<uint64_t>(b[i]) != (static_cast<uint64_t>(b[i - 1]) << ki)) {
+          return false;
+        }
+      } else {
+        _exact = _exact && b[i] == std::ldexp(b[i - 1], ki);
+      }
+      k = ki;
+    }
+    if constexpr (std::is_integral<T>::value) {
+      _e0 = 63 - __builtin_clzll(static_cast<uint64_t>(b[0]));
+    } else {
+      _e0 = log2rough(b[0]);
+    }
+    _kmul = ((uint64_t(1) << 32) + k - 1) / k;
+    _kernel = Kernel::Exponent;
+    return true;
+  }
+
+  bool compare() {
+    if (this->_delim.size() > compareMax) {
+      return false;
+    }
+    std::copy(this->_delim.begin(), this->_delim.end(), _cmp.begin());
+    _kernel = Kernel::Compare;
+    return true;
+  }
+
+  bool verify() const {
+    std::vector<T> probes = {std::numeric_limits<T>::lowest(), T(0), std::numeric_limits<T>::max()};
+    for (T const& v : this->_delim) {
+      probes.push_back(v);
+      if constexpr (std::is_integral<T>::value) {
+        if (v != std::numeric_limits<T>::max()) {
+          probes.push_back(v + 1);
+        }
+        if (v != std::numeric_limits<T>::lowest()) {
+          probes.push_back(v - 1);
+        }
+      } else {
+        probes.push_back(std::nextafter(v, std::numeric_limits<T>::infinity()));
+        probes.push_back(std::nextafter(v, -std::numeric_limits<T>::infinity()));
+      }
+    }
+    for (T const& v : probes) {
+      if (pos(v) != reference(v)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  static bool isPow2(T const& v) {
+    if constexpr (std::is_integral<T>::value) {
+      return (v & (v - 1)) == 0;
+    } else {
+      int e;
+      return std::frexp(v, &e) == T(0.5);
+    }
+  }
+
+  size_t fixup(T const& val, size_t i) const {
+    auto const& b = this->_delim;
+    while (i > 0 && !(b[i - 1] < val)) {
+      --i;
+    }
+    while (i < b.size() && b[i] < val) {
+      ++i;
+    }
+    return i;
+  }
+
+  size_t posLinear(T const& val) const {
+    T const origin = this->_delim.front();
+    if constexpr (std::is_integral<T>::value) {
+      uint64_t x = static_cast<uint64_t>(val) - static_cast<uint64_t>(origin) - 1;
+      bool const above = origin < val;
+      x = above ? x : 0;
+      x = (x < _div.range()) ? x : _div.range() - 1;
+      return static_cast<size_t>(above) + _div.template div<(sizeof(T) > 4)>(x);
+    } else {
+      size_t const m = this->_delim.size();
+      T g = (val - origin) * _inv;
+      size_t i = 0;
+      if (g > T(0)) {
+        if (g < static_cast<T>(m)) {
+          i = static_cast<size_t>(g);
+          i += (static_cast<T>(i) < g) ? 1 : 0;
+        } else {
+          i = m;
+        }
+      }
+      return fixup(val, i);
+    }
+  }
+
+  size_t posExponent(T const& val) const {
+    if (!(this->_delim.front() < val)) {
+      return 0;
+    }
+    size_t const m = this->_delim.size();
+    int e;
+    if constexpr (std::is_integral<T>::value) {
+      e = 63 - __builtin_clzll(static_cast<uint64_t>(val) - 1);
+    } else if constexpr (sizeof(T) == 8) {
+      uint64_t y;
+      memcpy(&y, &val, 8);
+      e = static_cast<int>(((y - 1) >> 52) & 0x7ff) - 1023;
+    } else {
+      uint32_t y;
+      memcpy(&y, &val, 4);
+      e = static_cast<int>(((y - 1) >> 23) & 0xff) - 127;
+    }
+    size_t i = ((static_cast<uint64_t>(e - _e0) * _kmul) >> 32) + 1;
+    i = (i < m) ? i : m;
+    return _exact ? i : fixup(val, i);
+  }
+
+  size_t posCompare(T const& val) const {
+    size_t i = (_cmp[7] < val) ? 8 : 0;
+    i += (_cmp[i + 3] < val) ? 4 : 0;
+    i += (_cmp[i + 1] < val) ? 2 : 0;
+    i += (_cmp[i] < val) ? 1 : 0;
+    return i + ((_cmp[i] < val) ? 1 : 0);
+  }
+
+  size_t posSearch(T const& val) const {
+    T const* base = this->_delim.data();
+    size_t len = this->_delim.size();
+    while (len > 1) {
+      size_t half = len / 2;
+      base = (base[half] < val) ? base + half : base;
+      len -= half;
+    }
+    return static_cast<size_t>(base - this->_delim.data()) + ((*base < val) ? 1 : 0);
+  }
+
+  Kernel _kernel;
+  lin_reciprocal _div;
+  T _inv;
+  int _e0;
+  uint64_t _kmul;
+  bool _exact;
+  std::array<T, compareMax> _cmp;
+};
+
+/**
+ * @brief the fastest exact scale for these boundaries, see auto_scale_t
+ */
+template<typename T>
+auto_scale_t<T> make_scale(std::vector<T> const& bounds) {
+  return auto_scale_t<T>(bounds);
+}
+
+/**
+ * @brief the fastest exact scale for the delimiters of another scale
+ */
+template<typename T>
+auto_scale_t<T> make_scale(scale_t<T> const& scale) {
+  return auto_scale_t<T>(scale.delims());
+}
+
+/**
+ * @brief bucket counts moved out of a Histogram by exchange()
+ *
+ * Snapshots of consecutive intervals can be merged into a long-lived
+ * cumulative snapshot, which Histogram::toPrometheus renders as well.
+ */
+class HistogramSnapshot {
+ public:
+  HistogramSnapshot() = default;
+  explicit HistogramSnapshot(size_t n) : _counts(n, 0) {}
+  size_t size() const { return _counts.size(); }
+  uint64_t operator[](size_t i) const { return _counts[i]; }
+  uint64_t& operator[](size_t i) { return _counts[i]; }
+  std::vector<uint64_t> const& counts() const { return _counts; }
+  uint64_t count() const;
+  void merge(HistogramSnapshot const&);
+  void clear();
+ private:
+  std::vector<uint64_t> _counts;
+};
+
+/**
+ * @brief one exemplar per histogram bucket, see Histogram::enableExemplars
+ *
+ * Every bucket has a slot guarded by its own seqlock. A writer first checks
+ * the slot's due time, so within the sampling interval offer() costs a
+ * coarse clock read and one load. Past it, the writer that wins the
+ * sequence number stores value, timestamp and trace id, the others drop
+ * theirs. Readers retry until they see an even, unchanged sequence number.
+ * All slot fields are atomics, so torn reads are detected, not undefined.
+ */
+class Exemplars {
+ public:
+  static constexpr size_t maxTraceId = 64;
+
+  struct Exemplar {
+    double value;
+    double timestamp;  // seconds since the epoch
+    std::string traceId;
+  };
+
+  Exemplars(size_t n, std::chrono::milliseconds interval);
+  Exemplars(Exemplars const&) = delete;
+
+  /**
+   * @brief keep value and traceId for bucket if its interval has passed
+   * @return whether the exemplar was stored
+   */
+  bool offer(size_t bucket, double value, std::string_view traceId) {
+    Slot& s = _slots[bucket];
+    int64_t const now = ticks();
+    if (now < s.due.load(std::memory_order_relaxed)) {
+      return false;
+    }
+    uint32_t seq = s.seq.load(std::memory_order_relaxed);
+    if ((seq & 1) != 0 ||
+        !s.seq.compare_exchange_strong(seq, seq + 1, std::memory_order_relaxed)) {
+      return false;
+    }
+    // another writer may have taken this interval between the check and
+    // the exchange, nothing was written yet
+    if (now < s.due.load(std::memory_order_relaxed)) {
+      s.seq.store(seq, std::memory_order_relaxed);
+      return false;
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+    s.due.store(now + _interval, std::memory_order_relaxed);
+    store(s, value, traceId);
+    s.seq.store(seq + 2, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * @brief a consistent copy of bucket's exemplar, false if there is none
+   * or writers kept it busy
+   */
+  bool load(size_t bucket, Exemplar& e) const;
+
+  /**
+   * @brief append " # {trace_id=...} value timestamp" for bucket, if any
+   */
+  void render(std::string& result, size_t bucket) const;
+
+  size_t size() const { return _n; }
+
+ private:
+  struct alignas(64) Slot {
+    std::atomic<uint32_t> seq;
+    std::atomic<uint32_t> length;
+    std::atomic<int64_t> due;
+    std::atomic<uint64_t> value;
+    std::atomic<int64_t> timestamp;  // system clock, nanoseconds
+    std::atomic<uint64_t> traceId[maxTraceId / 8];
+  };
+
+  /**
+   * @brief CLOCK_MONOTONIC_COARSE in nanoseconds, a few ns per call
+   */
+  static int64_t ticks();
+
+  static void store(Slot& s, double value, std::string_view traceId);
+
+  size_t _n;
+  std::unique_ptr<Slot[]> _slots;
+  int64_t const _interval;  // nanoseconds
+};
+
+template<typename Scale, typename = void>
+struct has_batch_pos : std::false_type {};
+
+template<typename Scale>
+struct has_batch_pos<Scale, std::void_t<decltype(std::declval<Scale const&>().pos(
+  std::declval<typename Scale::value_type const*>(), size_t(0), std::declval<uint32_t*>()))>>
+  : std::true_type {};
 
 /**
  * @brief Histogram functionality
+ *
+ * Storage is the bucket counter array, any of simplex_array (at any
+ * atomicity), strong_duplex_array or weak_duplex_array from counter.h.
+ * Use simplex_array with atomicity::semi for single writer histograms, a
+ * duplex array for many writers, each counting through its own broker:
+ *
+ *   Histogram<logr_scale_t<double>, gcl::counter::weak_duplex_array<uint64_t>> h(...);
+ *   thread_local gcl::counter::weak_broker_array<uint64_t> b(h.storage());
+ *   h.count(b, 42.0);
+ *
+ * A buffer_array on h.storage() works the same way for simplex storage.
+ * Metrics::numa_hist_type keeps one bucket array per NUMA node and counts
+ * into the array of the calling thread's node. Metrics::large_hist_type
+ * puts very many buckets on huge pages.
  */
-template<typename Scale> class Histogram : public Metric {
+template<typename Scale, typename Storage = Metrics::hist_type>
+class Histogram : public Metric {
 
  public:
 
   using value_type = typename Scale::value_type;
+  using storage_type = Storage;
 
   Histogram() = delete;
 
   Histogram(Scale&& scale, std::string const& name, std::string const& help,
             std::string const& labels = std::string())
-    : Metric(name, help, labels), _c(Metrics::hist_type(scale.n())), _scale(std::move(scale)),
+    : Metric(name, help, labels), _c(scale.n()), _scale(std::move(scale)),
       _lowr(std::numeric_limits<value_type>::max()),
       _highr(std::numeric_limits<value_type>::min()),
       _n(_scale.n() - 1) {}
 
   Histogram(Scale const& scale, std::string const& name, std::string const& help,
             std::string const& labels = std::string())
-    : Metric(name, help, labels), _c(Metrics::hist_type(scale.n())), _scale(scale),
+    : Metric(name, help, labels), _c(scale.n()), _scale(scale),
       _lowr(std::numeric_limits<value_type>::max()),
       _highr(std::numeric_limits<value_type>::min()),
       _n(_scale.n() - 1) {}
@@ -541,7 +1220,7 @@ template<typename Scale> class Histogram : public Metric {
     }
   }
 
-  Scale const& scale() {
+  Scale const& scale() const {
     return _scale;
   }
 
@@ -559,10 +1238,99 @@ template<typename Scale> class Histogram : public Metric {
     records(t);
 #endif
   }
+
+  /**
+   * @brief count t and offer it as exemplar of its bucket with traceId
+   *
+   * Without enableExemplars() this is count(t).
+   */
+  void count(value_type const& t, std::string_view traceId) {
+    size_t const p = _scale.pos(t);
+    _c[p] += 1;
+    if (_exemplars != nullptr) {
+      _exemplars->offer(p, static_cast<double>(t), traceId);
+    }
+#ifdef USE_MAINTAINER_MODE
+    records(t);
+#endif
+  }
+
+  /**
+   * @brief keep one exemplar per bucket, replaced at most once per interval
+   *
+   * Exemplars are exported with the buckets by toOpenMetrics(), the
+   * Prometheus text format has no syntax for them. Call before counting
+   * starts, it is not synchronized with count().
+   */
+  void enableExemplars(std::chrono::milliseconds interval = std::chrono::seconds(1)) {
+    _exemplars = std::make_unique<Exemplars>(size(), interval);
+  }
+
+  Exemplars const* exemplars() const {
+    return _exemplars.get();
+  }
+
+  /**
+   * @brief count n values, bucketed in blocks by the scale's batch pos
+   *
+   * Scales without a batch pos (only logr_scale_t has one) are bucketed
+   * one value at a time. The values are summed per bucket in a thread
+   * local array first, so the storage sees one add per non-empty bucket
+   * rather than one atomic add per value; the counts end up the same as
+   * with count() per value.
+   */
+  void countBatch(value_type const* values, size_t n) {
+    constexpr size_t block = 256;
+    uint32_t p[block];
+    // all zero between calls, only the non-empty buckets are reset
+    thread_local std::vector<uint64_t> sums;
+    if (sums.size() < size()) {
+      sums.resize(size());
+    }
+    for (size_t i = 0; i < n; i += block) {
+      size_t m = std::min(block, n - i);
+      if constexpr (has_batch_pos<Scale>::value) {
+        _scale.pos(values + i, m, p);
+      } else {
+        for (size_t j = 0; j < m; ++j) {
+          p[j] = static_cast<uint32_t>(_scale.pos(values[i + j]));
+        }
+      }
+      for (size_t j = 0; j < m; ++j) {
+        ++sums[p[j]];
+      }
+    }
+    for (size_t b = 0; b < size(); ++b) {
+      if (sums[b] != 0) {
+        _c[b] += sums[b];
+        sums[b] = 0;
+      }
+    }
+#ifdef USE_MAINTAINER_MODE
+    for (size_t i = 0; i < n; ++i) {
+      records(values[i]);
+    }
+#endif
+  }
+
+  /**
+   * @brief count through a broker or buffer attached to storage()
+   */
+  template<typename Proxy>
+  void count(Proxy& p, value_type const& t, uint64_t n = 1) {
+    p[_scale.pos(t)]+=n;
+#ifdef USE_MAINTAINER_MODE
+    records(t);
+#endif
+  }
+
+  Storage& storage() {
+    return _c;
+  }
   value_type const& low() const { return _scale.low(); }
   value_type const& high() const { return _scale.high(); }
 
-  Metrics::hist_type::value_type& operator[](size_t n) {
+  typename Storage::value_type& operator[](size_t n) {
     return _c[n];
   }
 
@@ -578,16 +1346,246 @@ template<typename Scale> class Histogram : public Metric {
 
   size_t size() const { return _c.size(); }
 
+  /**
+   * @brief move all counts into a snapshot and reset them to zero
+   *
+   * Every bucket is exchanged atomically (strong duplex storage drains its
+   * brokers), so each sample ends up in exactly one snapshot even under
+   * concurrent writers. The counts are added to into, which makes
+   * accumulating intervals cheap. Not available for weak_duplex_array.
+   */
+  void exchange(HistogramSnapshot& into) {
+    if (into.size() == 0) {
+      into = HistogramSnapshot(size());
+    }
+    TRI_ASSERT(into.size() == size());
+    for (size_t i = 0; i < size(); ++i) {
+      into[i] += _c.exchange(i, 0);
+    }
+  }
+
+  HistogramSnapshot exchange() {
+    HistogramSnapshot s(size());
+    exchange(s);
+    return s;
+  }
+
   virtual void toPrometheus(std::string& result) const override {
-    result += "\n#TYPE " + name() + " histogram\n";
-    result += "#HELP " + name() + " " + help() + "\n";
-    std::string lbs = labels();
+    render(result, false, [this](size_t i) { return load(i); });
+  }
+
+  virtual void toOpenMetrics(std::string& result) const override {
+    render(result, true, [this](size_t i) { return load(i); });
+  }
+
+  /**
+   * @brief render snapshot counts, e.g. a cumulative total, as this histogram
+   */
+  void toPrometheus(std::string& result, HistogramSnapshot const& counts) const {
+    TRI_ASSERT(counts.size() == size());
+    render(result, false, [&counts](size_t i) { return counts[i]; });
+  }
+
+  std::ostream& print(std::ostream& o) const {
+    o << name() << " scale: " <<  _scale << " extremes: [" << _lowr << ", " << _highr << "]";
+    return o;
+  }
+
+ private:
+  /**
+   * @brief OpenMetrics buckets are cumulative and carry the exemplars
+   */
+  template<typename F>
+  void render(std::string& result, bool openMetrics, F const& bucket) const {
+    std::string const& nm = name();
+    std::string const& lbs = labels();
     auto const haveLabels = !lbs.empty();
     auto const separator = haveLabels && lbs.back() != ',';
+    result.append(openMetrics ? "# TYPE " : "\n#TYPE ").append(nm).append(" histogram\n");
+    result.append(openMetrics ? "# HELP " : "#HELP ").append(nm).append(" ")
+      .append(help()).append("\n");
     uint64_t sum(0);
     for (size_t i = 0; i < size(); ++i) {
-      uint64_t n = load(i);
+      uint64_t n = bucket(i);
       sum += n;
+      result.append(nm).append("_bucket{");
+      if (haveLabels) {
+        result.append(lbs);
+      }
+      if (separator) {
+        result.append(",");
+      }
+      result.append("le=\"").append(_scale.delim(i)).append("\"} ")
+        .append(std::to_string(openMetrics ? sum : n));
+      if (openMetrics && _exemplars != nullptr) {
+        _exemplars->render(result, i);
+      }
+      result.append("\n");
+    }
+    result.append(nm).append("_count");
+    if (haveLabels) {
+      result.append("{").append(lbs).append("}");
+    }
+    result.append(" ").append(std::to_string(sum)).append("\n");
+  }
+
+  Storage _c;
+  Scale _scale;
+  value_type _lowr, _highr;
+  size_t _n;
+  std::unique_ptr<Exemplars> _exemplars;
+
+};
+
+/**
+ * @brief auto-ranging exponential histogram without configured range
+ *
+ * Buckets are the leading 1 + Precision bits of the double representation
+ * of a value, i.e. every power of two is split into 2^Precision buckets of
+ * relative width 2^-Precision, covering the whole range of double (and of
+ * uint64_t, which is converted). Buckets are (lower, upper] like the le
+ * label they are exported with, so powers of two end their bucket. Zero,
+ * negative values and NaN share one extra bucket, exported as le="0";
+ * negative() tells how many of them were negative. Counters live in pages
+ * of 8 octaves which are allocated on first use and published lock-free
+ * with a compare-exchange, so memory is only paid for the ranges actually
+ * seen.
+ */
+template<typename T, unsigned Precision = 3>
+class SparseHistogram : public Metric {
+  static_assert(Precision >= 1 && Precision <= 10, "precision out of range");
+  static constexpr unsigned shift = 52 - Precision;
+  static constexpr size_t pageSize = size_t(8) << Precision;
+  static constexpr size_t pages = (size_t(2048) << Precision) / pageSize;
+
+  struct Page {
+    Page() {
+      for (auto& c : counts) {
+        c.store(0, std::memory_order_relaxed);
+      }
+    }
+    std::atomic<uint64_t> counts[pageSize];
+  };
+
+ public:
+  using value_type = T;
+
+  SparseHistogram(std::string const& name, std::string const& help,
+                  std::string const& labels = std::string())
+    : Metric(name, help, labels), _nonPositive(0), _negative(0) {
+    for (auto& p : _dir) {
+      p.store(nullptr, std::memory_order_relaxed);
+    }
+  }
+  SparseHistogram(SparseHistogram const&) = delete;
+  ~SparseHistogram() {
+    for (auto& p : _dir) {
+      delete p.load(std::memory_order_relaxed);
+    }
+  }
+
+  void count(value_type const& t) {
+    count(t, 1);
+  }
+
+  void count(value_type const& t, uint64_t n) {
+    double d = static_cast<double>(t);
+    if (!(d > 0.)) {
+      _nonPositive.fetch_add(n, std::memory_order_relaxed);
+      if (d < 0.) {
+        _negative.fetch_add(n, std::memory_order_relaxed);
+      }
+      return;
+    }
+    uint64_t bits;
+    memcpy(&bits, &d, 8);
+    // the predecessor, so that upper(idx) itself is in bucket idx
+    size_t idx = (bits - 1) >> shift;
+    Page* page = _dir[idx / pageSize].load(std::memory_order_acquire);
+    if (page == nullptr) {
+      page = allocate(idx / pageSize);
+    }
+    page->counts[idx % pageSize].fetch_add(n, std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief relative width of a bucket
+   */
+  static constexpr double precision() { return 1.0 / (1 << Precision); }
+
+  /**
+   * @brief upper bound of bucket idx, inclusive
+   */
+  static double upper(size_t idx) {
+    uint64_t bits = static_cast<uint64_t>(idx + 1) << shift;
+    double d;
+    memcpy(&d, &bits, 8);
+    return d;
+  }
+
+  /**
+   * @brief negative values counted, they are part of the le="0" bucket
+   */
+  uint64_t negative() const {
+    return _negative.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief bytes used including all allocated pages
+   */
+  size_t memory() const {
+    size_t m = sizeof(*this);
+    for (auto const& p : _dir) {
+      if (p.load(std::memory_order_relaxed) != nullptr) {
+        m += sizeof(Page);
+      }
+    }
+    return m;
+  }
+
+  /**
+   * @brief non-empty buckets as (upper bound, count), zero bucket first
+   */
+  std::vector<std::pair<double, uint64_t>> load() const {
+    std::vector<std::pair<double, uint64_t>> v;
+    uint64_t z = _nonPositive.load(std::memory_order_relaxed);
+    if (z != 0) {
+      v.emplace_back(0., z);
+    }
+    for (size_t p = 0; p < pages; ++p) {
+      Page const* page = _dir[p].load(std::memory_order_acquire);
+      if (page == nullptr) {
+        continue;
+      }
+      for (size_t i = 0; i < pageSize; ++i) {
+        uint64_t n = page->counts[i].load(std::memory_order_relaxed);
+        if (n != 0) {
+          v.emplace_back(upper(p * pageSize + i), n);
+        }
+      }
+    }
+    return v;
+  }
+
+  virtual void toPrometheus(std::string& result) const override {
+    render(result, false);
+  }
+
+  virtual void toOpenMetrics(std::string& result) const override {
+    render(result, true);
+  }
+
+ private:
+  /**
+   * @brief OpenMetrics buckets are cumulative and end with +Inf
+   */
+  void render(std::string& result, bool openMetrics) const {
+    result += (openMetrics ? "# TYPE " : "\n#TYPE ") + name() + " histogram\n";
+    result += (openMetrics ? "# HELP " : "#HELP ") + name() + " " + help() + "\n";
+    std::string lbs = labels();
+    auto const haveLabels = !lbs.empty();
+    auto const separator = haveLabels && lbs.back() != ',';
+    auto bucket = [&](char const* le, uint64_t n) {
       result += name() + "_bucket{";
       if (haveLabels) {
         result += lbs;
@@ -595,7 +1593,25 @@ template<typename Scale> class Histogram : public Metric {
       if (separator) {
         result += ",";
       }
-      result += "le=\"" + _scale.delim(i) + "\"} " + std::to_string(n) + "\n";
+      result += "le=\"" + std::string(le) + "\"} " + std::to_string(n) + "\n";
+    };
+    uint64_t sum(0);
+    bool inf = false;
+    for (auto const& b : load()) {
+      sum += b.second;
+      // bounds span the whole double range, to_string would print 300
+      // digits; 17 significant digits print every bound so it parses back
+      char le[32];
+      if (std::isfinite(b.first)) {
+        snprintf(le, sizeof(le), "%.17g", b.first);
+      } else {
+        snprintf(le, sizeof(le), "+Inf");
+        inf = true;
+      }
+      bucket(le, openMetrics ? sum : b.second);
+    }
+    if (openMetrics && !inf) {
+      bucket("+Inf", sum);
     }
     result += name() + "_count";
     if (!labels().empty()) {
@@ -604,22 +1620,494 @@ template<typename Scale> class Histogram : public Metric {
     result += " " + std::to_string(sum) + "\n";
   }
 
-  std::ostream& print(std::ostream& o) const {
-    o << name() << " scale: " <<  _scale << " extremes: [" << _lowr << ", " << _highr << "]";
-    return o;
+  Page* allocate(size_t p) {
+    Page* fresh = new Page();
+    Page* expected = nullptr;
+    if (_dir[p].compare_exchange_strong(expected, fresh, std::memory_order_acq_rel,
+                                        std::memory_order_acquire)) {
+      return fresh;
+    }
+    delete fresh;
+    return expected;
+  }
+
+  std::atomic<Page*> _dir[pages];
+  std::atomic<uint64_t> _nonPositive;
+  std::atomic<uint64_t> _negative;
+};
+
+/**
+ * @brief distinct count estimate (HyperLogLog++) exported as gauge
+ *
+ * 2^precision one-byte registers, precision 4 to 18, standard error about
+ * 1.04 / sqrt(2^precision), e.g. 0.8% at precision 14 (16 KiB). Keys are
+ * hashed with std::hash and remixed, so integers need no extra care. Inserts
+ * are lock-free: a register is only written (compare-exchange) when the rank
+ * grows, which becomes rare once the sketch has seen some keys, so repeated
+ * keys only read. As in HLL++ the hash is 64 bits wide (no large range
+ * correction) and small cardinalities use linear counting up to the
+ * paper's thresholds; the empirical bias tables and sparse mode are left
+ * out. For per-interval counts, exchange() returns and clears the registers.
+ */
+class Cardinality : public Metric {
+ public:
+  Cardinality(unsigned precision, std::string const& name, std::string const& help,
+              std::string const& labels = std::string());
+  Cardinality(Cardinality const&) = delete;
+  ~Cardinality();
+
+  template<typename K>
+  void insert(K const& key) {
+    insertHash(std::hash<K>()(key));
   }
 
+  void insertHash(uint64_t h) {
+    // splitmix64 finalizer, std::hash of integers is the identity
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    size_t idx = h >> (64 - _p);
+    // the guard bit bounds the rank by 64 - precision + 1
+    uint64_t w = (h << _p) | (uint64_t(1) << (_p - 1));
+    uint8_t rank = static_cast<uint8_t>(__builtin_clzll(w) + 1);
+    auto& r = _registers[idx];
+    uint8_t cur = r.load(std::memory_order_relaxed);
+    while (rank > cur &&
+           !r.compare_exchange_weak(cur, rank, std::memory_order_relaxed)) {
+    }
+  }
+
+  unsigned precision() const { return _p; }
+  size_t size() const { return _m; }
+
+  /**
+   * @brief copy of the registers, e.g. to merge elsewhere
+   */
+  std::vector<uint8_t> registers() const;
+
+  /**
+   * @brief registers reset to zero, returns the old ones
+   */
+  std::vector<uint8_t> exchange();
+  void clear();
+
+  /**
+   * @brief union with another sketch of the same precision
+   */
+  void merge(Cardinality const& other);
+  void merge(uint8_t const* registers, size_t n);
+
+  /**
+   * @brief register-wise max on plain arrays, written to vectorize
+   */
+  static void mergeRegisters(uint8_t* into, uint8_t const* from, size_t n);
+
+  static double estimate(uint8_t const* registers, size_t n);
+  double estimate() const;
+
+  virtual void toPrometheus(std::string& result) const override;
+
  private:
-  Metrics::hist_type _c;
-  Scale _scale;
-  value_type _lowr, _highr;
-  size_t _n;
+  unsigned const _p;
+  size_t const _m;
+  std::unique_ptr<std::atomic<uint8_t>[]> _registers;
+};
+
+/**
+ * @brief heavy hitters (Count-Min sketch plus heap) exported as labelled gauges
+ *
+ * Each sketch counts every key in a Count-Min sketch of 4 rows and keeps
+ * the capacity keys with the largest estimates as candidates in a min-heap.
+ * Width is the power of two >= 8 * capacity, so an estimate exceeds the
+ * true count by at most e/width of all counts with probability 1 - e^-4.
+ * Keys estimated below the heap minimum, i.e. the long tail, only cost the
+ * four counter increments. capacity should be a few times k.
+ *
+ * Counting threads own a TopK::Local each, registered with the metric like
+ * a broker with its duplex counter, and only take the Local's uncontended
+ * lock. A scrape adds up the Count-Min counters of all live sketches and of
+ * those of destroyed Locals, estimates the union of their candidates and
+ * exports the k largest as series name{labels,label="key"} estimate.
+ */
+template<typename Key = std::string>
+class TopK : public Metric {
+ public:
+  class Sketch {
+   public:
+    static constexpr size_t depth = 4;
+
+    explicit Sketch(size_t capacity)
+      : _capacity(capacity), _width(64) {
+      while (_width < 8 * capacity) {
+        _width *= 2;
+      }
+      TRI_ASSERT(_width <= (size_t(1) << 32));
+      _counts.assign(depth * _width, 0);
+      _entries.reserve(capacity);
+      _heap.reserve(capacity);
+      _index.reserve(2 * capacity);
+    }
+
+    static uint64_t hash(Key const& key) {
+      // splitmix64 finalizer, std::hash of integers is the identity
+      uint64_t h = std::hash<Key>()(key);
+      h ^= h >> 30;
+      h *= 0xbf58476d1ce4e5b9ULL;
+      h ^= h >> 27;
+      h *= 0x94d049bb133111ebULL;
+      return h ^ (h >> 31);
+    }
+
+    /**
+     * @brief Count-Min estimate of hash h in counts of the given width
+     */
+    static uint64_t estimate(uint64_t const* counts, size_t width, uint64_t h) {
+      uint64_t est = std::numeric_limits<uint64_t>::max();
+      for (size_t i = 0; i < depth; ++i) {
+        est = std::min(est, counts[i * width + slot(h, i, width)]);
+      }
+      return est;
+    }
+
+    void insert(Key const& key, uint64_t n = 1) {
+      uint64_t const h = hash(key);
+      uint64_t est = std::numeric_limits<uint64_t>::max();
+      for (size_t i = 0; i < depth; ++i) {
+        uint64_t& c = _counts[i * _width + slot(h, i, _width)];
+        c += n;
+        est = std::min(est, c);
+      }
+      offer(key, h, est);
+    }
+
+    /**
+     * @brief add other's counts, its candidates compete for the heap
+     */
+    void merge(Sketch const& other) {
+      TRI_ASSERT(other._width == _width);
+      for (size_t i = 0; i < _counts.size(); ++i) {
+        _counts[i] += other._counts[i];
+      }
+      for (auto const& e : other._entries) {
+        offer(e.key, e.hash, estimate(_counts.data(), _width, e.hash));
+      }
+    }
+
+    /**
+     * @brief f(key) for all candidates
+     */
+    template<typename F>
+    void visit(F const& f) const {
+      for (auto const& e : _entries) {
+        f(e.key);
+      }
+    }
 
+    std::vector<uint64_t> const& counts() const { return _counts; }
+    size_t size() const { return _entries.size(); }
+    size_t capacity() const { return _capacity; }
+    size_t width() const { return _width; }
+
+   private:
+    struct Entry {
+      Key key;
+      uint64_t hash;
+      uint64_t count;
+      uint32_t pos;  // in _heap
+    };
+
+    struct Identity {
+      size_t operator()(uint64_t h) const { return static_cast<size_t>(h); }
+    };
+
+    static size_t slot(uint64_t h, size_t i, size_t width) {
+      // multiplicative hashing with a different odd factor per row; the top
+      // bits of each product are independent enough, unlike double hashing
+      // whose rows all collide once the low bits of both halves do
+      static uint64_t const factor[depth] = {
+        0x9e3779b97f4a7c15ULL, 0xc2b2ae3d27d4eb4fULL,
+        0x165667b19e3779f9ULL, 0xd6e8feb86659fd93ULL};
+      return static_cast<size_t>(((h * factor[i]) >> 32) & (width - 1));
+    }
+
+    /**
+     * @brief candidates are indexed by their 64 bit hash, which is already
+     * mixed and needs no second pass over the key; on the rare collision
+     * the newcomer is not taken
+     */
+    void offer(Key const& key, uint64_t h, uint64_t est) {
+      if (_entries.size() == _capacity && est <= count(0)) {
+        return;  // below every candidate, or a candidate that did not grow
+      }
+      auto it = _index.find(h);
+      if (it != _index.end()) {
+        Entry& e = _entries[it->second];
+        if (e.key == key) {
+          e.count = est;
+          down(e.pos);
+        }
+        return;
+      }
+      if (_entries.size() < _capacity) {
+        uint32_t e = static_cast<uint32_t>(_entries.size());
+        _entries.push_back(Entry{key, h, est, static_cast<uint32_t>(_heap.size())});
+        _heap.push_back(e);
+        _index.emplace(h, e);
+        up(_heap.size() - 1);
+        return;
+      }
+      // replace the minimum, reusing its map node and key buffer
+      Entry& min = _entries[_heap[0]];
+      auto node = _index.extract(min.hash);
+      node.key() = h;
+      _index.insert(std::move(node));
+      min.key = key;
+      min.hash = h;
+      min.count = est;
+      down(0);
+    }
+
+    void swap(size_t a, size_t b) {
+      std::swap(_heap[a], _heap[b]);
+      _entries[_heap[a]].pos = static_cast<uint32_t>(a);
+      _entries[_heap[b]].pos = static_cast<uint32_t>(b);
+    }
+    uint64_t count(size_t h) const { return _entries[_heap[h]].count; }
+    void up(size_t h) {
+      while (h > 0 && count((h - 1) / 2) > count(h)) {
+        swap(h, (h - 1) / 2);
+        h = (h - 1) / 2;
+      }
+    }
+    void down(size_t h) {
+      size_t const n = _heap.size();
+      while (true) {
+        size_t l = 2 * h + 1, m = h;
+        if (l < n && count(l) < count(m)) {
+          m = l;
+        }
+        if (l + 1 < n && count(l + 1) < count(m)) {
+          m = l + 1;
+        }
+        if (m == h) {
+          return;
+        }
+        swap(h, m);
+        h = m;
+      }
+    }
+
+    size_t _capacity;
+    size_t _width;
+    std::vector<uint64_t> _counts;
+    std::vector<Entry> _entries;
+    std::vector<uint32_t> _heap;
+    std::unordered_map<uint64_t, uint32_t, Identity> _index;
+  };
+
+  /**
+   * @brief per-thread sketch, the TopK must outlive it
+   */
+  class Local {
+   public:
+    explicit Local(TopK& top) : _top(top), _sketch(top._capacity) {
+      std::lock_guard<std::mutex> guard(_top._mutex);
+      _top._locals.insert(this);
+    }
+    Local(Local const&) = delete;
+    ~Local() {
+      std::lock_guard<std::mutex> guard(_top._mutex);
+      _top._locals.erase(this);
+      std::lock_guard<std::mutex> mine(_mutex);
+      _top._retired.merge(_sketch);
+    }
+    void insert(Key const& key, uint64_t n = 1) {
+      std::lock_guard<std::mutex> guard(_mutex);
+      _sketch.insert(key, n);
+    }
+   private:
+    friend class TopK;
+    TopK& _top;
+    std::mutex _mutex;
+    Sketch _sketch;
+  };
+
+  TopK(size_t k, size_t capacity, std::string const& name, std::string const& help,
+       std::string const& label = "key", std::string const& labels = std::string())
+    : Metric(name, help, labels), _k(k), _capacity(std::max(k, capacity)),
+      _label(label), _retired(_capacity) {}
+  TopK(TopK const&) = delete;
+  ~TopK() { TRI_ASSERT(_locals.empty()); }
+
+  /**
+   * @brief count without a Local, through the shared sketch under the lock
+   */
+  void insert(Key const& key, uint64_t n = 1) {
+    std::lock_guard<std::mutex> guard(_mutex);
+    _retired.insert(key, n);
+  }
+
+  /**
+   * @brief the k heaviest keys, merged over all sketches, largest first
+   */
+  std::vector<std::pair<Key, uint64_t>> top() const {
+    std::vector<uint64_t> counts;
+    std::unordered_set<Key> candidates;
+    auto merge = [&](Sketch const& s) {
+      auto const& c = s.counts();
+      if (counts.empty()) {
+        counts.assign(c.size(), 0);
+      }
+      for (size_t i = 0; i < c.size(); ++i) {
+        counts[i] += c[i];
+      }
+      s.visit([&candidates](Key const& k) { candidates.insert(k); });
+    };
+    {
+      std::lock_guard<std::mutex> guard(_mutex);
+      merge(_retired);
+      for (Local* l : _locals) {
+        std::lock_guard<std::mutex> theirs(l->_mutex);
+        merge(l->_sketch);
+      }
+    }
+    std::vector<std::pair<Key, uint64_t>> v;
+    v.reserve(candidates.size());
+    for (auto const& k : candidates) {
+      v.emplace_back(k, Sketch::estimate(counts.data(), _retired.width(), Sketch::hash(k)));
+    }
+    auto by = [](auto const& a, auto const& b) { return a.second > b.second; };
+    if (v.size() > _k) {
+      std::partial_sort(v.begin(), v.begin() + _k, v.end(), by);
+      v.resize(_k);
+    } else {
+      std::sort(v.begin(), v.end(), by);
+    }
+    return v;
+  }
+
+  size_t k() const { return _k; }
+  size_t capacity() const { return _capacity; }
+
+  virtual void toPrometheus(std::string& result) const override {
+    result += "\n#TYPE " + name() + " gauge\n";
+    result += "#HELP " + name() + " " + help() + "\n";
+    std::string lbs = labels();
+    auto const separator = !lbs.empty() && lbs.back() != ',';
+    for (auto const& e : top()) {
+      result += name() + "{" + lbs;
+      if (separator) {
+        result += ",";
+      }
+      result += _label + "=\"" + escape(e.first) + "\"} " + std::to_string(e.second) + "\n";
+    }
+  }
+
+ private:
+  static std::string escape(Key const& key) {
+    std::string s;
+    if constexpr (std::is_arithmetic_v<Key>) {
+      s = std::to_string(key);
+    } else {
+      s = std::string(key);
+    }
+    std::string r;
+    r.reserve(s.size());
+    for (char c : s) {
+      if (c == '\\' || c == '"') {
+        r += '\\';
+        r += c;
+      } else if (c == '\n') {
+        r += "\\n";
+      } else {
+        r += c;
+      }
+    }
+    return r;
+  }
+
+  size_t const _k;
+  size_t const _capacity;
+  std::string const _label;
+  mutable std::mutex _mutex;  // _locals and _retired
+  std::unordered_set<Local*> _locals;
+  Sketch _retired;
+};
+
+/**
+ * @brief event rates as 1, 5 and 15 second moving averages
+ *
+ * mark() adds to one of a few cache line sized shards, picked per thread,
+ * so concurrent marks rarely share a line. tick() is meant to be called
+ * every interval (default 250ms) by some periodic thread. It exchanges the
+ * shards, folds the sum into the exponentially weighted moving averages,
+ * and stores the results into atomics, so rate() is a single load from any
+ * thread. Concurrent or late ticks are fine: a compare-exchange on the next
+ * due time elects one thread to fold, ticks during its fold are no-ops, and
+ * the marks of missed intervals are spread over them. Rates are per second; the first tick
+ * initializes them.
+ */
+class Meter : public Metric {
+ public:
+  using clock = std::chrono::steady_clock;
+  static constexpr size_t shards = 16;
+  static constexpr size_t windows = 3;
+
+  Meter(std::string const& name, std::string const& help,
+        std::string const& labels = std::string(),
+        std::chrono::milliseconds interval = std::chrono::milliseconds(250));
+  Meter(Meter const&) = delete;
+  ~Meter();
+
+  void mark(uint64_t n = 1) {
+    _shards[shard()].n.fetch_add(n, std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief fold the marks of all intervals that are due at now
+   */
+  void tick(clock::time_point now = clock::now());
+
+  /**
+   * @brief rate over the 1, 5 or 15 second window (i = 0, 1, 2)
+   */
+  double rate(size_t i) const { return _rates[i].load(std::memory_order_relaxed); }
+  double rate1() const { return rate(0); }
+  double rate5() const { return rate(1); }
+  double rate15() const { return rate(2); }
+
+  /**
+   * @brief all marks, including those not yet ticked
+   */
+  uint64_t count() const;
+
+  virtual void toPrometheus(std::string& result) const override;
+
+ private:
+  struct alignas(64) Shard {
+    std::atomic<uint64_t> n;
+  };
+
+  static size_t shard() {
+    static std::atomic<size_t> next(0);
+    thread_local size_t const mine = next.fetch_add(1, std::memory_order_relaxed) % shards;
+    return mine;
+  }
+
+  Shard _shards[shards];
+  int64_t const _interval;  // in clock ticks
+  double _alpha[windows];
+  std::atomic<int64_t> _due;
+  std::atomic<double> _rates[windows];
+  std::atomic<uint64_t> _ticked;
+  std::atomic<bool> _initialized;
 };
 
 std::ostream& operator<< (std::ostream&, Metrics::counter_type const&);
-template<typename T>
-std::ostream& operator<<(std::ostream& o, Histogram<T> const& h) {
+template<typename T, typename S>
+std::ostream& operator<<(std::ostream& o, Histogram<T, S> const& h) {
   return h.print(o);
 }
 
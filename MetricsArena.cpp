@@ -0,0 +1,100 @@
+////////////////////////////////////////////////////////////////////////////////
+/// DISCLAIMER
+///
+/// Copyright 2014-2021 ArangoDB GmbH, Cologne, Germany
+/// Copyright 2004-2014 triAGENS GmbH, Cologne, Germany
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     http://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+///
+/// Copyright holder is ArangoDB GmbH, Cologne, Germany
+////////////////////////////////////////////////////////////////////////////////
+
+#include "MetricsArena.h"
+
+#include <algorithm>
+
+#include <sys/mman.h>
+
+namespace {
+constexpr size_t hugePage = size_t(2) << 20;
+}
+
+thread_local MetricsArena* MetricsArena::_current = nullptr;
+
+MetricsArena::MetricsArena(size_t capacity, bool hugePages)
+  : _base(nullptr), _capacity((capacity + hugePage - 1) / hugePage * hugePage),
+    _used(0), _huge(false) {
+  if (_capacity > UINT32_MAX) {
+    throw std::bad_alloc();
+  }
+  void* p = MAP_FAILED;
+  if (hugePages) {
+    // no MAP_NORESERVE here: the reservation makes mmap fail rather than a
+    // later page fault raise SIGBUS when the huge page pool is short
+    p = mmap(nullptr, _capacity, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    _huge = (p != MAP_FAILED);
+  }
+  if (p == MAP_FAILED) {
+    p = mmap(nullptr, _capacity, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED) {
+      throw std::bad_alloc();
+    }
+    if (hugePages) {
+      _huge = (madvise(p, _capacity, MADV_HUGEPAGE) == 0);
+    }
+  }
+  _base = static_cast<char*>(p);
+}
+
+MetricsArena::~MetricsArena() {
+  for (auto it = _objects.rbegin(); it != _objects.rend(); ++it) {
+    _kinds[it->kind](_base + it->offset);
+  }
+  munmap(_base, _capacity);
+}
+
+void* MetricsArena::allocate(size_t bytes, size_t align) {
+  size_t at = (_used + align - 1) / align * align;
+  if (at + bytes > _capacity) {
+    throw std::bad_alloc();
+  }
+  _used = at + bytes;
+  return _base + at;
+}
+
+uint32_t MetricsArena::kind(Destructor d) {
+  // a handful of metric types, a linear search is fine
+  auto it = std::find(_kinds.begin(), _kinds.end(), d);
+  if (it == _kinds.end()) {
+    it = _kinds.insert(it, d);
+  }
+  return uint32_t(it - _kinds.begin());
+}
+
+ArenaBuckets::ArenaBuckets(size_t n)
+  : _v(nullptr), _n(n), _heap(MetricsArena::current() == nullptr) {
+  void* p = _heap ? ::operator new(n * sizeof(value_type))
+    : MetricsArena::current()->allocate(n * sizeof(value_type), alignof(value_type));
+  _v = static_cast<value_type*>(p);
+  for (size_t i = 0; i < n; ++i) {
+    new (_v + i) value_type(0);
+  }
+}
+
+ArenaBuckets::~ArenaBuckets() {
+  if (_heap) {
+    ::operator delete(_v);
+  }
+}
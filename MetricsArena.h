@@ -0,0 +1,126 @@
+////////////////////////////////////////////////////////////////////////////////
+/// DISCLAIMER
+///
+/// Copyright 2014-2021 ArangoDB GmbH, Cologne, Germany
+/// Copyright 2004-2014 triAGENS GmbH, Cologne, Germany
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     http://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+///
+/// Copyright holder is ArangoDB GmbH, Cologne, Germany
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef ARANGODB_REST_SERVER_METRICS_ARENA_H
+#define ARANGODB_REST_SERVER_METRICS_ARENA_H 1
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <new>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief contiguous memory for metrics, in creation (= scrape) order
+ *
+ * One mapping of the given capacity is reserved up front, pages are only
+ * committed when touched. With hugePages the mapping uses explicit huge
+ * pages if the system has some reserved, and transparent huge pages
+ * otherwise. create() constructs a metric in place at the next free
+ * address; while it runs the arena is current(), so that storage like
+ * ArenaBuckets inside the metric is carved from it as well. Metrics live
+ * until the arena is destroyed; a full arena throws std::bad_alloc. The
+ * capacity is limited to 4GB, destructors are kept as 8 byte records.
+ */
+class MetricsArena {
+ public:
+  explicit MetricsArena(size_t capacity, bool hugePages = false);
+  MetricsArena(MetricsArena const&) = delete;
+  ~MetricsArena();
+
+  void* allocate(size_t bytes, size_t align);
+
+  template<typename M, typename... Args>
+  M* create(Args&&... args) {
+    void* p = allocate(sizeof(M), alignof(M));
+    MetricsArena* outer = _current;
+    _current = this;
+    M* m;
+    try {
+      m = new (p) M(std::forward<Args>(args)...);
+    } catch (...) {
+      _current = outer;
+      throw;
+    }
+    _current = outer;
+    _objects.push_back({uint32_t(static_cast<char*>(p) - _base),
+                        kind([](void* o) { static_cast<M*>(o)->~M(); })});
+    return m;
+  }
+
+  /**
+   * @brief the arena inside create() on this thread, or nullptr
+   */
+  static MetricsArena* current() { return _current; }
+
+  size_t used() const { return _used; }
+  size_t capacity() const { return _capacity; }
+  bool hugePages() const { return _huge; }
+
+ private:
+  struct Object {
+    uint32_t offset;
+    uint32_t kind;
+  };
+  using Destructor = void (*)(void*);
+
+  uint32_t kind(Destructor d);
+
+  static thread_local MetricsArena* _current;
+  char* _base;
+  size_t _capacity;
+  size_t _used;
+  bool _huge;
+  std::vector<Destructor> _kinds;
+  std::deque<Object> _objects;
+};
+
+/**
+ * @brief histogram bucket storage from the current arena
+ *
+ * A drop-in Storage for Histogram: Histogram<Scale, ArenaBuckets> created
+ * through MetricsArena::create has its buckets right behind it. Outside
+ * create() the buckets come from the heap.
+ */
+class ArenaBuckets {
+ public:
+  using value_type = std::atomic<uint64_t>;
+
+  explicit ArenaBuckets(size_t n);
+  ArenaBuckets(ArenaBuckets const&) = delete;
+  ~ArenaBuckets();
+
+  value_type& operator[](size_t i) { return _v[i]; }
+  uint64_t load(size_t i) const { return _v[i].load(std::memory_order_relaxed); }
+  uint64_t exchange(size_t i, uint64_t to) {
+    return _v[i].exchange(to, std::memory_order_relaxed);
+  }
+  size_t size() const { return _n; }
+
+ private:
+  value_type* _v;
+  size_t _n;
+  bool _heap;
+};
+
+#endif
@@ -0,0 +1,105 @@
+////////////////////////////////////////////////////////////////////////////////
+/// DISCLAIMER
+///
+/// Copyright 2014-2021 ArangoDB GmbH, Cologne, Germany
+/// Copyright 2004-2014 triAGENS GmbH, Cologne, Germany
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     http://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+///
+/// Copyright holder is ArangoDB GmbH, Cologne, Germany
+////////////////////////////////////////////////////////////////////////////////
+
+#include "MetricsExporter.h"
+
+#include <algorithm>
+
+MetricsExporter::MetricsExporter(bool openMetrics)
+  : _published(&_buffers[0]), _generation(0), _openMetrics(openMetrics), _stop(false) {}
+
+MetricsExporter::~MetricsExporter() { stop(); }
+
+void MetricsExporter::add(Metric const& metric) {
+  std::lock_guard<std::mutex> guard(_mutex);
+  _metrics.push_back(&metric);
+}
+
+void MetricsExporter::remove(Metric const& metric) {
+  std::lock_guard<std::mutex> guard(_mutex);
+  _metrics.erase(std::remove(_metrics.begin(), _metrics.end(), &metric), _metrics.end());
+}
+
+void MetricsExporter::refresh() {
+  std::lock_guard<std::mutex> guard(_mutex);
+  Buffer* current = _published.load();
+  Buffer* next = (current == &_buffers[0]) ? &_buffers[1] : &_buffers[0];
+  // readers of the previous round may still hold it, they are short-lived
+  while (next->readers.load() != 0) {
+    std::this_thread::yield();
+  }
+  // counts sitting in self-flushing buffers reach their primes
+  gcl::counter::flush_registry::global().flush();
+  next->text.clear();
+  for (auto const* m : _metrics) {
+    m->toPrometheus(next->text);
+  }
+  if (_openMetrics) {
+    next->openMetrics.clear();
+    for (auto const* m : _metrics) {
+      m->toOpenMetrics(next->openMetrics);
+    }
+    next->openMetrics.append("# EOF\n");
+  }
+  next->generation = ++_generation;
+  _published.store(next);
+}
+
+MetricsExporter::Snapshot MetricsExporter::scrape() const {
+  while (true) {
+    Buffer* b = _published.load();
+    b->readers.fetch_add(1);
+    // a refresh may have picked b after our load, then it is no longer
+    // published and possibly being rewritten
+    if (_published.load() == b) {
+      return Snapshot(b);
+    }
+    b->readers.fetch_sub(1);
+  }
+}
+
+void MetricsExporter::start(std::chrono::milliseconds interval) {
+  stop();
+  {
+    std::lock_guard<std::mutex> guard(_threadMutex);
+    _stop = false;
+  }
+  _thread = std::thread([this, interval] {
+    std::unique_lock<std::mutex> guard(_threadMutex);
+    while (!_stop) {
+      guard.unlock();
+      refresh();
+      guard.lock();
+      _wakeup.wait_for(guard, interval, [this] { return _stop; });
+    }
+  });
+}
+
+void MetricsExporter::stop() {
+  {
+    std::lock_guard<std::mutex> guard(_threadMutex);
+    _stop = true;
+  }
+  _wakeup.notify_all();
+  if (_thread.joinable()) {
+    _thread.join();
+  }
+}
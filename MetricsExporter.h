@@ -0,0 +1,129 @@
+////////////////////////////////////////////////////////////////////////////////
+/// DISCLAIMER
+///
+/// Copyright 2014-2021 ArangoDB GmbH, Cologne, Germany
+/// Copyright 2004-2014 triAGENS GmbH, Cologne, Germany
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     http://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+///
+/// Copyright holder is ArangoDB GmbH, Cologne, Germany
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef ARANGODB_REST_SERVER_METRICS_EXPORTER_H
+#define ARANGODB_REST_SERVER_METRICS_EXPORTER_H 1
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Metrics.h"
+
+/**
+ * @brief registry of metrics serialized into double-buffered snapshots
+ *
+ * refresh() serializes all registered metrics into the buffer not currently
+ * published and then swaps the published pointer. scrape() only pins the
+ * published buffer, it never touches a metric. With start() a background
+ * thread refreshes periodically, so scraping threads neither wait for the
+ * serialization nor pull the counters' cache lines.
+ *
+ * Every refresh flushes the global gcl::counter::flush_registry, which
+ * also advances the epoch of the self-flushing buffers.
+ *
+ * A refresh reuses a buffer only after its last reader is gone: readers
+ * register in the buffer and re-check that it is still published.
+ *
+ * With openMetrics every refresh also renders the OpenMetrics text, which
+ * carries histogram exemplars, into the same buffer.
+ */
+class MetricsExporter {
+  struct Buffer {
+    Buffer() : readers(0), generation(0) {}
+    std::string text;
+    std::string openMetrics;
+    std::atomic<uint32_t> readers;
+    uint64_t generation;
+  };
+
+ public:
+  /**
+   * @brief pinned published snapshot, valid until destruction
+   */
+  class Snapshot {
+   public:
+    Snapshot(Snapshot&& other) noexcept : _buffer(other._buffer) { other._buffer = nullptr; }
+    Snapshot(Snapshot const&) = delete;
+    Snapshot& operator=(Snapshot const&) = delete;
+    ~Snapshot() {
+      if (_buffer != nullptr) {
+        _buffer->readers.fetch_sub(1);
+      }
+    }
+    std::string const& text() const { return _buffer->text; }
+    /**
+     * @brief OpenMetrics text ending in # EOF, empty without openMetrics
+     */
+    std::string const& openMetrics() const { return _buffer->openMetrics; }
+    uint64_t generation() const { return _buffer->generation; }
+   private:
+    friend class MetricsExporter;
+    explicit Snapshot(Buffer* b) : _buffer(b) {}
+    Buffer* _buffer;
+  };
+
+  explicit MetricsExporter(bool openMetrics = false);
+  MetricsExporter(MetricsExporter const&) = delete;
+  ~MetricsExporter();
+
+  /**
+   * @brief register/unregister, the metric must outlive its registration
+   */
+  void add(Metric const& metric);
+  void remove(Metric const& metric);
+
+  /**
+   * @brief serialize all metrics and publish the result
+   */
+  void refresh();
+
+  /**
+   * @brief latest published serialization
+   */
+  Snapshot scrape() const;
+
+  /**
+   * @brief refresh every interval on a background thread
+   */
+  void start(std::chrono::milliseconds interval);
+  void stop();
+
+ private:
+  std::mutex _mutex;  // registry and refresh
+  std::vector<Metric const*> _metrics;
+  Buffer _buffers[2];
+  std::atomic<Buffer*> _published;
+  uint64_t _generation;
+  bool const _openMetrics;
+
+  std::mutex _threadMutex;
+  std::condition_variable _wakeup;
+  bool _stop;
+  std::thread _thread;
+};
+
+#endif
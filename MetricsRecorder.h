@@ -0,0 +1,274 @@
+////////////////////////////////////////////////////////////////////////////////
+/// DISCLAIMER
+///
+/// Copyright 2014-2021 ArangoDB GmbH, Cologne, Germany
+/// Copyright 2004-2014 triAGENS GmbH, Cologne, Germany
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     http://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+///
+/// Copyright holder is ArangoDB GmbH, Cologne, Germany
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef ARANGODB_REST_SERVER_METRICS_RECORDER_H
+#define ARANGODB_REST_SERVER_METRICS_RECORDER_H 1
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Metrics.h"
+
+/**
+ * @brief bounded lock-free ring of one producer and one consumer thread
+ *
+ * Capacity is rounded up to a power of two. Head and tail sit on their own
+ * cache lines and each side caches the other's index, so a push touches
+ * the consumer's line only when the ring looks full.
+ */
+template<typename T>
+class SpscRing {
+ public:
+  explicit SpscRing(size_t capacity)
+    : _mask(roundUp(capacity) - 1), _slots(new T[_mask + 1]),
+      _head(0), _tail(0), _cachedHead(0), _cachedTail(0) {}
+  SpscRing(SpscRing const&) = delete;
+
+  /**
+   * @brief producer only, false if the ring is full
+   */
+  bool push(T const& v) {
+    uint64_t const tail = _tail.load(std::memory_order_relaxed);
+    if (tail - _cachedHead > _mask) {
+      _cachedHead = _head.load(std::memory_order_acquire);
+      if (tail - _cachedHead > _mask) {
+        return false;
+      }
+    }
+    _slots[tail & _mask] = v;
+    _tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * @brief consumer only, hands everything queued to f(T const*, size_t)
+   * in at most two contiguous spans
+   * @return number of values consumed
+   */
+  template<typename F>
+  size_t drain(F&& f) {
+    uint64_t const head = _head.load(std::memory_order_relaxed);
+    _cachedTail = _tail.load(std::memory_order_acquire);
+    size_t const n = static_cast<size_t>(_cachedTail - head);
+    if (n == 0) {
+      return 0;
+    }
+    size_t const first = std::min(n, static_cast<size_t>(_mask + 1 - (head & _mask)));
+    f(_slots.get() + (head & _mask), first);
+    if (first < n) {
+      f(_slots.get(), n - first);
+    }
+    _head.store(head + n, std::memory_order_release);
+    return n;
+  }
+
+  size_t capacity() const { return static_cast<size_t>(_mask + 1); }
+
+ private:
+  static uint64_t roundUp(size_t n) {
+    uint64_t c = 2;
+    while (c < n) {
+      c <<= 1;
+    }
+    return c;
+  }
+
+  uint64_t const _mask;
+  std::unique_ptr<T[]> const _slots;
+  alignas(64) std::atomic<uint64_t> _head;  // consumer
+  alignas(64) std::atomic<uint64_t> _tail;  // producer
+  alignas(64) uint64_t _cachedHead;         // producer's copy of _head
+  alignas(64) uint64_t _cachedTail;         // consumer's copy of _tail
+};
+
+/**
+ * @brief records samples for a Histogram off the calling thread
+ *
+ * Every recording thread gets a Producer with its own SpscRing; record()
+ * is a store and a release of the ring's tail, no bucketing and no atomic
+ * read-modify-write. drain(), usually on the thread started by start(),
+ * moves all queued samples into the histogram through countBatch(). When
+ * a ring is full the sample is dropped and counted, see dropped().
+ *
+ *   MetricsRecorder<Histogram<logr_scale_t<double>>> r(h);
+ *   r.start(std::chrono::milliseconds(10));
+ *   thread_local auto p = r.producer();
+ *   p.record(42.0);
+ *
+ * Rings of destroyed producers are drained one last time and then
+ * released. The histogram must outlive the recorder.
+ */
+template<typename Hist>
+class MetricsRecorder {
+ public:
+  using value_type = typename Hist::value_type;
+
+ private:
+  struct Ring {
+    explicit Ring(size_t capacity) : ring(capacity), dropped(0), closed(false) {}
+    SpscRing<value_type> ring;
+    std::atomic<uint64_t> dropped;  // written by the producer only
+    std::atomic<bool> closed;
+  };
+
+ public:
+  class Producer {
+   public:
+    Producer(Producer&& other) noexcept = default;
+    Producer(Producer const&) = delete;
+    ~Producer() {
+      if (_ring != nullptr) {
+        _ring->closed.store(true, std::memory_order_release);
+      }
+    }
+
+    /**
+     * @brief queue v, false if it was dropped
+     */
+    bool record(value_type const& v) {
+      if (_ring->ring.push(v)) {
+        return true;
+      }
+      _ring->dropped.store(_ring->dropped.load(std::memory_order_relaxed) + 1,
+                           std::memory_order_relaxed);
+      return false;
+    }
+
+   private:
+    friend class MetricsRecorder;
+    explicit Producer(std::shared_ptr<Ring> ring) : _ring(std::move(ring)) {}
+    std::shared_ptr<Ring> _ring;
+  };
+
+  explicit MetricsRecorder(Hist& histogram, size_t ringCapacity = 4096)
+    : _histogram(histogram), _capacity(ringCapacity), _retiredDrops(0),
+      _drained(0), _stop(false) {}
+  MetricsRecorder(MetricsRecorder const&) = delete;
+  ~MetricsRecorder() {
+    stop();
+    drain();
+  }
+
+  /**
+   * @brief a new ring for the calling thread, use from that thread only
+   */
+  Producer producer() {
+    auto ring = std::make_shared<Ring>(_capacity);
+    std::lock_guard<std::mutex> guard(_mutex);
+    _rings.push_back(ring);
+    return Producer(std::move(ring));
+  }
+
+  /**
+   * @brief count all queued samples into the histogram
+   * @return number of samples counted
+   */
+  size_t drain() {
+    std::lock_guard<std::mutex> guard(_mutex);
+    size_t n = 0;
+    for (auto it = _rings.begin(); it != _rings.end();) {
+      Ring& r = **it;
+      // closed before draining, so nothing is pushed after the last drain
+      bool const closed = r.closed.load(std::memory_order_acquire);
+      n += r.ring.drain([this](value_type const* values, size_t m) {
+        _histogram.countBatch(values, m);
+      });
+      if (closed) {
+        _retiredDrops += r.dropped.load(std::memory_order_relaxed);
+        it = _rings.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    _drained.fetch_add(n, std::memory_order_relaxed);
+    return n;
+  }
+
+  /**
+   * @brief samples lost to full rings so far
+   */
+  uint64_t dropped() const {
+    std::lock_guard<std::mutex> guard(_mutex);
+    uint64_t n = _retiredDrops;
+    for (auto const& r : _rings) {
+      n += r->dropped.load(std::memory_order_relaxed);
+    }
+    return n;
+  }
+
+  /**
+   * @brief samples counted into the histogram so far
+   */
+  uint64_t drained() const { return _drained.load(std::memory_order_relaxed); }
+
+  /**
+   * @brief drain every interval on a background thread
+   */
+  void start(std::chrono::milliseconds interval) {
+    stop();
+    {
+      std::lock_guard<std::mutex> guard(_threadMutex);
+      _stop = false;
+    }
+    _thread = std::thread([this, interval] {
+      std::unique_lock<std::mutex> guard(_threadMutex);
+      while (!_stop) {
+        guard.unlock();
+        drain();
+        guard.lock();
+        _wakeup.wait_for(guard, interval, [this] { return _stop; });
+      }
+    });
+  }
+
+  void stop() {
+    {
+      std::lock_guard<std::mutex> guard(_threadMutex);
+      _stop = true;
+    }
+    _wakeup.notify_all();
+    if (_thread.joinable()) {
+      _thread.join();
+    }
+  }
+
+ private:
+  Hist& _histogram;
+  size_t const _capacity;
+  mutable std::mutex _mutex;  // rings and drain
+  std::vector<std::shared_ptr<Ring>> _rings;
+  uint64_t _retiredDrops;
+  std::atomic<uint64_t> _drained;
+
+  std::mutex _threadMutex;
+  std::condition_variable _wakeup;
+  bool _stop;
+  std::thread _thread;
+};
+
+#endif
@@ -0,0 +1,481 @@
+////////////////////////////////////////////////////////////////////////////////
+/// DISCLAIMER
+///
+/// Copyright 2014-2021 ArangoDB GmbH, Cologne, Germany
+/// Copyright 2004-2014 triAGENS GmbH, Cologne, Germany
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     http://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+///
+/// Copyright holder is ArangoDB GmbH, Cologne, Germany
+////////////////////////////////////////////////////////////////////////////////
+
+#include "MetricsRetention.h"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace {
+
+constexpr uint32_t dataWords = (MetricsRetention::blockSize - 24) / 8;
+constexpr uint32_t dataBits = dataWords * 64;
+// longest record: XOR with a new window, 1 + 1 + 6 + 6 + 64 bits
+constexpr uint32_t maxRecord = 78;
+constexpr uint8_t noWindow = 0xff;
+
+/**
+ * @brief appends bits to a block's data, least significant bit first
+ */
+struct BitWriter {
+  uint64_t* data;
+  uint32_t& bits;
+
+  void write(uint64_t v, unsigned n) {
+    uint32_t const word = bits >> 6;
+    unsigned const off = bits & 63;
+    data[word] |= v << off;
+    if (off + n > 64) {
+      data[word + 1] = v >> (64 - off);
+    }
+    bits += n;
+  }
+};
+
+struct BitReader {
+  uint64_t const* data;
+  uint32_t pos;
+
+  uint64_t peek(unsigned n) const {
+    uint32_t const word = pos >> 6;
+    unsigned const off = pos & 63;
+    uint64_t v = data[word] >> off;
+    // a peek may reach beyond the last record
+    if (off + n > 64 && word + 1 < dataWords) {
+      v |= data[word + 1] << (64 - off);
+    }
+    return (n == 64) ? v : v & ((uint64_t(1) << n) - 1);
+  }
+
+  uint64_t read(unsigned n) {
+    uint64_t v = peek(n);
+    pos += n;
+    return v;
+  }
+};
+
+// delta-of-delta classes: a unary prefix of 0 to 5 ones, then the zigzag
+// encoded value in this many bits
+constexpr unsigned dodBits[] = {0, 7, 9, 12, 32, 64};
+
+void writeDod(BitWriter& w, int64_t dod) {
+  uint64_t const zz = (static_cast<uint64_t>(dod) << 1) ^ static_cast<uint64_t>(dod >> 63);
+  if (zz == 0) {
+    w.write(0, 1);
+    return;
+  }
+  unsigned c = 1;
+  while (c < 5 && zz >= (uint64_t(1) << dodBits[c])) {
+    ++c;
+  }
+  // c ones, terminated by a zero below the last class
+  w.write((uint64_t(1) << c) - 1, (c < 5) ? c + 1 : 5);
+  w.write(zz, dodBits[c]);
+}
+
+// both readers take a record from one 64 bit peek where it fits
+
+int64_t readDod(BitReader& r) {
+  // classes 0 to 4 fit the peek and decode without branches, jittery
+  // timestamps alternate between them unpredictably
+  static constexpr unsigned prefix[] = {1, 2, 3, 4, 5, 5};
+  static constexpr uint64_t mask[] = {0, 0x7f, 0x1ff, 0xfff, 0xffffffff, ~uint64_t(0)};
+  uint64_t const w = r.peek(64);
+  unsigned const ones = __builtin_ctzll(~w | 0x20);
+  uint64_t zz;
+  if (ones < 5) {
+    zz = (w >> prefix[ones]) & mask[ones];
+    r.pos += prefix[ones] + dodBits[ones];
+  } else {
+    r.pos += 5;
+    zz = r.read(64);
+  }
+  return static_cast<int64_t>(zz >> 1) ^ -static_cast<int64_t>(zz & 1);
+}
+
+uint64_t readXor(BitReader& r, unsigned& leading, unsigned& trailing) {
+  uint64_t const w = r.peek(64);
+  if ((w & 1) == 0) {
+    r.pos += 1;
+    return 0;
+  }
+  unsigned header = 2;
+  if ((w & 2) != 0) {
+    leading = static_cast<unsigned>((w >> 2) & 63);
+    trailing = 64 - leading - static_cast<unsigned>((w >> 8) & 63) - 1;
+    header = 14;
+  }
+  unsigned const m = 64 - leading - trailing;
+  uint64_t x;
+  if (header + m <= 64) {
+    x = (w >> header) & ((m == 64) ? ~uint64_t(0) : (uint64_t(1) << m) - 1);
+    r.pos += header + m;
+  } else {
+    r.pos += header;
+    x = r.read(m);
+  }
+  return x << trailing;
+}
+
+}  // namespace
+
+MetricsRetention::MetricsRetention(std::chrono::milliseconds retention,
+                                   std::chrono::milliseconds interval)
+  : _retention(static_cast<uint32_t>(std::max<int64_t>(retention / interval, 1))),
+    _interval(interval), _allocated(0), _used(0), _tick(0), _stop(false) {
+  TRI_ASSERT(interval.count() > 0);
+  _time = Series{nullptr, nullptr, nullptr, 0, nullptr, Kind::Counter, noWindow, 0, UINT32_MAX, 0, 0, {}};
+}
+
+MetricsRetention::~MetricsRetention() {
+  stop();
+  for (auto const& s : _series) {
+    if (s.le != nullptr) {
+      MetricsStrings::release(*s.le);
+    }
+  }
+}
+
+uint64_t MetricsRetention::loadCounter(void const* metric, size_t) {
+  return static_cast<Counter const*>(metric)->load();
+}
+
+MetricsRetention::SeriesId MetricsRetention::add(Counter const& counter) {
+  return addSeries(counter, Kind::Counter, &loadCounter, &counter, 0, nullptr);
+}
+
+MetricsRetention::SeriesId MetricsRetention::addSeries(
+    Metric const& metric, Kind kind, Loader load, void const* source,
+    size_t index, std::string const* le) {
+  std::lock_guard<std::mutex> guard(_mutex);
+  _series.push_back(Series{&metric, source, load, index, le, kind, noWindow, 0, UINT32_MAX, 0, 0, {}});
+  return _series.size() - 1;
+}
+
+void MetricsRetention::remove(Metric const& metric) {
+  std::lock_guard<std::mutex> guard(_mutex);
+  for (auto& s : _series) {
+    if (s.metric == &metric) {
+      for (uint32_t b : s.blocks) {
+        _free.push_back(b);
+        --_used;
+      }
+      s.blocks.clear();
+      s.blocks.shrink_to_fit();
+      s.expiry = UINT32_MAX;
+      s.metric = nullptr;
+      s.source = nullptr;
+      if (s.le != nullptr) {
+        MetricsStrings::release(*s.le);
+        s.le = nullptr;
+      }
+    }
+  }
+}
+
+uint32_t MetricsRetention::allocate() {
+  uint32_t i;
+  if (!_free.empty()) {
+    i = _free.back();
+    _free.pop_back();
+  } else {
+    if ((_allocated >> chunkShift) == _chunks.size()) {
+      _chunks.emplace_back(new Block[size_t(1) << chunkShift]);
+    }
+    i = _allocated++;
+  }
+  ++_used;
+  memset(&block(i), 0, sizeof(Block));
+  return i;
+}
+
+void MetricsRetention::append(Series& s, uint64_t v) {
+  if (s.blocks.empty() || block(s.blocks.back()).bits + maxRecord > dataBits) {
+    uint32_t const i = allocate();
+    Block& b = block(i);
+    b.firstTick = _tick;
+    b.count = 1;
+    b.first = v;
+    s.blocks.push_back(i);
+    if (s.blocks.size() == 2) {
+      s.expiry = _tick + _retention;
+    }
+    s.last = v;
+    s.delta = 0;
+    s.leading = noWindow;
+    return;
+  }
+  Block& b = block(s.blocks.back());
+  BitWriter w{b.data, b.bits};
+  if (s.kind == Kind::Counter) {
+    // modulo 2^64, so wrapping or decreasing counters round-trip as well
+    uint64_t const delta = v - s.last;
+    writeDod(w, static_cast<int64_t>(delta - s.delta));
+    s.delta = delta;
+  } else {
+    uint64_t const x = v ^ s.last;
+    if (x == 0) {
+      w.write(0, 1);
+    } else {
+      unsigned const lz = std::min(__builtin_clzll(x), 63);
+      unsigned const tz = __builtin_ctzll(x);
+      if (s.leading != noWindow && lz >= s.leading && tz >= s.trailing) {
+        // control bits 1, 0: inside the previous window
+        w.write(0b01, 2);
+        w.write(x >> s.trailing, 64 - s.leading - s.trailing);
+      } else {
+        unsigned const m = 64 - lz - tz;
+        w.write(0b11, 2);
+        w.write(lz, 6);
+        w.write(m - 1, 6);
+        w.write(x >> tz, m);
+        s.leading = static_cast<uint8_t>(lz);
+        s.trailing = static_cast<uint8_t>(tz);
+      }
+    }
+  }
+  s.last = v;
+  ++b.count;
+}
+
+void MetricsRetention::expire(Series& s) {
+  // checked without touching the blocks, most ticks expire nothing
+  if (_tick < s.expiry) {
+    return;
+  }
+  uint32_t const oldest = _tick - _retention;
+  size_t n = 0;
+  // the next block starting at or before oldest makes a block obsolete
+  while (n + 1 < s.blocks.size() && block(s.blocks[n + 1]).firstTick <= oldest) {
+    _free.push_back(s.blocks[n]);
+    --_used;
+    ++n;
+  }
+  s.blocks.erase(s.blocks.begin(), s.blocks.begin() + n);
+  s.expiry = (s.blocks.size() > 1) ? block(s.blocks[1]).firstTick + _retention : UINT32_MAX;
+}
+
+void MetricsRetention::tick(clock::time_point now) {
+  int64_t const ms =
+    std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count();
+  std::lock_guard<std::mutex> guard(_mutex);
+  append(_time, static_cast<uint64_t>(ms));
+  for (auto& s : _series) {
+    if (s.metric != nullptr) {
+      append(s, s.load(s.source, s.index));
+    }
+  }
+  ++_tick;
+  expire(_time);
+  for (auto& s : _series) {
+    expire(s);
+  }
+}
+
+template<typename F>
+void MetricsRetention::decode(Series const& s, uint32_t from, uint32_t to, F&& f) const {
+  for (uint32_t i : s.blocks) {
+    Block const& b = block(i);
+    if (b.firstTick > to) {
+      break;
+    }
+    if (b.firstTick + b.count <= from) {
+      continue;
+    }
+    uint32_t const end = std::min(b.firstTick + b.count - 1, to);
+    uint32_t t = b.firstTick;
+    uint64_t v = b.first;
+    if (t >= from) {
+      f(t, v);
+    }
+    BitReader r{b.data, 0};
+    uint64_t delta = 0;
+    unsigned leading = 0, trailing = 0;
+    while (t < end) {
+      ++t;
+      if (s.kind == Kind::Counter) {
+        delta += static_cast<uint64_t>(readDod(r));
+        v += delta;
+      } else {
+        v ^= readXor(r, leading, trailing);
+      }
+      if (t >= from) {
+        f(t, v);
+      }
+    }
+  }
+}
+
+bool MetricsRetention::ticks(int64_t from, int64_t to, uint32_t& first, uint32_t& last,
+                             std::vector<int64_t>& times) const {
+  // all retained times, the wall clock may have gone back in between
+  times.clear();
+  times.reserve(_retention + blockSize * 8);
+  uint32_t start = 0;
+  decode(_time, 0, UINT32_MAX, [&](uint32_t t, uint64_t raw) {
+    if (times.empty()) {
+      start = t;
+    }
+    times.push_back(static_cast<int64_t>(raw));
+  });
+  auto in = [from, to](int64_t ms) { return from <= ms && ms <= to; };
+  auto f = std::find_if(times.begin(), times.end(), in);
+  if (f == times.end()) {
+    return false;
+  }
+  auto l = std::find_if(times.rbegin(), times.rend(), in).base();
+  first = start + static_cast<uint32_t>(f - times.begin());
+  last = start + static_cast<uint32_t>(l - times.begin()) - 1;
+  times.erase(l, times.end());
+  times.erase(times.begin(), f);
+  return true;
+}
+
+void MetricsRetention::query(SeriesId id, int64_t from, int64_t to,
+                             std::vector<Point>& out) const {
+  std::lock_guard<std::mutex> guard(_mutex);
+  TRI_ASSERT(id < _series.size());
+  Series const& s = _series[id];
+  std::vector<int64_t> times;
+  uint32_t first, last;
+  if (!ticks(from, to, first, last, times)) {
+    return;
+  }
+  bool const counter = s.kind == Kind::Counter;
+  out.reserve(out.size() + times.size());
+  decode(s, first, last, [&](uint32_t t, uint64_t raw) {
+    int64_t const ms = times[t - first];
+    if (ms < from || ms > to) {
+      return;
+    }
+    double value;
+    if (counter) {
+      value = static_cast<double>(raw);
+    } else {
+      memcpy(&value, &raw, sizeof(value));
+    }
+    out.push_back(Point{ms, value});
+  });
+}
+
+void MetricsRetention::dump(std::string& result) const {
+  std::lock_guard<std::mutex> guard(_mutex);
+  std::vector<int64_t> times;
+  uint32_t first, last;
+  if (!ticks(INT64_MIN, INT64_MAX, first, last, times)) {
+    return;
+  }
+  for (auto const& s : _series) {
+    if (s.metric == nullptr) {
+      continue;
+    }
+    std::string prefix = s.metric->name();
+    std::string const& lbs = s.metric->labels();
+    if (!lbs.empty() || s.le != nullptr) {
+      prefix += "{" + lbs;
+      if (s.le != nullptr) {
+        if (!lbs.empty() && lbs.back() != ',') {
+          prefix += ",";
+        }
+        prefix += "le=\"" + *s.le + "\"";
+      }
+      prefix += "}";
+    }
+    decode(s, first, last, [&](uint32_t t, uint64_t raw) {
+      char line[64];
+      if (s.kind == Kind::Counter) {
+        snprintf(line, sizeof(line), " %lld %llu\n", static_cast<long long>(times[t - first]),
+                 static_cast<unsigned long long>(raw));
+      } else {
+        double value;
+        memcpy(&value, &raw, sizeof(value));
+        snprintf(line, sizeof(line), " %lld %.17g\n", static_cast<long long>(times[t - first]),
+                 value);
+      }
+      result.append(prefix).append(line);
+    });
+  }
+}
+
+size_t MetricsRetention::series() const {
+  std::lock_guard<std::mutex> guard(_mutex);
+  size_t n = 0;
+  for (auto const& s : _series) {
+    n += (s.metric != nullptr) ? 1 : 0;
+  }
+  return n;
+}
+
+size_t MetricsRetention::samples() const {
+  std::lock_guard<std::mutex> guard(_mutex);
+  size_t n = 0;
+  for (auto const& s : _series) {
+    for (uint32_t b : s.blocks) {
+      n += block(b).count;
+    }
+  }
+  return n;
+}
+
+size_t MetricsRetention::blockMemory() const {
+  std::lock_guard<std::mutex> guard(_mutex);
+  return _used * blockSize;
+}
+
+size_t MetricsRetention::memory() const {
+  std::lock_guard<std::mutex> guard(_mutex);
+  size_t n = _chunks.size() * (size_t(1) << chunkShift) * blockSize +
+             _free.capacity() * sizeof(uint32_t) +
+             _series.capacity() * sizeof(Series) +
+             _time.blocks.capacity() * sizeof(uint32_t);
+  for (auto const& s : _series) {
+    n += s.blocks.capacity() * sizeof(uint32_t);
+  }
+  return n;
+}
+
+void MetricsRetention::start() {
+  stop();
+  {
+    std::lock_guard<std::mutex> guard(_threadMutex);
+    _stop = false;
+  }
+  _thread = std::thread([this] {
+    std::unique_lock<std::mutex> guard(_threadMutex);
+    while (!_stop) {
+      guard.unlock();
+      tick();
+      guard.lock();
+      _wakeup.wait_for(guard, _interval, [this] { return _stop; });
+    }
+  });
+}
+
+void MetricsRetention::stop() {
+  {
+    std::lock_guard<std::mutex> guard(_threadMutex);
+    _stop = true;
+  }
+  _wakeup.notify_all();
+  if (_thread.joinable()) {
+    _thread.join();
+  }
+}
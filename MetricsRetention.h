@@ -0,0 +1,226 @@
+////////////////////////////////////////////////////////////////////////////////
+/// DISCLAIMER
+///
+/// Copyright 2014-2021 ArangoDB GmbH, Cologne, Germany
+/// Copyright 2004-2014 triAGENS GmbH, Cologne, Germany
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     http://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+///
+/// Copyright holder is ArangoDB GmbH, Cologne, Germany
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef ARANGODB_REST_SERVER_METRICS_RETENTION_H
+#define ARANGODB_REST_SERVER_METRICS_RETENTION_H 1
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Metrics.h"
+
+/**
+ * @brief in-process history of metric values, Gorilla compressed
+ *
+ * tick() samples every registered series: Counters, Gauges and each bucket
+ * of a Histogram. Counters and buckets are stored with delta-of-delta
+ * encoding, steady rates cost one bit per sample. Gauges are stored as the
+ * XOR of consecutive doubles, repeated values cost one bit. The sample
+ * times are one shared delta-of-delta series, all series are sampled on
+ * every tick.
+ *
+ * Each series writes into a chain of fixed-size blocks taken from a pool
+ * shared by all series. A block starts with a raw value, so it decodes on
+ * its own. Blocks that only hold ticks older than the retention are handed
+ * back to the pool, so the footprint stays at what the last retention
+ * period needs.
+ *
+ * Counters and buckets are stored as the raw uint64 and wrap modulo 2^64.
+ * Gauges go through double, so integral gauges beyond 2^53 are rounded on
+ * the way in, and query() returns every value as a double.
+ *
+ * Registered metrics must outlive their registration. tick(), query() and
+ * dump() may run on different threads.
+ */
+class MetricsRetention {
+ public:
+  using clock = std::chrono::system_clock;
+  using SeriesId = size_t;
+
+  static constexpr size_t blockSize = 256;
+
+  struct Point {
+    int64_t time;  // milliseconds since the epoch
+    double value;
+  };
+
+  /**
+   * @brief keeps retention / interval ticks, start() ticks every interval
+   */
+  explicit MetricsRetention(std::chrono::milliseconds retention = std::chrono::hours(1),
+                            std::chrono::milliseconds interval = std::chrono::seconds(1));
+  MetricsRetention(MetricsRetention const&) = delete;
+  ~MetricsRetention();
+
+  /**
+   * @brief register a metric, a Histogram registers one series per bucket
+   * @return id of the (first) series
+   */
+  SeriesId add(Counter const& counter);
+
+  template<typename T>
+  SeriesId add(Gauge<T> const& gauge) {
+    return addSeries(gauge, Kind::Gauge, &loadGauge<T>, &gauge, 0, nullptr);
+  }
+
+  template<typename Scale, typename Storage>
+  SeriesId add(Histogram<Scale, Storage> const& histogram) {
+    SeriesId first = 0;
+    for (size_t i = 0; i < histogram.size(); ++i) {
+      SeriesId id = addSeries(histogram, Kind::Counter, &loadBucket<Histogram<Scale, Storage>>,
+                              &histogram, i, &MetricsStrings::intern(histogram.scale().delim(i)));
+      first = (i == 0) ? id : first;
+    }
+    return first;
+  }
+
+  /**
+   * @brief drop all series of metric and their history
+   */
+  void remove(Metric const& metric);
+
+  /**
+   * @brief sample all series, now is the time recorded for the tick
+   */
+  void tick(clock::time_point now = clock::now());
+
+  /**
+   * @brief samples of series id with from <= time <= to (milliseconds)
+   */
+  void query(SeriesId id, int64_t from, int64_t to, std::vector<Point>& out) const;
+
+  /**
+   * @brief all retained samples as "name{labels} time value" lines
+   */
+  void dump(std::string& result) const;
+
+  size_t series() const;
+  size_t samples() const;
+
+  /**
+   * @brief bytes in blocks in use, and all bytes including series records
+   */
+  size_t blockMemory() const;
+  size_t memory() const;
+
+  /**
+   * @brief tick every interval on a background thread
+   */
+  void start();
+  void stop();
+
+ private:
+  enum class Kind : uint8_t { Counter, Gauge };
+  using Loader = uint64_t (*)(void const* metric, size_t index);
+
+  struct Block {
+    uint32_t firstTick;
+    uint32_t count;
+    uint32_t bits;  // used bits of data
+    uint32_t reserved;
+    uint64_t first;
+    uint64_t data[(blockSize - 24) / 8];
+  };
+  static_assert(sizeof(Block) == blockSize, "blocks are fixed size");
+
+  /**
+   * @brief encoder state and block chain of one series
+   */
+  struct Series {
+    Metric const* metric;
+    void const* source;
+    Loader load;
+    size_t index;
+    std::string const* le;  // bucket bound for histograms
+    Kind kind;
+    uint8_t leading;
+    uint8_t trailing;
+    uint32_t expiry;  // tick from which the oldest block is obsolete
+    uint64_t last;
+    uint64_t delta;
+    std::vector<uint32_t> blocks;  // oldest first
+  };
+
+  static uint64_t loadCounter(void const* metric, size_t);
+
+  template<typename T>
+  static uint64_t loadGauge(void const* metric, size_t) {
+    double d = static_cast<double>(static_cast<Gauge<T> const*>(metric)->load());
+    uint64_t bits;
+    memcpy(&bits, &d, sizeof(bits));
+    return bits;
+  }
+
+  template<typename H>
+  static uint64_t loadBucket(void const* metric, size_t index) {
+    return static_cast<H const*>(metric)->load(index);
+  }
+
+  SeriesId addSeries(Metric const& metric, Kind kind, Loader load, void const* source,
+                     size_t index, std::string const* le);
+
+  void append(Series& s, uint64_t value);
+  void expire(Series& s);
+  uint32_t allocate();
+  Block& block(uint32_t i) { return _chunks[i >> chunkShift][i & chunkMask]; }
+  Block const& block(uint32_t i) const { return _chunks[i >> chunkShift][i & chunkMask]; }
+
+  /**
+   * @brief decode the samples of s at ticks [from, to] into f(tick, raw)
+   */
+  template<typename F>
+  void decode(Series const& s, uint32_t from, uint32_t to, F&& f) const;
+
+  /**
+   * @brief ticks [first, last] with times in [from, to], false if none
+   */
+  bool ticks(int64_t from, int64_t to, uint32_t& first, uint32_t& last,
+             std::vector<int64_t>& times) const;
+
+  static constexpr unsigned chunkShift = 10;
+  static constexpr uint32_t chunkMask = (1u << chunkShift) - 1;
+
+  uint32_t const _retention;  // ticks
+  std::chrono::milliseconds const _interval;
+
+  mutable std::mutex _mutex;
+  std::vector<std::unique_ptr<Block[]>> _chunks;
+  std::vector<uint32_t> _free;
+  uint32_t _allocated;  // blocks ever handed out of _chunks
+  size_t _used;
+  Series _time;
+  std::vector<Series> _series;  // metric nullptr once removed
+  uint32_t _tick;  // number of ticks so far
+
+  std::mutex _threadMutex;
+  std::condition_variable _wakeup;
+  bool _stop;
+  std::thread _thread;
+};
+
+#endif
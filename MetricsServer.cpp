@@ -0,0 +1,475 @@
+////////////////////////////////////////////////////////////////////////////////
+/// DISCLAIMER
+///
+/// Copyright 2014-2021 ArangoDB GmbH, Cologne, Germany
+/// Copyright 2004-2014 triAGENS GmbH, Cologne, Germany
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     http://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+///
+/// Copyright holder is ArangoDB GmbH, Cologne, Germany
+////////////////////////////////////////////////////////////////////////////////
+
+#include "MetricsServer.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#if defined HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+namespace {
+
+// requests are a few hundred bytes, anything larger is not a scraper
+constexpr size_t maxRequest = 16384;
+
+std::string lower(std::string s) {
+  std::transform(s.begin(), s.end(), s.begin(),
+                 [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+  return s;
+}
+
+std::string trim(std::string const& s) {
+  size_t b = s.find_first_not_of(" \t");
+  if (b == std::string::npos) {
+    return std::string();
+  }
+  return s.substr(b, s.find_last_not_of(" \t") - b + 1);
+}
+
+/**
+ * @brief whether a lower cased list like "gzip;q=0.5, br" accepts token,
+ *        an explicit entry wins over "*" and q=0 means not acceptable
+ */
+bool accepts(std::string const& value, std::string const& token) {
+  double q = -1.;
+  double wildcard = -1.;
+  size_t pos = 0;
+  while (pos <= value.size()) {
+    size_t comma = std::min(value.find(',', pos), value.size());
+    std::string item = value.substr(pos, comma - pos);
+    pos = comma + 1;
+    size_t semi = item.find(';');
+    std::string name = trim(item.substr(0, semi));
+    double weight = 1.;
+    while (semi != std::string::npos) {
+      size_t next = item.find(';', semi + 1);
+      std::string param = trim(item.substr(semi + 1, next - semi - 1));
+      if (param.rfind("q=", 0) == 0) {
+        weight = std::strtod(param.c_str() + 2, nullptr);
+      }
+      semi = next;
+    }
+    if (name == token) {
+      q = weight;
+    } else if (name == "*") {
+      wildcard = weight;
+    }
+  }
+  return (q >= 0. ? q : wildcard) > 0.;
+}
+
+#if defined HAVE_ZLIB
+std::string gzip(std::string const& in) {
+  z_stream z{};
+  if (deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    return std::string();
+  }
+  std::string out(deflateBound(&z, in.size()) + 32, '\0');
+  z.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+  z.avail_in = static_cast<uInt>(in.size());
+  z.next_out = reinterpret_cast<Bytef*>(&out[0]);
+  z.avail_out = static_cast<uInt>(out.size());
+  int rc = deflate(&z, Z_FINISH);
+  out.resize(z.total_out);
+  deflateEnd(&z);
+  return (rc == Z_STREAM_END) ? out : std::string();
+}
+#endif
+
+}  // namespace
+
+MetricsServer::MetricsServer(MetricsExporter& exporter)
+  : _exporter(exporter), _listen(-1), _epoll(-1), _wakeup(-1), _spare(-1), _port(0),
+    _paused(false), _warned(false) {}
+
+MetricsServer::~MetricsServer() { stop(); }
+
+bool MetricsServer::start(uint16_t port, std::string const& address) {
+  stop();
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  if (inet_pton(AF_INET, address.c_str(), &addr.sin_addr) != 1) {
+    errno = EINVAL;
+    return false;
+  }
+  _listen = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  _epoll = epoll_create1(EPOLL_CLOEXEC);
+  _wakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  _spare = open("/dev/null", O_RDONLY | O_CLOEXEC);
+  int one = 1;
+  socklen_t len = sizeof(addr);
+  if (_listen < 0 || _epoll < 0 || _wakeup < 0 ||
+      setsockopt(_listen, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0 ||
+      bind(_listen, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+      listen(_listen, SOMAXCONN) != 0 ||
+      getsockname(_listen, reinterpret_cast<sockaddr*>(&addr), &len) != 0) {
+    int e = errno;
+    stop();
+    errno = e;
+    return false;
+  }
+  _port = ntohs(addr.sin_port);
+  for (int fd : {_listen, _wakeup}) {
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    epoll_ctl(_epoll, EPOLL_CTL_ADD, fd, &ev);
+  }
+  _thread = std::thread([this] { run(); });
+  return true;
+}
+
+void MetricsServer::stop() {
+  if (_thread.joinable()) {
+    uint64_t one = 1;
+    ssize_t n = write(_wakeup, &one, sizeof(one));
+    (void) n;
+    _thread.join();
+  }
+  for (auto const& c : _connections) {
+    close(c.first);
+  }
+  _connections.clear();
+  for (int* fd : {&_listen, &_epoll, &_wakeup, &_spare}) {
+    if (*fd >= 0) {
+      close(*fd);
+      *fd = -1;
+    }
+  }
+  _body.reset();
+  _port = 0;
+  _paused = false;
+  _warned = false;
+}
+
+void MetricsServer::run() {
+  epoll_event events[256];
+  while (true) {
+    int n = epoll_wait(_epoll, events, 256, _paused ? 1000 : -1);
+    if (n < 0 && errno != EINTR) {
+      return;
+    }
+    if (n == 0) {
+      resume();
+    }
+    for (int i = 0; i < n; ++i) {
+      int fd = events[i].data.fd;
+      if (fd == _wakeup) {
+        return;
+      }
+      if (fd == _listen) {
+        accept();
+        continue;
+      }
+      auto it = _connections.find(fd);
+      if (it == _connections.end()) {
+        continue;
+      }
+      bool ok = (events[i].events & EPOLLOUT) ? respond(fd, it->second)
+                                              : receive(fd, it->second);
+      if (!ok) {
+        drop(fd);
+      }
+    }
+  }
+}
+
+void MetricsServer::accept() {
+  while (true) {
+    int fd = accept4(_listen, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      int const e = errno;
+      if (e == EINTR || e == ECONNABORTED) {
+        continue;
+      }
+      if (e != EAGAIN && e != EWOULDBLOCK && refuse(e)) {
+        continue;
+      }
+      return;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    if (epoll_ctl(_epoll, EPOLL_CTL_ADD, fd, &ev) != 0) {
+      close(fd);
+      continue;
+    }
+    _connections.emplace(fd, Connection());
+  }
+}
+
+bool MetricsServer::refuse(int error) {
+  if (!_warned) {
+    _warned = true;
+    std::cerr << "MetricsServer: cannot accept connections (" << strerror(error)
+              << "), refusing scrapers until resources are freed" << std::endl;
+  }
+  if ((error == EMFILE || error == ENFILE) && _spare >= 0) {
+    // the spare descriptor makes room to take the connection off the queue
+    close(_spare);
+    int fd = accept4(_listen, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd >= 0) {
+      close(fd);
+    }
+    _spare = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+      return true;
+    }
+  }
+  // the listen socket is level-triggered and would wake us up right away
+  epoll_ctl(_epoll, EPOLL_CTL_DEL, _listen, nullptr);
+  _paused = true;
+  return false;
+}
+
+void MetricsServer::resume() {
+  if (!_paused) {
+    return;
+  }
+  epoll_event ev{};
+  ev.events = EPOLLIN;
+  ev.data.fd = _listen;
+  epoll_ctl(_epoll, EPOLL_CTL_ADD, _listen, &ev);
+  _paused = false;
+}
+
+void MetricsServer::drop(int fd) {
+  epoll_ctl(_epoll, EPOLL_CTL_DEL, fd, nullptr);
+  close(fd);
+  _connections.erase(fd);
+  resume();
+}
+
+bool MetricsServer::receive(int fd, Connection& c) {
+  char buf[4096];
+  while (true) {
+    ssize_t n = recv(fd, buf, sizeof(buf), 0);
+    if (n > 0) {
+      c.in.append(buf, static_cast<size_t>(n));
+      if (c.in.size() > 4 * maxRequest) {
+        return false;
+      }
+      continue;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    }
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    return false;  // peer closed or error
+  }
+  // while a response is still going out EPOLLOUT drives the connection
+  return c.payload != nullptr || !c.head.empty() || respond(fd, c);
+}
+
+/**
+ * @brief answer complete requests in order until the socket is full
+ */
+bool MetricsServer::respond(int fd, Connection& c) {
+  while (true) {
+    if (c.payload != nullptr || !c.head.empty()) {
+      if (!transmit(fd, c)) {
+        return false;
+      }
+      if (c.payload != nullptr || !c.head.empty()) {
+        epoll_event ev{};
+        ev.events = EPOLLOUT;
+        ev.data.fd = fd;
+        epoll_ctl(_epoll, EPOLL_CTL_MOD, fd, &ev);
+        return true;
+      }
+      if (c.close) {
+        return false;
+      }
+      epoll_event ev{};
+      ev.events = EPOLLIN;
+      ev.data.fd = fd;
+      epoll_ctl(_epoll, EPOLL_CTL_MOD, fd, &ev);
+    }
+
+    size_t end = c.in.find("\r\n\r\n");
+    if (end == std::string::npos) {
+      return c.in.size() <= maxRequest;
+    }
+    std::string request = c.in.substr(0, end);
+    c.in.erase(0, end + 4);
+
+    // request line
+    size_t eol = std::min(request.find("\r\n"), request.size());
+    std::string line = request.substr(0, eol);
+    size_t sp1 = line.find(' ');
+    size_t sp2 = (sp1 == std::string::npos) ? sp1 : line.find(' ', sp1 + 1);
+    if (sp2 == std::string::npos) {
+      c.head = "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+      c.close = true;
+      continue;
+    }
+    std::string method = line.substr(0, sp1);
+    std::string path = line.substr(sp1 + 1, sp2 - sp1 - 1);
+    std::string version = line.substr(sp2 + 1);
+    path = path.substr(0, path.find('?'));
+
+    // headers
+    bool keepAlive = (version == "HTTP/1.1");
+    bool acceptGzip = false;
+    bool acceptOpenMetrics = false;
+    size_t pos = eol;
+    while (pos < request.size()) {
+      size_t next = std::min(request.find("\r\n", pos + 2), request.size());
+      std::string header = request.substr(pos + 2, next - pos - 2);
+      pos = next;
+      size_t colon = header.find(':');
+      if (colon == std::string::npos) {
+        continue;
+      }
+      std::string name = lower(header.substr(0, colon));
+      std::string value = lower(header.substr(colon + 1));
+      if (name == "connection") {
+        if (value.find("close") != std::string::npos) {
+          keepAlive = false;
+        } else if (value.find("keep-alive") != std::string::npos) {
+          keepAlive = true;
+        }
+      } else if (name == "accept-encoding") {
+        acceptGzip = accepts(value, "gzip");
+      } else if (name == "accept") {
+        acceptOpenMetrics = accepts(value, "application/openmetrics-text");
+      }
+    }
+    c.close = !keepAlive;
+    char const* connection = keepAlive ? "" : "Connection: close\r\n";
+
+    if (method != "GET" && method != "HEAD") {
+      c.head = std::string("HTTP/1.1 405 Method Not Allowed\r\nAllow: GET, HEAD\r\n"
+                           "Content-Length: 0\r\n") + connection + "\r\n";
+      continue;
+    }
+    if (path != "/metrics") {
+      c.head = std::string("HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n") +
+        connection + "\r\n";
+      continue;
+    }
+
+    c.body = body();
+    bool om = acceptOpenMetrics && !c.body->openMetrics.empty();
+    std::string const& plain = om ? c.body->openMetrics : c.body->plain;
+    std::string const& zipped = om ? c.body->openMetricsGzip : c.body->gzip;
+    bool gz = acceptGzip && !zipped.empty();
+    std::string const& payload = gz ? zipped : plain;
+    c.head = om ? "HTTP/1.1 200 OK\r\n"
+                  "Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"
+                : "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n";
+    c.head += "Vary: Accept, Accept-Encoding\r\n";
+    if (gz) {
+      c.head += "Content-Encoding: gzip\r\n";
+    }
+    c.head += "Content-Length: " + std::to_string(payload.size()) + "\r\n";
+    c.head += connection;
+    c.head += "\r\n";
+    c.payload = (method == "GET") ? &payload : nullptr;
+    c.sent = 0;
+  }
+}
+
+/**
+ * @brief send pending head and payload, false on a broken connection
+ */
+bool MetricsServer::transmit(int fd, Connection& c) {
+  while (c.payload != nullptr || !c.head.empty()) {
+    size_t head = c.head.size();
+    size_t total = head + (c.payload != nullptr ? c.payload->size() : 0);
+    iovec iov[2];
+    int n = 0;
+    if (c.sent < head) {
+      iov[n].iov_base = const_cast<char*>(c.head.data() + c.sent);
+      iov[n].iov_len = head - c.sent;
+      ++n;
+    }
+    if (c.payload != nullptr) {
+      size_t off = (c.sent > head) ? c.sent - head : 0;
+      iov[n].iov_base = const_cast<char*>(c.payload->data() + off);
+      iov[n].iov_len = c.payload->size() - off;
+      ++n;
+    }
+    // writev, but without SIGPIPE on a vanished peer
+    msghdr msg{};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = n;
+    ssize_t w = sendmsg(fd, &msg, MSG_NOSIGNAL);
+    if (w < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+    c.sent += static_cast<size_t>(w);
+    if (c.sent == total) {
+      c.head.clear();
+      c.payload = nullptr;
+      c.body.reset();
+      c.sent = 0;
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief published snapshot, copied (and compressed) once per generation
+ */
+std::shared_ptr<MetricsServer::Body const> MetricsServer::body() {
+  auto snapshot = _exporter.scrape();
+  if (_body == nullptr || _body->generation != snapshot.generation()) {
+    auto b = std::make_shared<Body>();
+    b->generation = snapshot.generation();
+    b->plain = snapshot.text();
+    b->openMetrics = snapshot.openMetrics();
+#if defined HAVE_ZLIB
+    b->gzip = gzip(b->plain);
+    if (!b->openMetrics.empty()) {
+      b->openMetricsGzip = gzip(b->openMetrics);
+    }
+#endif
+    _body = std::move(b);
+  }
+  return _body;
+}
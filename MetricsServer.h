@@ -0,0 +1,115 @@
+////////////////////////////////////////////////////////////////////////////////
+/// DISCLAIMER
+///
+/// Copyright 2014-2021 ArangoDB GmbH, Cologne, Germany
+/// Copyright 2004-2014 triAGENS GmbH, Cologne, Germany
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     http://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+///
+/// Copyright holder is ArangoDB GmbH, Cologne, Germany
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef ARANGODB_REST_SERVER_METRICS_SERVER_H
+#define ARANGODB_REST_SERVER_METRICS_SERVER_H 1
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include "MetricsExporter.h"
+
+/**
+ * @brief minimal HTTP/1.1 endpoint serving GET /metrics
+ *
+ * One thread runs a level-triggered epoll loop over all connections, request
+ * threads are never involved. The body is the exporter's latest published
+ * snapshot. The server copies it once per exporter generation, gzips it once
+ * if built with zlib (HAVE_ZLIB), and shares it between all connections, so
+ * a slow scraper does not pin an exporter buffer. Responses go out with one
+ * writev of header and body. Keep-alive is the HTTP/1.1 default,
+ * "Connection: close" and HTTP/1.0 close after the response. Pipelined
+ * requests are answered in order. Scrapers whose Accept header asks for
+ * application/openmetrics-text get the OpenMetrics text, with exemplars,
+ * if the exporter renders it.
+ *
+ * When out of descriptors the server accepts and closes pending connections
+ * with a spare descriptor instead of spinning on the listen socket, other
+ * accept failures pause listening; either is reported once on stderr.
+ *
+ * Linux only. start() returns false with errno set if the socket cannot be
+ * bound.
+ */
+class MetricsServer {
+ public:
+  explicit MetricsServer(MetricsExporter& exporter);
+  MetricsServer(MetricsServer const&) = delete;
+  ~MetricsServer();
+
+  /**
+   * @brief listen on address:port, port 0 picks a free one, see port()
+   */
+  bool start(uint16_t port = 0, std::string const& address = "127.0.0.1");
+  void stop();
+
+  uint16_t port() const { return _port; }
+
+ private:
+  struct Body {
+    uint64_t generation;
+    std::string plain;
+    std::string gzip;
+    std::string openMetrics;
+    std::string openMetricsGzip;
+  };
+
+  struct Connection {
+    std::string in;
+    std::string head;
+    std::shared_ptr<Body const> body;
+    std::string const* payload = nullptr;
+    size_t sent = 0;
+    bool close = false;
+  };
+
+  void run();
+  void accept();
+  bool receive(int fd, Connection& c);
+  bool respond(int fd, Connection& c);
+  bool transmit(int fd, Connection& c);
+  void drop(int fd);
+
+  /**
+   * @brief accept failed with error: refuse the pending connection with the
+   * spare descriptor, true if that worked, else stop listening until a
+   * connection is dropped or a second has passed
+   */
+  bool refuse(int error);
+  void resume();
+  std::shared_ptr<Body const> body();
+
+  MetricsExporter& _exporter;
+  int _listen;
+  int _epoll;
+  int _wakeup;
+  int _spare;  // /dev/null, closed to accept one connection when out of fds
+  uint16_t _port;
+  bool _paused;  // _listen is out of the epoll set
+  bool _warned;
+  std::thread _thread;
+  std::unordered_map<int, Connection> _connections;
+  std::shared_ptr<Body const> _body;
+};
+
+#endif
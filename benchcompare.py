@@ -0,0 +1,205 @@
+#!/usr/bin/env python3
+"""Store benchmark baselines per host and CPU model and compare against them.
+
+  benchcompare.py baseline [options] BINARY...   run and store as baseline
+  benchcompare.py compare [options] BINARY...    run and compare to baseline
+  benchcompare.py diff [options] OLD.json NEW.json
+
+Every binary is run with --benchmark_repetitions and JSON output. For each
+benchmark the per-repetition times of baseline and new run are compared
+with a one-sided Mann-Whitney U test. A benchmark regressed if its median
+got slower by more than --threshold and the test is significant at
+--alpha. The exit code is 1 if anything regressed, 2 on usage errors.
+
+Only the standard library is used and nothing leaves the machine.
+"""
+
+import argparse
+import json
+import math
+import os
+import platform
+import re
+import subprocess
+import sys
+import tempfile
+from functools import lru_cache
+
+
+def cpu_model():
+    try:
+        with open("/proc/cpuinfo") as f:
+            for line in f:
+                if line.startswith("model name"):
+                    return line.split(":", 1)[1].strip()
+    except OSError:
+        pass
+    return platform.processor() or platform.machine()
+
+
+def host_key():
+    key = platform.node() + "-" + cpu_model()
+    return re.sub(r"[^A-Za-z0-9.]+", "_", key).strip("_")
+
+
+def run(binary, args):
+    with tempfile.NamedTemporaryFile(suffix=".json", delete=False) as f:
+        out = f.name
+    try:
+        cmd = [binary,
+               "--benchmark_repetitions=%d" % args.repetitions,
+               "--benchmark_filter=%s" % args.filter,
+               "--benchmark_out=%s" % out,
+               "--benchmark_out_format=json"]
+        if args.min_time:
+            cmd.append("--benchmark_min_time=%s" % args.min_time)
+        print("running", " ".join(cmd), file=sys.stderr)
+        subprocess.run(cmd, check=True, stdout=subprocess.DEVNULL)
+        with open(out) as f:
+            return json.load(f)
+    finally:
+        os.unlink(out)
+
+
+def samples(report, metric):
+    """benchmark name -> list of per-repetition values"""
+    result = {}
+    for b in report.get("benchmarks", []):
+        if b.get("run_type", "iteration") != "iteration" or "error_occurred" in b:
+            continue
+        if metric not in b:
+            continue
+        result.setdefault(b["run_name"], []).append(float(b[metric]))
+    return result
+
+
+def median(xs):
+    s = sorted(xs)
+    n = len(s)
+    return s[n // 2] if n % 2 else (s[n // 2 - 1] + s[n // 2]) / 2.
+
+
+def ranks(values):
+    order = sorted(range(len(values)), key=lambda i: values[i])
+    r = [0.] * len(values)
+    ties = []
+    i = 0
+    while i < len(order):
+        j = i
+        while j + 1 < len(order) and values[order[j + 1]] == values[order[i]]:
+            j += 1
+        for k in range(i, j + 1):
+            r[order[k]] = (i + j) / 2. + 1.
+        if j > i:
+            ties.append(j - i + 1)
+        i = j + 1
+    return r, ties
+
+
+@lru_cache(maxsize=None)
+def u_count(m, n, u):
+    """number of arrangements of m x's and n y's with exactly u (x > y) pairs"""
+    if u < 0:
+        return 0
+    if m == 0 or n == 0:
+        return 1 if u == 0 else 0
+    # the largest element is either an x (beating all n y's) or a y
+    return u_count(m - 1, n, u - n) + u_count(m, n - 1, u)
+
+
+def mann_whitney_greater(x, y):
+    """p-value for H1: x tends to be larger than y"""
+    m, n = len(x), len(y)
+    r, ties = ranks(list(x) + list(y))
+    u = sum(r[:m]) - m * (m + 1) / 2.
+    if not ties and m + n <= 40:
+        total = math.comb(m + n, m)
+        ui = int(round(u))
+        return sum(u_count(m, n, k) for k in range(ui, m * n + 1)) / total
+    mean = m * n / 2.
+    tie = sum(t ** 3 - t for t in ties) / ((m + n) * (m + n - 1))
+    var = m * n / 12. * ((m + n + 1) - tie)
+    if var <= 0:
+        return 1.
+    z = (u - mean - .5) / math.sqrt(var)
+    return .5 * math.erfc(z / math.sqrt(2.))
+
+
+def compare(old, new, args):
+    old_s, new_s = samples(old, args.metric), samples(new, args.metric)
+    regressions = 0
+    width = max([len(k) for k in new_s] + [9])
+    print("%-*s %12s %12s %9s %9s" % (width, "Benchmark", "baseline", "new",
+                                      "change", "p"))
+    for name, ys in new_s.items():
+        xs = old_s.get(name)
+        if not xs:
+            print("%-*s %12s %12.4g %9s %9s  new" % (width, name, "-", median(ys),
+                                                   "-", "-"))
+            continue
+        mo, mn = median(xs), median(ys)
+        change = (mn - mo) / mo if mo else 0.
+        p = mann_whitney_greater(ys, xs)
+        verdict = ""
+        if change > args.threshold and p < args.alpha:
+            verdict = "REGRESSION"
+            regressions += 1
+        elif change < -args.threshold and mann_whitney_greater(xs, ys) < args.alpha:
+            verdict = "improved"
+        print("%-*s %12.4g %12.4g %+8.1f%% %9.3g  %s" % (width, name, mo, mn,
+                                                       100. * change, p, verdict))
+    if min([len(v) for v in new_s.values()] + [len(v) for v in old_s.values()] or [0]) < 4:
+        print("note: fewer than 4 repetitions, no difference can be significant",
+              file=sys.stderr)
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("mode", choices=["baseline", "compare", "diff"])
+    parser.add_argument("inputs", nargs="+", help="binaries, or two JSON files for diff")
+    parser.add_argument("--dir", default="baselines", help="baseline directory")
+    parser.add_argument("--repetitions", type=int, default=10)
+    parser.add_argument("--filter", default=".")
+    parser.add_argument("--min-time", default="")
+    parser.add_argument("--metric", default="real_time",
+                        help="JSON field to compare, e.g. cpu_time")
+    parser.add_argument("--threshold", type=float, default=.05,
+                        help="relative slowdown of the median to report")
+    parser.add_argument("--alpha", type=float, default=.01,
+                        help="significance level of the U test")
+    args = parser.parse_args()
+
+    if args.mode == "diff":
+        if len(args.inputs) != 2:
+            parser.error("diff needs OLD.json NEW.json")
+        with open(args.inputs[0]) as f:
+            old = json.load(f)
+        with open(args.inputs[1]) as f:
+            new = json.load(f)
+        return 1 if compare(old, new, args) else 0
+
+    directory = os.path.join(args.dir, host_key())
+    regressions = 0
+    for binary in args.inputs:
+        path = os.path.join(directory, os.path.basename(binary) + ".json")
+        if args.mode == "compare" and not os.path.exists(path):
+            print("no baseline %s, run the baseline mode first" % path, file=sys.stderr)
+            return 2
+        report = run(binary, args)
+        if args.mode == "baseline":
+            os.makedirs(directory, exist_ok=True)
+            with open(path, "w") as f:
+                json.dump(report, f, indent=1)
+            print("stored", path, file=sys.stderr)
+        else:
+            with open(path) as f:
+                regressions += compare(json.load(f), report, args)
+    if regressions:
+        print("%d regression(s)" % regressions, file=sys.stderr)
+    return 1 if regressions else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
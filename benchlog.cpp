@@ -9,7 +9,12 @@
 #include <atomic>
 
 #include <benchmark/benchmark.h>
+#include "BucketKernels.h"
+#include "buckets.h"
+#include "distributions.h"
 #include "logscale.h"
+#include "perfcounters.h"
+#include "scaling.h"
 
 static int count = 0;
 static uint64_t dummy64 = 0;
@@ -36,12 +41,14 @@ static void BM_OurHistogram(benchmark::State& state) {
     counts[i] = 0;
   }
   float v = 1.0;
+  bench::PerfCounters perf;
   while (state.KeepRunning()) {
     size_t x = static_cast<size_t>(1+std::floor((log(v - low)-div)/lbase));
     counts[x]++;
     v += 1.0;
     v = (v > 999.0) ? 1.0 : v;
   }
+  perf.report(state);
   dummyfloat += v;
   for (size_t i = 0; i < 10; ++i) {
     dummy64 += counts[i];
@@ -77,12 +84,14 @@ static void BM_NewHistogramFirstTry(benchmark::State& state) {
     counts[i] = 0;
   }
   float v = 1.0;
+  bench::PerfCounters perf;
   while (state.KeepRunning()) {
     uint32_t x = ((uint32_t) (((uint64_t) v >> 52) & 0x7ff)) / 10;
     counts[x]++;
     v += 1.0;
     v = (v > 999.0) ? 1.0 : v;
   }
+  perf.report(state);
 #if 0
   if (++count == 1) {
     std::cout << "Limit              Count\n";
@@ -108,10 +117,12 @@ void BM_Log2Empty(benchmark::State& state) {
   }
   T r = 0;
   size_t i = 0;
+  bench::PerfCounters perf;
   while (state.KeepRunning()) {
     //r += vtab[i];
     benchmark::DoNotOptimize(i = (i >= 9) ? 0 : i+1);
   }
+  perf.report(state);
 }
 BENCHMARK_TEMPLATE(BM_Log2Empty, float);
 BENCHMARK_TEMPLATE(BM_Log2Empty, double);
@@ -125,10 +136,12 @@ void BM_Log2(benchmark::State& state) {
     v *= 10.0;
   }  T r = 0;
   size_t i = 0;
+  bench::PerfCounters perf;
   while (state.KeepRunning()) {
     r += std::log2(vtab[i]);
     i = (i >= 9) ? 0 : i+1;
   }
+  perf.report(state);
   dummydouble += r;
 }
 BENCHMARK_TEMPLATE(BM_Log2, float);
@@ -144,10 +157,12 @@ void BM_Log(benchmark::State& state) {
   }
   T r = 0;
   size_t i = 0;
+  bench::PerfCounters perf;
   while (state.KeepRunning()) {
     r += std::log(vtab[i]);
     i = (i >= 9) ? 0 : i+1;
   }
+  perf.report(state);
   dummydouble += r;
 }
 BENCHMARK_TEMPLATE(BM_Log, float);
@@ -209,10 +224,12 @@ static void BM_Log2Rough(benchmark::State& state) {
   }
   uint32_t r = 0;
   size_t i = 0;
+  bench::PerfCounters perf;
   while (state.KeepRunning()) {
     benchmark::DoNotOptimize(r += log2rough(vtab[i]));
     i = (i >= 9) ? 0 : i+1;
   }
+  perf.report(state);
   dummydouble += r;
 }
 BENCHMARK_TEMPLATE(BM_Log2Rough, float);
@@ -221,158 +238,128 @@ BENCHMARK_TEMPLATE(BM_Log2Rough, uint64_t);
 BENCHMARK_TEMPLATE(BM_Log2Rough, uint32_t);
 
 
+// The remaining benchmarks draw their values from a pre-generated pool, see
+// distributions.h; range(0) is the distribution, range(1) the batch size.
+// [lowest, highest] keeps all bucketing kernels below in range.
+static constexpr double lowest = 2.;
+static constexpr double highest = 1e8;
+
 template<typename T>
 void BM_log(benchmark::State& state) {
-  std::vector<T> data;
+  bench::Values<T> data(state, lowest, highest);
   uint32_t y;
-  std::random_device rd;
-  std::mt19937 gen(rd());
-  T s;
+  bench::PerfCounters perf;
   for (auto _ : state) {
-    state.PauseTiming();
-    for (int i = 0; i < state.range(0); ++i)
-      if constexpr (std::is_integral<T>::value) {
-        std::uniform_int_distribution<T> dis(1,100000);
-        data.push_back(dis(gen));
-      } else {
-        std::uniform_real_distribution<T> dis(1,100000);
-        data.push_back(dis(gen));
-      }
-    auto s = data.begin();
-    state.ResumeTiming();
     for (int j = 0; j < state.range(1); ++j) {
-      benchmark::DoNotOptimize(y = log(*s++));
+      benchmark::DoNotOptimize(y = log(data.next()));
     }
   }
+  perf.report(state);
   dummydouble += y;
 }
-BENCHMARK_TEMPLATE(BM_log, float)->Args({1<<2, 128})
-  ->Args({1<<2, 256})->Args({1<<2, 512})->Args({1<<2, 1024});
-BENCHMARK_TEMPLATE(BM_log, double)->Args({1<<2, 128})
-  ->Args({1<<2, 256})->Args({1<<2, 512})->Args({1<<2, 1024});
+BENCHMARK_TEMPLATE(BM_log, float)
+  ->ArgNames({"dist", "batch"})->ArgsProduct({bench::distributions(), {128, 1024}});
+BENCHMARK_TEMPLATE(BM_log, double)
+  ->ArgNames({"dist", "batch"})->ArgsProduct({bench::distributions(), {128, 1024}});
 
 template<typename T>
 void BM_log2(benchmark::State& state) {
-  std::vector<T> data;
+  bench::Values<T> data(state, lowest, highest);
   uint32_t y;
-  std::random_device rd;
-  std::mt19937 gen(rd());
-  T s;
+  bench::PerfCounters perf;
   for (auto _ : state) {
-    state.PauseTiming();
-    for (int i = 0; i < state.range(0); ++i)
-      if constexpr (std::is_integral<T>::value) {
-        std::uniform_int_distribution<T> dis(1,100000);
-        data.push_back(dis(gen));
-      } else {
-        std::uniform_real_distribution<T> dis(1,100000);
-        data.push_back(dis(gen));
-      }
-    auto s = data.begin();
-    state.ResumeTiming();
     for (int j = 0; j < state.range(1); ++j) {
-      benchmark::DoNotOptimize(y = log2(*s++));
+      benchmark::DoNotOptimize(y = log2(data.next()));
     }
   }
+  perf.report(state);
   dummydouble += y;
 }
-BENCHMARK_TEMPLATE(BM_log2, float)->Args({1<<2, 128})
-  ->Args({1<<2, 256})->Args({1<<2, 512})->Args({1<<2, 1024});
-BENCHMARK_TEMPLATE(BM_log2, double)->Args({1<<2, 128})
-  ->Args({1<<2, 256})->Args({1<<2, 512})->Args({1<<2, 1024});
+BENCHMARK_TEMPLATE(BM_log2, float)
+  ->ArgNames({"dist", "batch"})->ArgsProduct({bench::distributions(), {128, 1024}});
+BENCHMARK_TEMPLATE(BM_log2, double)
+  ->ArgNames({"dist", "batch"})->ArgsProduct({bench::distributions(), {128, 1024}});
 
 template<typename T>
 void BM_log2r(benchmark::State& state) {
-  std::vector<T> data;
+  bench::Values<T> data(state, lowest, highest);
   uint32_t y;
-  std::random_device rd;
-  std::mt19937 gen(rd());
-  T s;
+  bench::PerfCounters perf;
   for (auto _ : state) {
-    state.PauseTiming();
-    for (int i = 0; i < state.range(0); ++i)
-      if constexpr (std::is_integral<T>::value) {
-        std::uniform_int_distribution<T> dis(1,100000);
-        data.push_back(dis(gen));
-      } else {
-        std::uniform_real_distribution<T> dis(1,100000);
-        data.push_back(dis(gen));
-      }
-    state.ResumeTiming();
-    auto s = data.begin();
     for (int j = 0; j < state.range(1); ++j) {
-      benchmark::DoNotOptimize(y = log2rough(*s++));
+      benchmark::DoNotOptimize(y = log2rough(data.next()));
     }
   }
+  perf.report(state);
   dummydouble += y;
 }
-BENCHMARK_TEMPLATE(BM_log2r, float)->Args({1<<2, 128})
-  ->Args({1<<2, 256})->Args({1<<2, 512})->Args({1<<2, 1024});
-BENCHMARK_TEMPLATE(BM_log2r, double)->Args({1<<2, 128})
-  ->Args({1<<2, 256})->Args({1<<2, 512})->Args({1<<2, 1024});
-BENCHMARK_TEMPLATE(BM_log2r, uint32_t)->Args({1<<2, 128})
-  ->Args({1<<2, 256})->Args({1<<2, 512})->Args({1<<2, 1024});
-BENCHMARK_TEMPLATE(BM_log2r, uint64_t)->Args({1<<2, 128})
-  ->Args({1<<2, 256})->Args({1<<2, 512})->Args({1<<2, 1024});
-
-static double table[9] = {1.0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8 };
-
-static inline size_t findBucket(double d) {
-  for (size_t i = 0; i < 9; ++i) {
-    if (d <= table[i]) {
-      return i;
+BENCHMARK_TEMPLATE(BM_log2r, float)
+  ->ArgNames({"dist", "batch"})->ArgsProduct({bench::distributions(), {128, 1024}});
+BENCHMARK_TEMPLATE(BM_log2r, double)
+  ->ArgNames({"dist", "batch"})->ArgsProduct({bench::distributions(), {128, 1024}});
+BENCHMARK_TEMPLATE(BM_log2r, uint32_t)
+  ->ArgNames({"dist", "batch"})->ArgsProduct({bench::distributions(), {128, 1024}});
+BENCHMARK_TEMPLATE(BM_log2r, uint64_t)
+  ->ArgNames({"dist", "batch"})->ArgsProduct({bench::distributions(), {128, 1024}});
+
+// log2rough over a whole batch through the dispatched kernels, level 0..2
+// forces baseline, avx2, avx512, 3 is the one picked for this CPU
+template<typename T>
+void BM_log2r_batch(benchmark::State& state) {
+  int const level = static_cast<int>(state.range(0));
+  size_t const batch = static_cast<size_t>(state.range(1));
+  if (level <= 2 && static_cast<CpuLevel>(level) > cpuLevel()) {
+    state.SkipWithError("instruction set not supported");
+    return;
+  }
+  BucketKernels const& k = (level <= 2) ? bucketKernelsFor(static_cast<CpuLevel>(level))
+                                        : bucketKernels();
+  bench::Values<T> data(bench::Dist::LogNormal, lowest, highest);
+  std::vector<int32_t> out(batch);
+  size_t off = 0;
+  bench::PerfCounters perf;
+  for (auto _ : state) {
+    if constexpr (std::is_same_v<T, double>) {
+      k.log2roughDouble(data.all().data() + off, batch, out.data());
+    } else {
+      k.log2roughFloat(data.all().data() + off, batch, out.data());
     }
+    benchmark::DoNotOptimize(out.data());
+    benchmark::ClobberMemory();
+    off = (off + batch) & (bench::Values<T>::size - 1);
   }
-  return 9;
-}
-
-static inline size_t findBucket2(double d) {
-  size_t r = 0;
-  r = (d <= table[0]) ? 0 : r;
-  r = (d <= table[1]) ? 1 : r;
-  r = (d <= table[2]) ? 2 : r;
-  r = (d <= table[3]) ? 3 : r;
-  r = (d <= table[4]) ? 4 : r;
-  r = (d <= table[5]) ? 5 : r;
-  r = (d <= table[6]) ? 6 : r;
-  r = (d <= table[7]) ? 7 : r;
-  r = (d <= table[8]) ? 8 : r;
-  return r;
+  perf.report(state);
+  state.SetItemsProcessed(state.iterations() * batch);
+  state.SetLabel(cpuLevelName(k.level));
 }
+BENCHMARK_TEMPLATE(BM_log2r_batch, float)
+  ->ArgNames({"level", "batch"})->ArgsProduct({{0, 1, 2, 3}, {128, 1024}});
+BENCHMARK_TEMPLATE(BM_log2r_batch, double)
+  ->ArgNames({"level", "batch"})->ArgsProduct({{0, 1, 2, 3}, {128, 1024}});
 
 void BM_LinearSearch(benchmark::State& state) {
-  double vtab[10];
-  double v = 1.0;
-  for (int i = 0; i < 10; ++i) {
-    vtab[i] = v;
-    v *= 10.0;
-  }
+  bench::Values<double> data(state, lowest, highest);
   uint32_t r = 0;
-  size_t i = 0;
+  bench::PerfCounters perf;
   while (state.KeepRunning()) {
-    benchmark::DoNotOptimize(r += findBucket(vtab[i]));
-    i = (i >= 9) ? 0 : i+1;
+    benchmark::DoNotOptimize(r += findBucket(data.next()));
   }
+  perf.report(state);
   dummydouble += r;
 }
-BENCHMARK(BM_LinearSearch);
+BENCHMARK(BM_LinearSearch)->ArgName("dist")->ArgsProduct({bench::distributions()});
 
 void BM_LinearSearch2(benchmark::State& state) {
-  double vtab[10];
-  double v = 1.0;
-  for (int i = 0; i < 10; ++i) {
-    vtab[i] = v;
-    v *= 10.0;
-  }
+  bench::Values<double> data(state, lowest, highest);
   uint32_t r = 0;
-  size_t i = 0;
+  bench::PerfCounters perf;
   while (state.KeepRunning()) {
-    benchmark::DoNotOptimize(r += findBucket2(vtab[i]));
-    i = (i >= 9) ? 0 : i+1;
+    benchmark::DoNotOptimize(r += findBucket2(data.next()));
   }
+  perf.report(state);
   dummydouble += r;
 }
-BENCHMARK(BM_LinearSearch2);
+BENCHMARK(BM_LinearSearch2)->ArgName("dist")->ArgsProduct({bench::distributions()});
 
 void BM_LogCast(benchmark::State& state) {
   uint64_t vtab[10];
@@ -383,10 +370,12 @@ void BM_LogCast(benchmark::State& state) {
   }
   uint32_t r = 0;
   size_t i = 0;
+  bench::PerfCounters perf;
   while (state.KeepRunning()) {
     r += log2rough((double) vtab[i]);
     i = (i >= 9) ? 0 : i+1;
   }
+  perf.report(state);
   dummydouble += r;
 }
 BENCHMARK(BM_LogCast);
@@ -394,11 +383,13 @@ BENCHMARK(BM_LogCast);
 void BM_clock_gettime (benchmark::State& state) {
   struct timespec start, end;
   clock_gettime(CLOCK_REALTIME, &start);
+  bench::PerfCounters perf;
   for (auto _ : state) {
     for (int i = 0; i < state.range(1); ++i) {
       benchmark::DoNotOptimize(clock_gettime(CLOCK_REALTIME, &end));
     }
   }
+  perf.report(state);
   dummy64 += end.tv_nsec - start.tv_nsec;
 }
 BENCHMARK(BM_clock_gettime)->Args({1<<2, 128})
@@ -408,10 +399,12 @@ template<typename T>
 void BM_clock(benchmark::State& state) {
   auto start = T::now();
   std::chrono::time_point<T> end;
+  bench::PerfCounters perf;
   while (state.KeepRunning()) {
     //benchmark::DoNotOptimize(x += std::chrono::duration(std::chrono::steady_clock::now() - start).count());
     benchmark::DoNotOptimize(end = T::now());
   }
+  perf.report(state);
   dummy64 += std::chrono::duration(end - start).count();
 }
 BENCHMARK_TEMPLATE(BM_clock, std::chrono::steady_clock);
@@ -430,10 +423,12 @@ template<typename T, typename S, typename R>
 void BM_clockdiff(benchmark::State& state) {
 
   S s;
+  bench::PerfCounters perf;
   while (state.KeepRunning()) {
     //benchmark::DoNotOptimize(x += std::chrono::duration(std::chrono::steady_clock::now() - start).count());
     benchmark::DoNotOptimize(s = tdiff<T,S,R>());
   }
+  perf.report(state);
   dummy64 += s;
 }
 BENCHMARK_TEMPLATE(BM_clockdiff, std::chrono::steady_clock, float, std::ratio<1,1>);
@@ -442,27 +437,32 @@ BENCHMARK_TEMPLATE(BM_clockdiff, std::chrono::steady_clock, uint64_t, std::nano)
 BENCHMARK_TEMPLATE(BM_clockdiff, std::chrono::steady_clock, long int, std::ratio<1,uint64_t(1e9)>);
 
 template <std::memory_order mo>
-void BM_atomic_omp(benchmark::State& state) {
-  std::atomic<uint64_t> a(0);
-  for (auto _ : state) {
-#pragma omp parallel for shared(a) num_threads(8)
-    for (int i = 0; i < 10000000; i++) {
-      benchmark::DoNotOptimize(a.fetch_add(i, mo));
-    }
-  }
+void BM_atomic_threads(benchmark::State& state) {
+  static std::atomic<uint64_t> a(0);
+  bench::Throughput t;
+  bench::PerfCounters perf;
+  for (auto _ : t.loop(state)) {
+    benchmark::DoNotOptimize(a.fetch_add(1, mo));
+  }
+  perf.report(state);
+  t.report(state);
   dummy64 += a;
 }
-BENCHMARK_TEMPLATE(BM_atomic_omp, std::memory_order_seq_cst);
-BENCHMARK_TEMPLATE(BM_atomic_omp, std::memory_order_relaxed);
+BENCHMARK_TEMPLATE(BM_atomic_threads, std::memory_order_seq_cst)
+  ->ThreadRange(1, bench::maxThreads())->UseRealTime();
+BENCHMARK_TEMPLATE(BM_atomic_threads, std::memory_order_relaxed)
+  ->ThreadRange(1, bench::maxThreads())->UseRealTime();
 
 template<std::memory_order mo>
 void BM_atomic(benchmark::State& state) {
   std::atomic<uint64_t> a(0);
+  bench::PerfCounters perf;
   for (auto _ : state) {
     for (int i = 0; i < 10000000; i++) {
       benchmark::DoNotOptimize(a.fetch_add(i, mo));
     }
   }
+  perf.report(state);
   dummy64 += a;
 }
 BENCHMARK_TEMPLATE(BM_atomic, std::memory_order_seq_cst);
@@ -491,22 +491,17 @@ static void countHisto(uint32_t v) {
 template<typename T>
 static void BM_NewHistogram(benchmark::State& state) {
   initHisto();
-  T vtab[10];
-  T v = 1;
-  for (int i = 0; i < 10; ++i) {
-    vtab[i] = v;
-    v *= 8;
-  }
-  size_t i = 0;
+  bench::Values<T> data(state, lowest, highest);
+  bench::PerfCounters perf;
   while (state.KeepRunning()) {
-    countHisto(vtab[i]);
-    i = (i >= 9) ? 0 : i+1;
+    countHisto(data.next());
   }
+  perf.report(state);
 }
-BENCHMARK_TEMPLATE(BM_NewHistogram, float);
-BENCHMARK_TEMPLATE(BM_NewHistogram, double);
-BENCHMARK_TEMPLATE(BM_NewHistogram, uint64_t);
-BENCHMARK_TEMPLATE(BM_NewHistogram, uint32_t);
+BENCHMARK_TEMPLATE(BM_NewHistogram, float)->ArgName("dist")->ArgsProduct({bench::distributions()});
+BENCHMARK_TEMPLATE(BM_NewHistogram, double)->ArgName("dist")->ArgsProduct({bench::distributions()});
+BENCHMARK_TEMPLATE(BM_NewHistogram, uint64_t)->ArgName("dist")->ArgsProduct({bench::distributions()});
+BENCHMARK_TEMPLATE(BM_NewHistogram, uint32_t)->ArgName("dist")->ArgsProduct({bench::distributions()});
 
 static void BM_OldFullHistogram(benchmark::State& state) {
   log_scale_t<double> scale(10, 1, pow(10, 9), 10);
@@ -514,21 +509,18 @@ static void BM_OldFullHistogram(benchmark::State& state) {
   for (size_t i = 0; i < 10; ++i) {
     counts[i] = 0;
   }
-  double vtab[10];
-  double v = 1;
-  for (int i = 0; i < 10; ++i) {
-    vtab[i] = v;
-    v *= 8;
-  }
-  size_t i = 0;
+  bench::Values<double> data(state, lowest, highest);
+  bench::PerfCounters perf;
   while (state.KeepRunning()) {
-    counts[scale.pos(vtab[i])].fetch_add(1, std::memory_order_relaxed);
-    i = (i >= 9) ? 0 : i+1;
+    counts[scale.pos(data.next())].fetch_add(1, std::memory_order_relaxed);
   }
+  perf.report(state);
   for (size_t i = 0; i < 10; ++i) {
     dummy64 += counts[i];
   }
 }
-BENCHMARK(BM_OldFullHistogram);
+BENCHMARK(BM_OldFullHistogram)->ArgName("dist")->ArgsProduct({bench::distributions()});
 
-BENCHMARK_MAIN();
+int main(int argc, char** argv) {
+  return bench::runBenchmarks(argc, argv);
+}
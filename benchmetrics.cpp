@@ -6,107 +6,516 @@
 #include <random>
 #include <omp.h>
 #include <chrono>
+#include <algorithm>
 #include <atomic>
+#include <memory>
+#include <thread>
+#include <pthread.h>
+#include <sched.h>
+
+#if defined __GLIBC__ && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+#include <malloc.h>
+#define BENCHMETRICS_MALLINFO2 1
+#endif
 
 #include <benchmark/benchmark.h>
 #include "Metrics.h"
+#include "MetricsArena.h"
+#include "MetricsExporter.h"
+#include "MetricsRecorder.h"
+#include "MetricsRetention.h"
+#include "MetricsServer.h"
+#include "distributions.h"
+#include "interference.h"
+#include "loadgen.h"
+#include "perfcounters.h"
+#include "scaling.h"
 
 uint64_t dummy;
 
+// Bucketing benchmarks draw from a pre-generated pool of values, see
+// distributions.h; range(0) is the distribution, range(1) the batch of
+// values counted per iteration.
+
 template<typename T>
 static void BM_std_log_histogram(benchmark::State& state) {
   auto h = Histogram(log_scale_t<T>(2.0, 0., 100000000., 10), "", "");
+  bench::Values<T> data(state, 0., 1000000000.);
+  bench::PerfCounters perf;
   for (auto _ : state) {
-    state.PauseTiming();
-    uint32_t y;
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::vector<T> data;
-
-    typename std::conditional<
-      std::is_integral<T>::value,
-      std::uniform_int_distribution<T>,
-      std::uniform_real_distribution<T>>::type dis(0.,1000000000.);
-
-    for (int i = 0; i < state.range(1); ++i) {
-      data.push_back(dis(gen));
-    }
-    auto s = data.begin();
-    state.ResumeTiming();
     for (int j = 0; j < state.range(1); ++j) {
-      h.count(*s++);
+      h.count(data.next());
     }
   }
+  perf.report(state);
   std::string hs;
   h.toPrometheus(hs);
   //std::cout << hs << std::endl;
 }
 BENCHMARK_TEMPLATE(BM_std_log_histogram, uint64_t)
-  ->Args({1, 128})->Args({1, 256})->Args({1, 512})->Args({1, 1024})->Args({1, 2048});
+  ->ArgNames({"dist", "batch"})->ArgsProduct({bench::distributions(), {128, 512, 2048}});
 BENCHMARK_TEMPLATE(BM_std_log_histogram, double)
-  ->Args({1, 128})->Args({1, 256})->Args({1, 512})->Args({1, 1024})->Args({1, 2048});
+  ->ArgNames({"dist", "batch"})->ArgsProduct({bench::distributions(), {128, 512, 2048}});
 BENCHMARK_TEMPLATE(BM_std_log_histogram, float)
-  ->Args({1, 128})->Args({1, 256})->Args({1, 512})->Args({1, 1024})->Args({1, 2048});
+  ->ArgNames({"dist", "batch"})->ArgsProduct({bench::distributions(), {128, 512, 2048}});
 
 template<typename T>
 static void BM_rough_histogram(benchmark::State& state) {
   auto h = Histogram(logr_scale_t<T>(2.0, 0., 100000000., 10), "", "");
+  bench::Values<T> data(state, 0., 1000000000.);
+  bench::PerfCounters perf;
   for (auto _ : state) {
-    state.PauseTiming();
-    uint32_t y;
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::vector<T> data;
-
-    typename std::conditional<
-      std::is_integral<T>::value,
-      std::uniform_int_distribution<T>,
-      std::uniform_real_distribution<T>>::type dis(0.,1000000000.);
-
-    for (int i = 0; i < state.range(1); ++i) {
-      data.push_back(dis(gen));
-    }
-    auto s = data.begin();
-    state.ResumeTiming();
     for (int j = 0; j < state.range(1); ++j) {
-      h.count(*s++);
+      h.count(data.next());
     }
   }
+  perf.report(state);
   std::string hs;
   h.toPrometheus(hs);
   //std::cout << hs << std::endl;
 }
 BENCHMARK_TEMPLATE(BM_rough_histogram, uint64_t)
-  ->Args({1, 128})->Args({1, 256})->Args({1, 512})->Args({1, 1024})->Args({1, 2048});
+  ->ArgNames({"dist", "batch"})->ArgsProduct({bench::distributions(), {128, 512, 2048}});
 BENCHMARK_TEMPLATE(BM_rough_histogram, double)
-  ->Args({1, 128})->Args({1, 256})->Args({1, 512})->Args({1, 1024})->Args({1, 2048});
+  ->ArgNames({"dist", "batch"})->ArgsProduct({bench::distributions(), {128, 512, 2048}});
 BENCHMARK_TEMPLATE(BM_rough_histogram, float)
-  ->Args({1, 128})->Args({1, 256})->Args({1, 512})->Args({1, 1024})->Args({1, 2048});
+  ->ArgNames({"dist", "batch"})->ArgsProduct({bench::distributions(), {128, 512, 2048}});
+
+// Linear bucketing alone, uniform values over the scale: pow2=1 is
+// [0, 2^20) in 1024 buckets (width 1024), pow2=0 is [0, 10^6) in 100.
+// lin_scale_t divides, int_lin_scale_t shifts or multiplies and clamps.
+
+template<typename Scale>
+static void BM_linear_scale(benchmark::State& state) {
+  using T = typename Scale::value_type;
+  bool const pow2 = state.range(0) != 0;
+  double const high = pow2 ? 1048576. : 1000000.;
+  Scale scale(T(0), static_cast<T>(high), pow2 ? 1024 : 100);
+  bench::Values<T> data(bench::Dist::Uniform, 0., high - 1.);
+  size_t sum = 0;
+  bench::PerfCounters perf;
+  for (auto _ : state) {
+    for (int j = 0; j < 512; ++j) {
+      sum += scale.pos(data.next());
+    }
+  }
+  perf.report(state);
+  benchmark::DoNotOptimize(sum);
+  state.SetItemsProcessed(state.iterations() * 512);
+}
+BENCHMARK_TEMPLATE(BM_linear_scale, lin_scale_t<uint32_t>)->ArgName("pow2")->Arg(0)->Arg(1);
+BENCHMARK_TEMPLATE(BM_linear_scale, int_lin_scale_t<uint32_t>)->ArgName("pow2")->Arg(0)->Arg(1);
+BENCHMARK_TEMPLATE(BM_linear_scale, lin_scale_t<uint64_t>)->ArgName("pow2")->Arg(0)->Arg(1);
+BENCHMARK_TEMPLATE(BM_linear_scale, int_lin_scale_t<uint64_t>)->ArgName("pow2")->Arg(0)->Arg(1);
+BENCHMARK_TEMPLATE(BM_linear_scale, lin_scale_t<double>)->ArgName("pow2")->Arg(0)->Arg(1);
+
+// make_scale() against the naive fixed_scale_t (a linear scan) over the
+// same boundaries. Configurations: 0 linear with width 1024 (64 buckets),
+// 1 linear with width 1000 (100), 2 powers of two up to 2^30, 3 powers of 8
+// up to 8^10, 4 eight Prometheus-like bounds, 5 forty irregular bounds. The
+// label names the kernel make_scale() picked.
 
 template<typename T>
-static void BM_gauge_add(benchmark::State& state) {
-  auto g = Gauge<T>(T(0.), "", "");
+static std::vector<T> scaleBounds(int config) {
+  std::vector<T> b;
+  switch (config) {
+    case 0: for (int i = 1; i <= 64; ++i) b.push_back(T(1024 * i)); break;
+    case 1: for (int i = 1; i <= 100; ++i) b.push_back(T(1000 * i)); break;
+    case 2: for (int i = 0; i <= 30; ++i) b.push_back(T(uint64_t(1) << i)); break;
+    case 3: for (int i = 0; i <= 10; ++i) b.push_back(T(uint64_t(1) << (3 * i))); break;
+    case 4: b = {T(5), T(10), T(25), T(50), T(100), T(250), T(500), T(1000)}; break;
+    default: {
+      std::mt19937_64 gen(7);
+      T x(0);
+      for (int i = 0; i < 40; ++i) {
+        x += T(1 + gen() % 2500);
+        b.push_back(x);
+      }
+    }
+  }
+  return b;
+}
+
+template<typename T, bool Auto>
+static void BM_scale_kernel(benchmark::State& state) {
+  int const config = static_cast<int>(state.range(0));
+  std::vector<T> const bounds = scaleBounds<T>(config);
+  auto scale = make_scale(bounds);
+  fixed_scale_t<T> naive(bounds.front(), bounds.back(), bounds);
+  bench::Values<T> data(config < 2 || config == 5 ? bench::Dist::Uniform : bench::Dist::LogNormal,
+                        0., 1.1 * static_cast<double>(bounds.back()));
+  size_t sum = 0;
+  bench::PerfCounters perf;
+  for (auto _ : state) {
+    for (int j = 0; j < 512; ++j) {
+      if constexpr (Auto) {
+        sum += scale.pos(data.next());
+      } else {
+        sum += naive.pos(data.next());
+      }
+    }
+  }
+  perf.report(state);
+  benchmark::DoNotOptimize(sum);
+  state.SetItemsProcessed(state.iterations() * 512);
+  state.SetLabel(Auto ? scale.kernelName() : "naive");
+}
+BENCHMARK_TEMPLATE(BM_scale_kernel, uint64_t, false)->ArgName("config")->DenseRange(0, 5);
+BENCHMARK_TEMPLATE(BM_scale_kernel, uint64_t, true)->ArgName("config")->DenseRange(0, 5);
+BENCHMARK_TEMPLATE(BM_scale_kernel, double, false)->ArgName("config")->DenseRange(0, 5);
+BENCHMARK_TEMPLATE(BM_scale_kernel, double, true)->ArgName("config")->DenseRange(0, 5);
+
+// Batch bucketing: level 0..2 forces baseline, avx2 and avx512 kernels,
+// 3 is what bucketKernels() picked, 4 calls the scalar pos() per value
+// inline. Build with -DBENCH_NATIVE=ON and compare level 3 here against
+// level 4 in benchmetrics_native to see what dispatch costs.
+template<typename T>
+static void BM_logr_batch(benchmark::State& state) {
+  int const level = static_cast<int>(state.range(0));
+  size_t const batch = static_cast<size_t>(state.range(1));
+  if (level <= 2 && static_cast<CpuLevel>(level) > cpuLevel()) {
+    state.SkipWithError("instruction set not supported");
+    return;
+  }
+  logr_scale_t<T> scale(2, 0, 1e8, 30);
+  bench::Values<T> data(bench::Dist::LogNormal, 0., 2e8);
+  std::vector<T> const& v = data.all();
+  std::vector<uint32_t> out(batch);
+  BucketKernels const& k = (level <= 2) ? bucketKernelsFor(static_cast<CpuLevel>(level))
+                                        : bucketKernels();
+  size_t off = 0;
+  bench::PerfCounters perf;
+  for (auto _ : state) {
+    T const* in = v.data() + off;
+    if (level == 4) {
+      for (size_t i = 0; i < batch; ++i) {
+        out[i] = static_cast<uint32_t>(scale.pos(in[i]));
+      }
+    } else if (level == 3) {
+      scale.pos(in, batch, out.data());
+    } else if constexpr (std::is_same_v<T, double>) {
+      k.logrDouble(scale.params(), in, batch, out.data());
+    } else {
+      k.logrFloat(scale.params(), in, batch, out.data());
+    }
+    benchmark::DoNotOptimize(out.data());
+    benchmark::ClobberMemory();
+    off = (off + batch) & (bench::Values<T>::size - 1);
+  }
+  perf.report(state);
+  state.SetItemsProcessed(state.iterations() * batch);
+  state.SetLabel(level == 4 ? "scalar" : cpuLevelName(level == 3 ? cpuLevel() : k.level));
+}
+BENCHMARK_TEMPLATE(BM_logr_batch, double)
+  ->ArgNames({"level", "batch"})->ArgsProduct({{0, 1, 2, 3, 4}, {256, 4096}});
+BENCHMARK_TEMPLATE(BM_logr_batch, float)
+  ->ArgNames({"level", "batch"})->ArgsProduct({{0, 1, 2, 3, 4}, {256, 4096}});
+
+// Histogram::countBatch against count() per value, single writer storage
+template<bool Batch>
+static void BM_histogram_batch(benchmark::State& state) {
+  Histogram<logr_scale_t<double>,
+            gcl::counter::simplex_array<uint64_t, gcl::counter::atomicity::semi>> h(
+    logr_scale_t<double>(2, 0, 1e8, 30), "batch", "");
+  bench::Values<double> data(bench::Dist::LogNormal, 0., 2e8);
+  std::vector<double> const& v = data.all();
+  size_t const batch = 1024;
+  size_t off = 0;
+  bench::PerfCounters perf;
+  for (auto _ : state) {
+    if constexpr (Batch) {
+      h.countBatch(v.data() + off, batch);
+    } else {
+      for (size_t i = 0; i < batch; ++i) {
+        h.count(v[off + i]);
+      }
+    }
+    off = (off + batch) & (bench::Values<double>::size - 1);
+  }
+  perf.report(state);
+  state.SetItemsProcessed(state.iterations() * batch);
+  dummy += h.load(0);
+}
+BENCHMARK_TEMPLATE(BM_histogram_batch, false);
+BENCHMARK_TEMPLATE(BM_histogram_batch, true);
+
+// Exemplars on the count path: mode 0 is count(t), 1 count(t, traceId)
+// with exemplars disabled, 2 with exemplars every hour (idle after the first
+// sample per bucket), 3 with exemplars on every count (always sampling).
+static void BM_histogram_exemplar(benchmark::State& state) {
+  int const mode = static_cast<int>(state.range(0));
+  Histogram<logr_scale_t<double>> h(logr_scale_t<double>(2, 0, 1e8, 30), "exemplar", "");
+  if (mode == 2) {
+    h.enableExemplars(std::chrono::hours(1));
+  } else if (mode == 3) {
+    h.enableExemplars(std::chrono::milliseconds(0));
+  }
+  bench::Values<double> data(bench::Dist::LogNormal, 0., 2e8);
+  std::string const traceId = "4bf92f3577b34da6a3ce929d0e0e4736";
+  bench::PerfCounters perf;
+  for (auto _ : state) {
+    if (mode == 0) {
+      h.count(data.next());
+    } else {
+      h.count(data.next(), traceId);
+    }
+  }
+  perf.report(state);
+  static char const* const labels[] = {"plain", "disabled", "idle", "sampling"};
+  state.SetLabel(labels[mode]);
+  std::string out;
+  h.toPrometheus(out);
+  dummy += out.size();
+}
+BENCHMARK(BM_histogram_exemplar)->ArgName("mode")->DenseRange(0, 3);
+
+// Offloaded recording: producer cost per sample, mode 0 counts inline
+// (pos() plus atomic add), 1 records into the thread's ring while an
+// aggregator drains it continuously from another CPU, 2 is the push path
+// alone (drained on this thread every 4096 samples with the timer paused),
+// 3 the drop path alone (the ring is full and never drained). Mode 1 pins
+// the benchmark and the aggregator to two different CPUs and is skipped
+// with only one; "dropped" is the fraction lost to a full ring and should
+// stay near 0, else mode 1 mostly times mode 3.
+
+/**
+ * @brief first two CPUs of the calling thread's affinity mask
+ */
+static std::vector<int> twoCpus() {
+  std::vector<int> cpus;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (pthread_getaffinity_np(pthread_self(), sizeof(set), &set) == 0) {
+    for (int c = 0; c < CPU_SETSIZE && cpus.size() < 2; ++c) {
+      if (CPU_ISSET(c, &set)) {
+        cpus.push_back(c);
+      }
+    }
+  }
+  return cpus;
+}
+
+static bool pinTo(pthread_t thread, int cpu) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return pthread_setaffinity_np(thread, sizeof(set), &set) == 0;
+}
+
+static void BM_recorder_record(benchmark::State& state) {
+  int const mode = static_cast<int>(state.range(0));
+  static char const* const labels[] = {"inline", "ring, aggregator", "push", "drop"};
+  state.SetLabel(labels[mode]);
+  Histogram<logr_scale_t<double>> h(logr_scale_t<double>(2, 0, 1e8, 30), "recorder", "");
+  MetricsRecorder<Histogram<logr_scale_t<double>>> r(h, 65536);
+  auto p = r.producer();
+  bench::Values<double> data(bench::Dist::LogNormal, 0., 2e8);
+  cpu_set_t old;
+  CPU_ZERO(&old);
+  pthread_getaffinity_np(pthread_self(), sizeof(old), &old);
+  std::atomic<bool> stop(false);
+  std::thread aggregator;
+  if (mode == 1) {
+    std::vector<int> const cpus = twoCpus();
+    if (cpus.size() < 2 || !pinTo(pthread_self(), cpus[0])) {
+      state.SkipWithError("needs two CPUs for producer and aggregator");
+      return;
+    }
+    aggregator = std::thread([&r, &stop] {
+      while (!stop.load(std::memory_order_relaxed)) {
+        r.drain();
+      }
+    });
+    pinTo(aggregator.native_handle(), cpus[1]);
+  } else if (mode == 3) {
+    while (p.record(data.next())) {
+    }
+  }
+  size_t i = 0;
+  bench::PerfCounters perf;
+  for (auto _ : state) {
+    if (mode == 0) {
+      h.count(data.next());
+    } else {
+      p.record(data.next());
+      if (mode == 2 && (++i & 4095) == 0) {
+        state.PauseTiming();
+        r.drain();
+        state.ResumeTiming();
+      }
+    }
+  }
+  perf.report(state);
+  if (aggregator.joinable()) {
+    stop.store(true, std::memory_order_relaxed);
+    aggregator.join();
+    pthread_setaffinity_np(pthread_self(), sizeof(old), &old);
+  }
+  state.counters["dropped"] = static_cast<double>(r.dropped()) /
+                              static_cast<double>(state.iterations());
+}
+BENCHMARK(BM_recorder_record)->ArgName("mode")->DenseRange(0, 3);
+
+// Aggregator throughput: drain() of range(0) queued samples from each of
+// range(1) rings into the histogram, with the default (atomic) storage and
+// with single writer storage.
+template<typename Storage>
+static void BM_recorder_drain(benchmark::State& state) {
+  size_t const batch = static_cast<size_t>(state.range(0));
+  size_t const rings = static_cast<size_t>(state.range(1));
+  Histogram<logr_scale_t<double>, Storage> h(logr_scale_t<double>(2, 0, 1e8, 30), "drain", "");
+  MetricsRecorder<decltype(h)> r(h, batch);
+  std::vector<decltype(r.producer())> producers;
+  for (size_t i = 0; i < rings; ++i) {
+    producers.push_back(r.producer());
+  }
+  bench::Values<double> data(bench::Dist::LogNormal, 0., 2e8);
+  size_t n = 0;
   for (auto _ : state) {
     state.PauseTiming();
-    uint32_t y;
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::vector<T> data;
+    for (auto& p : producers) {
+      for (size_t i = 0; i < batch; ++i) {
+        p.record(data.next());
+      }
+    }
+    state.ResumeTiming();
+    n += r.drain();
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(n));
+  dummy += h.load(0);
+}
+BENCHMARK_TEMPLATE(BM_recorder_drain, Metrics::hist_type)->ArgNames({"batch", "rings"})
+  ->ArgsProduct({{1024, 16384}, {1, 8}});
+BENCHMARK_TEMPLATE(BM_recorder_drain,
+                   gcl::counter::simplex_array<uint64_t, gcl::counter::atomicity::semi>)
+  ->ArgNames({"batch", "rings"})->ArgsProduct({{1024, 16384}, {1, 8}});
+
+// Retention: 10k series of one kind (0 counters, 1 gauges, 2 histogram
+// buckets, 3 a third of each), an hour of one second ticks recorded before
+// timing starts, so the timed ticks run in steady state with expiry.
+// Between ticks every metric changes as a busy process would: counters at
+// a per-series rate with jitter, gauges by a random walk (integral like
+// queue lengths or fractional like load, a third stay put), histograms by
+// a few samples each.
+struct RetentionLoad {
+  static constexpr size_t series = 10000;
+  static constexpr size_t buckets = 30;
 
-    typename std::conditional<
-      std::is_integral<T>::value,
-      std::uniform_int_distribution<T>,
-      std::uniform_real_distribution<T>>::type dis(0.,1.);
+  explicit RetentionLoad(int kind) : store(std::chrono::hours(1), std::chrono::seconds(1)),
+                                     rng(42), time(std::chrono::hours(24 * 365 * 50)) {
+    size_t const c = (kind == 0) ? series : (kind == 3) ? series / 3 : 0;
+    size_t const g = (kind == 1) ? series : (kind == 3) ? series / 3 : 0;
+    size_t const h = ((kind == 2) ? series : (kind == 3) ? series / 3 : 0) / buckets;
+    for (size_t i = 0; i < c; ++i) {
+      counters.push_back(std::make_unique<Counter>(0, "retention_counter",
+                                                   "", "i=\"" + std::to_string(i) + "\""));
+      rates.push_back(1 + rng() % 1000);
+      store.add(*counters.back());
+    }
+    for (size_t i = 0; i < g; ++i) {
+      gauges.push_back(std::make_unique<Gauge<double>>(
+        static_cast<double>(rng() % 10000), "retention_gauge", "", "i=\"" + std::to_string(i) + "\""));
+      store.add(*gauges.back());
+    }
+    for (size_t i = 0; i < h; ++i) {
+      histograms.push_back(std::make_unique<Histogram<logr_scale_t<double>>>(
+        logr_scale_t<double>(2, 0, 1e8, buckets), "retention_hist", "",
+        "i=\"" + std::to_string(i) + "\""));
+      store.add(*histograms.back());
+    }
+  }
 
-    for (int i = 0; i < state.range(1); ++i) {
-      data.push_back(dis(gen));
+  void update() {
+    for (size_t i = 0; i < counters.size(); ++i) {
+      *counters[i] += rates[i] + rng() % (rates[i] / 10 + 1);
+    }
+    for (size_t i = 0; i < gauges.size(); ++i) {
+      uint64_t r = rng();
+      if (r % 3 == 0) {
+        continue;
+      }
+      double step = static_cast<double>(static_cast<int64_t>(r % 21) - 10);
+      *gauges[i] = gauges[i]->load() + ((i & 1) ? step : step / 64.);
+    }
+    for (auto& h : histograms) {
+      for (int j = 0; j < 8; ++j) {
+        h->count(static_cast<double>(rng() % 100000000) / static_cast<double>(1 + rng() % 1000));
+      }
     }
-    auto s = data.begin();
+  }
+
+  void tick() {
+    time += std::chrono::milliseconds(1000 + rng() % 3);
+    store.tick(time);
+  }
+
+  MetricsRetention store;
+  std::mt19937_64 rng;
+  MetricsRetention::clock::time_point time;
+  std::vector<std::unique_ptr<Counter>> counters;
+  std::vector<uint64_t> rates;
+  std::vector<std::unique_ptr<Gauge<double>>> gauges;
+  std::vector<std::unique_ptr<Histogram<logr_scale_t<double>>>> histograms;
+};
+
+static void BM_retention_tick(benchmark::State& state) {
+  RetentionLoad load(static_cast<int>(state.range(0)));
+  for (int i = 0; i < 3600; ++i) {
+    load.update();
+    load.tick();
+  }
+  bench::PerfCounters perf;
+  for (auto _ : state) {
+    state.PauseTiming();
+    load.update();
     state.ResumeTiming();
+    load.tick();
+  }
+  perf.report(state);
+  size_t const samples = load.store.samples();
+  state.counters["series"] = static_cast<double>(load.store.series());
+  state.counters["B/sample"] = static_cast<double>(load.store.blockMemory()) / samples;
+  state.counters["B/sample total"] = static_cast<double>(load.store.memory()) / samples;
+  static char const* const labels[] = {"counters", "gauges", "buckets", "mixed"};
+  state.SetLabel(labels[state.range(0)]);
+}
+BENCHMARK(BM_retention_tick)->ArgName("kind")->DenseRange(0, 3)->Unit(benchmark::kMicrosecond);
+
+// Range query decode speed: the full hour of one series per iteration.
+static void BM_retention_query(benchmark::State& state) {
+  RetentionLoad load(3);
+  for (int i = 0; i < 3600; ++i) {
+    load.update();
+    load.tick();
+  }
+  // first counter, first gauge, a middle histogram bucket
+  MetricsRetention::SeriesId const id[] = {0, RetentionLoad::series / 3,
+                                           2 * (RetentionLoad::series / 3) + 10};
+  MetricsRetention::SeriesId const s = id[state.range(0)];
+  std::vector<MetricsRetention::Point> out;
+  size_t n = 0;
+  for (auto _ : state) {
+    out.clear();
+    load.store.query(s, INT64_MIN, INT64_MAX, out);
+    n += out.size();
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(n));
+  static char const* const labels[] = {"counter", "gauge", "bucket"};
+  state.SetLabel(labels[state.range(0)]);
+}
+BENCHMARK(BM_retention_query)->ArgName("kind")->DenseRange(0, 2);
+
+template<typename T>
+static void BM_gauge_add(benchmark::State& state) {
+  auto g = Gauge<T>(T(0.), "", "");
+  bench::Values<T> data(bench::Dist::Uniform, 0., 1.);
+  bench::PerfCounters perf;
+  for (auto _ : state) {
     for (int j = 0; j < state.range(1); ++j) {
-      g += *s++;
+      g += data.next();
     }
   }
+  perf.report(state);
   std::string hs;
   g.toPrometheus(hs);
 }
@@ -117,13 +526,1114 @@ BENCHMARK_TEMPLATE(BM_gauge_add, float)->Args({1, 128})->Args({1, 256})->Args({1
 
 static void BM_counter_inc(benchmark::State& state) {
   auto c = Counter(0, "", "");
+  bench::PerfCounters perf;
   for (auto _ : state) {
     c.count();
   }
+  perf.report(state);
   std::string hs;
   c.toPrometheus(hs);
 }
 BENCHMARK(BM_counter_inc)->Args({1, 128})->Args({1, 256})->Args({1, 512})->Args({1, 1024})->Args({1, 2048});
 
-BENCHMARK_MAIN();
+// Contention: every flavor is hammered by 1 .. hardware_concurrency threads.
+// Shared objects are function statics, one per template instantiation,
+// per-thread objects (buffers, brokers) live on the benchmarking thread.
+
+using namespace gcl::counter;
+
+static constexpr size_t contentionBuckets = 16;
+
+// atomicity::none and ::semi allow a single writer only, so every thread
+// counts on its own simplex; this is the lower bound the others compete with.
+template<atomicity A>
+static void BM_contention_simplex_local(benchmark::State& state) {
+  simplex<uint64_t, A> c;
+  bench::Throughput t;
+  bench::PerfCounters perf;
+  for (auto _ : t.loop(state)) {
+    ++c;
+    benchmark::DoNotOptimize(c);
+  }
+  perf.report(state);
+  t.report(state);
+  dummy += c.load();
+}
+BENCHMARK_TEMPLATE(BM_contention_simplex_local, atomicity::none)
+  ->ThreadRange(1, bench::maxThreads())->UseRealTime();
+BENCHMARK_TEMPLATE(BM_contention_simplex_local, atomicity::semi)
+  ->ThreadRange(1, bench::maxThreads())->UseRealTime();
+BENCHMARK_TEMPLATE(BM_contention_simplex_local, atomicity::full)
+  ->ThreadRange(1, bench::maxThreads())->UseRealTime();
+
+static void BM_contention_simplex(benchmark::State& state) {
+  static simplex<uint64_t, atomicity::full> c;
+  bench::Throughput t;
+  bench::PerfCounters perf;
+  for (auto _ : t.loop(state)) {
+    ++c;
+  }
+  perf.report(state);
+  t.report(state);
+  dummy += c.load();
+}
+BENCHMARK(BM_contention_simplex)->ThreadRange(1, bench::maxThreads())->UseRealTime();
+
+static void BM_contention_buffer(benchmark::State& state) {
+  static simplex<uint64_t, atomicity::full> c;
+  bench::Throughput t;
+  {
+    buffer<uint64_t, atomicity::full, atomicity::none> b(c);
+    bench::PerfCounters perf;
+    for (auto _ : t.loop(state)) {
+      ++b;
+      benchmark::DoNotOptimize(b);
+    }
+    perf.report(state);
+  }
+  t.report(state);
+  dummy += c.load();
+}
+BENCHMARK(BM_contention_buffer)->ThreadRange(1, bench::maxThreads())->UseRealTime();
+
+// Self-flushing buffers against the plain buffer above: range(0) is the
+// count threshold, range(1) the interval in microseconds at which a
+// background thread calls flush_registry::flush() (0: never).
+
+static bench::Reader& flusher() {
+  static bench::Reader r;
+  return r;
+}
+
+static void startFlusher(benchmark::State const& state) {
+  flusher().start(state.range(1), [] {
+    flush_registry::global().flush();
+    return uint64_t(0);
+  });
+}
+
+static void stopFlusher(benchmark::State const&) {
+  flusher().stop();
+}
+
+static void BM_contention_flush_buffer(benchmark::State& state) {
+  static simplex<uint64_t, atomicity::full> c;
+  bench::Throughput t;
+  {
+    flush_buffer<uint64_t, atomicity::full, atomicity::none> b(c, state.range(0));
+    bench::PerfCounters perf;
+    for (auto _ : t.loop(state)) {
+      ++b;
+      benchmark::DoNotOptimize(b);
+    }
+    perf.report(state);
+  }
+  t.report(state);
+  dummy += c.load();
+}
+BENCHMARK(BM_contention_flush_buffer)->ArgNames({"threshold", "flush_us"})
+  ->ArgsProduct({{64, 1024, 65536}, {0, 1000}})
+  ->ThreadRange(1, bench::maxThreads())->UseRealTime()
+  ->Setup(startFlusher)->Teardown(stopFlusher);
+
+template<typename Duplex, typename Broker>
+static void BM_contention_duplex(benchmark::State& state) {
+  static Duplex c;
+  bench::Throughput t;
+  {
+    Broker b(c);
+    bench::PerfCounters perf;
+    for (auto _ : t.loop(state)) {
+      ++b;
+    }
+    perf.report(state);
+  }
+  t.report(state);
+  dummy += c.load();
+}
+BENCHMARK_TEMPLATE(BM_contention_duplex, strong_duplex<uint64_t>, strong_broker<uint64_t>)
+  ->ThreadRange(1, bench::maxThreads())->UseRealTime();
+BENCHMARK_TEMPLATE(BM_contention_duplex, weak_duplex<uint64_t>, weak_broker<uint64_t>)
+  ->ThreadRange(1, bench::maxThreads())->UseRealTime();
+
+static void BM_contention_simplex_array(benchmark::State& state) {
+  static simplex_array<uint64_t, atomicity::full> c(contentionBuckets);
+  bench::Throughput t;
+  size_t i = state.thread_index();
+  bench::PerfCounters perf;
+  for (auto _ : t.loop(state)) {
+    ++c[i++ % contentionBuckets];
+  }
+  perf.report(state);
+  t.report(state);
+  dummy += c.load(0);
+}
+BENCHMARK(BM_contention_simplex_array)->ThreadRange(1, bench::maxThreads())->UseRealTime();
+
+static void BM_contention_buffer_array(benchmark::State& state) {
+  static simplex_array<uint64_t, atomicity::full> c(contentionBuckets);
+  bench::Throughput t;
+  size_t i = state.thread_index();
+  {
+    buffer_array<uint64_t, atomicity::full, atomicity::none> b(c);
+    bench::PerfCounters perf;
+    for (auto _ : t.loop(state)) {
+      ++b[i++ % contentionBuckets];
+      benchmark::DoNotOptimize(b);
+    }
+    perf.report(state);
+  }
+  t.report(state);
+  dummy += c.load(0);
+}
+BENCHMARK(BM_contention_buffer_array)->ThreadRange(1, bench::maxThreads())->UseRealTime();
+
+static void BM_contention_flush_buffer_array(benchmark::State& state) {
+  static simplex_array<uint64_t, atomicity::full> c(contentionBuckets);
+  bench::Throughput t;
+  size_t i = state.thread_index();
+  {
+    flush_buffer_array<uint64_t, atomicity::full, atomicity::none> b(c, state.range(0));
+    bench::PerfCounters perf;
+    for (auto _ : t.loop(state)) {
+      ++b[i++ % contentionBuckets];
+      benchmark::DoNotOptimize(b);
+    }
+    perf.report(state);
+  }
+  t.report(state);
+  dummy += c.load(0);
+}
+BENCHMARK(BM_contention_flush_buffer_array)->ArgNames({"threshold", "flush_us"})
+  ->ArgsProduct({{64, 1024, 65536}, {0, 1000}})
+  ->ThreadRange(1, bench::maxThreads())->UseRealTime()
+  ->Setup(startFlusher)->Teardown(stopFlusher);
+
+template<typename Duplex, typename Broker>
+static void BM_contention_duplex_array(benchmark::State& state) {
+  static Duplex c(contentionBuckets);
+  bench::Throughput t;
+  size_t i = state.thread_index();
+  {
+    Broker b(c);
+    bench::PerfCounters perf;
+    for (auto _ : t.loop(state)) {
+      ++b[i++ % contentionBuckets];
+    }
+    perf.report(state);
+  }
+  t.report(state);
+  dummy += c.load(0);
+}
+BENCHMARK_TEMPLATE(BM_contention_duplex_array,
+                   strong_duplex_array<uint64_t>, strong_broker_array<uint64_t>)
+  ->ThreadRange(1, bench::maxThreads())->UseRealTime();
+BENCHMARK_TEMPLATE(BM_contention_duplex_array,
+                   weak_duplex_array<uint64_t>, weak_broker_array<uint64_t>)
+  ->ThreadRange(1, bench::maxThreads())->UseRealTime();
+
+static void BM_contention_counter(benchmark::State& state) {
+  static Counter c(0, "contention", "");
+  bench::Throughput t;
+  bench::PerfCounters perf;
+  for (auto _ : t.loop(state)) {
+    c.count();
+  }
+  perf.report(state);
+  t.report(state);
+  dummy += c.load();
+}
+BENCHMARK(BM_contention_counter)->ThreadRange(1, bench::maxThreads())->UseRealTime();
+
+template<typename T>
+static void BM_contention_gauge(benchmark::State& state) {
+  static Gauge<T> g(T(0), "contention", "");
+  bench::Throughput t;
+  bench::PerfCounters perf;
+  for (auto _ : t.loop(state)) {
+    g += T(1);
+  }
+  perf.report(state);
+  t.report(state);
+  dummy += static_cast<uint64_t>(g.load());
+}
+BENCHMARK_TEMPLATE(BM_contention_gauge, uint64_t)
+  ->ThreadRange(1, bench::maxThreads())->UseRealTime();
+BENCHMARK_TEMPLATE(BM_contention_gauge, double)
+  ->ThreadRange(1, bench::maxThreads())->UseRealTime();
+
+static void BM_contention_histogram(benchmark::State& state) {
+  static Histogram<logr_scale_t<double>> h(
+    logr_scale_t<double>(2.0, 0., 65536., contentionBuckets), "contention", "");
+  double vals[contentionBuckets];
+  double v = 1.;
+  for (auto& i : vals) {
+    i = v;
+    v *= 2.;
+  }
+  bench::Throughput t;
+  size_t i = state.thread_index();
+  bench::PerfCounters perf;
+  for (auto _ : t.loop(state)) {
+    h.count(vals[i++ % contentionBuckets]);
+  }
+  perf.report(state);
+  t.report(state);
+  dummy += h.load(0);
+}
+BENCHMARK(BM_contention_histogram)->ThreadRange(1, bench::maxThreads())->UseRealTime();
+
+// Cardinality: inserts of keys from a set of range(1) distinct ones
+// (each thread walks the same set) and the register merge of two sketches,
+// plain byte max against atomic max into a live metric. "error" is the
+// relative estimate error at the end of the single threaded run.
+
+static void BM_cardinality_insert(benchmark::State& state) {
+  static std::unique_ptr<Cardinality> c;
+  if (state.thread_index() == 0) {
+    c = std::make_unique<Cardinality>(state.range(0), "distinct", "distinct keys");
+  }
+  uint64_t const distinct = state.range(1);
+  uint64_t key = 0;
+  bench::Throughput t;
+  bench::PerfCounters perf;
+  for (auto _ : t.loop(state)) {
+    c->insert(key);
+    key = (key + 1 == distinct) ? 0 : key + 1;
+  }
+  perf.report(state);
+  t.report(state);
+  if (state.thread_index() == 0 && state.threads() == 1) {
+    double truth = static_cast<double>(std::min<uint64_t>(distinct, state.iterations()));
+    state.counters["error"] = c->estimate() / truth - 1.;
+  }
+}
+BENCHMARK(BM_cardinality_insert)->ArgNames({"precision", "distinct"})
+  ->ArgsProduct({{10, 14}, {1000, 1000000}})
+  ->ThreadRange(1, bench::maxThreads())->UseRealTime();
+
+static void BM_cardinality_merge(benchmark::State& state) {
+  unsigned const p = state.range(0);
+  Cardinality a(p, "a", ""), b(p, "b", "");
+  for (uint64_t i = 0; i < 100000; ++i) {
+    a.insert(i);
+    b.insert(i + 50000);
+  }
+  std::vector<uint8_t> ra = a.registers();
+  std::vector<uint8_t> rb = b.registers();
+  bool const atomic = state.range(1) != 0;
+  bench::PerfCounters perf;
+  for (auto _ : state) {
+    if (atomic) {
+      a.merge(rb.data(), rb.size());
+    } else {
+      Cardinality::mergeRegisters(ra.data(), rb.data(), rb.size());
+    }
+    benchmark::DoNotOptimize(ra.data());
+  }
+  perf.report(state);
+  state.SetBytesProcessed(state.iterations() * ra.size());
+  state.counters["estimate"] = Cardinality::estimate(ra.data(), ra.size());
+}
+BENCHMARK(BM_cardinality_merge)->ArgNames({"precision", "atomic"})
+  ->ArgsProduct({{10, 14, 18}, {0, 1}});
+
+static void BM_cardinality_estimate(benchmark::State& state) {
+  Cardinality c(state.range(0), "c", "");
+  for (uint64_t i = 0; i < 100000; ++i) {
+    c.insert(i);
+  }
+  std::vector<uint8_t> r = c.registers();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(Cardinality::estimate(r.data(), r.size()));
+  }
+}
+BENCHMARK(BM_cardinality_estimate)->ArgNames({"precision"})->Arg(10)->Arg(14)->Arg(18);
+
+// TopK: every benchmark thread counts endpoint names drawn from a Zipf
+// distribution over 100000 ranks through its own TopK::Local; the scrape
+// benchmark merges the sketches of all threads into the top 20.
+
+static std::vector<std::string> const& zipfEndpoints() {
+  static std::vector<std::string> const keys = [] {
+    bench::Values<uint64_t> ranks(bench::Dist::Zipf, 10., 1e6);
+    std::vector<std::string> k;
+    k.reserve(ranks.all().size());
+    for (uint64_t r : ranks.all()) {
+      k.push_back("/_api/endpoint/" + std::to_string(r / 10));
+    }
+    return k;
+  }();
+  return keys;
+}
+
+static void BM_topk_insert(benchmark::State& state) {
+  static std::unique_ptr<TopK<>> top;
+  if (state.thread_index() == 0) {
+    top = std::make_unique<TopK<>>(20, state.range(0), "top_endpoints", "requests by endpoint",
+                                   "endpoint");
+  }
+  auto const& keys = zipfEndpoints();
+  size_t i = state.thread_index() * 7919;
+  bench::Throughput t;
+  {
+    TopK<>::Local local(*top);
+    bench::PerfCounters perf;
+    for (auto _ : t.loop(state)) {
+      local.insert(keys[i++ & (keys.size() - 1)]);
+    }
+    perf.report(state);
+  }
+  t.report(state);
+  if (state.thread_index() == 0) {
+    auto v = top->top();
+    state.counters["top_share"] = v.empty() ? 0. :
+      static_cast<double>(v.front().second) / static_cast<double>(state.iterations());
+  }
+}
+BENCHMARK(BM_topk_insert)->ArgNames({"capacity"})->Arg(100)->Arg(1000)
+  ->ThreadRange(1, bench::maxThreads())->UseRealTime();
+
+static void BM_topk_scrape(benchmark::State& state) {
+  TopK<> top(20, state.range(0), "top_endpoints", "requests by endpoint", "endpoint");
+  auto const& keys = zipfEndpoints();
+  std::vector<std::unique_ptr<TopK<>::Local>> locals;
+  for (int64_t l = 0; l < state.range(1); ++l) {
+    locals.emplace_back(std::make_unique<TopK<>::Local>(top));
+    for (size_t i = 0; i < keys.size(); ++i) {
+      locals.back()->insert(keys[(i + l * 7919) & (keys.size() - 1)]);
+    }
+  }
+  for (auto _ : state) {
+    std::string out;
+    top.toPrometheus(out);
+    benchmark::DoNotOptimize(out.data());
+  }
+}
+BENCHMARK(BM_topk_scrape)->ArgNames({"capacity", "locals"})
+  ->ArgsProduct({{100, 1000}, {1, 16}});
+
+// Meter: mark() under contention on one shared meter (compare with
+// BM_contention_counter), and one tick over range(0) meters, each with
+// pending marks, at an advancing clock so that every tick folds.
+
+static void BM_meter_mark(benchmark::State& state) {
+  static Meter m("requests", "request rate");
+  bench::Throughput t;
+  bench::PerfCounters perf;
+  for (auto _ : t.loop(state)) {
+    m.mark();
+  }
+  perf.report(state);
+  t.report(state);
+  dummy += m.count();
+}
+BENCHMARK(BM_meter_mark)->ThreadRange(1, bench::maxThreads())->UseRealTime();
+
+static void BM_meter_tick(benchmark::State& state) {
+  std::vector<std::unique_ptr<Meter>> meters;
+  for (int64_t i = 0; i < state.range(0); ++i) {
+    meters.emplace_back(std::make_unique<Meter>("m" + std::to_string(i), "meter"));
+  }
+  auto now = Meter::clock::now();
+  bench::PerfCounters perf;
+  for (auto _ : state) {
+    state.PauseTiming();
+    for (auto& m : meters) {
+      m->mark(3);
+    }
+    now += std::chrono::milliseconds(250);
+    state.ResumeTiming();
+    for (auto& m : meters) {
+      m->tick(now);
+    }
+  }
+  perf.report(state);
+  state.SetItemsProcessed(state.iterations() * meters.size());
+  dummy += static_cast<uint64_t>(meters.front()->rate1());
+}
+BENCHMARK(BM_meter_tick)->ArgNames({"meters"})->Arg(1000)->Arg(10000);
+
+// NUMA shards against their single-shard counterparts. Benchmark thread i
+// is pinned to the (i / nodes)-th CPU of node i % nodes, so any two threads
+// land on different nodes; the "nodes" counter shows the node count seen.
+// With a single node this is a plain pinned contention benchmark.
+
+class Pin {
+ public:
+  explicit Pin(int thread) {
+    auto const& topology = numa_topology::get();
+    auto const& cpus = topology.cpus(thread % topology.nodes());
+    CPU_ZERO(&_old);
+    _pinned = !cpus.empty() &&
+      pthread_getaffinity_np(pthread_self(), sizeof(_old), &_old) == 0;
+    if (_pinned) {
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      CPU_SET(cpus[(thread / topology.nodes()) % cpus.size()], &set);
+      _pinned = pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+    }
+  }
+  ~Pin() {
+    if (_pinned) {
+      pthread_setaffinity_np(pthread_self(), sizeof(_old), &_old);
+    }
+  }
+ private:
+  cpu_set_t _old;
+  bool _pinned;
+};
+
+template<typename Counter>
+static void BM_numa_counter(benchmark::State& state) {
+  static Counter c;
+  Pin pin(state.thread_index());
+  bench::Throughput t;
+  bench::PerfCounters perf;
+  for (auto _ : t.loop(state)) {
+    ++c;
+  }
+  perf.report(state);
+  t.report(state);
+  state.counters["nodes"] = numa_topology::get().nodes();
+  dummy += c.load();
+}
+BENCHMARK_TEMPLATE(BM_numa_counter, simplex<uint64_t, atomicity::full>)
+  ->ThreadRange(1, bench::maxThreads())->UseRealTime();
+BENCHMARK_TEMPLATE(BM_numa_counter, numa_simplex<uint64_t>)
+  ->ThreadRange(1, bench::maxThreads())->UseRealTime();
+
+template<typename Array>
+static void BM_numa_array(benchmark::State& state) {
+  static Array c(contentionBuckets);
+  Pin pin(state.thread_index());
+  size_t i = state.thread_index();
+  bench::Throughput t;
+  bench::PerfCounters perf;
+  for (auto _ : t.loop(state)) {
+    ++c[i++ % contentionBuckets];
+  }
+  perf.report(state);
+  t.report(state);
+  state.counters["nodes"] = numa_topology::get().nodes();
+  dummy += c.load(0);
+}
+BENCHMARK_TEMPLATE(BM_numa_array, simplex_array<uint64_t, atomicity::full>)
+  ->ThreadRange(1, bench::maxThreads())->UseRealTime();
+BENCHMARK_TEMPLATE(BM_numa_array, numa_simplex_array<uint64_t>)
+  ->ThreadRange(1, bench::maxThreads())->UseRealTime();
+
+// Scrape while counting: the benchmark threads are writers at full speed,
+// a background reader calls load/exchange/toPrometheus every interval_us.
+// interval_us:0 runs without reader and is the baseline for "degradation".
+
+template<typename Subject>
+struct Scrape {
+  static Subject& subject() {
+    static Subject s;
+    return s;
+  }
+  static bench::Reader& reader() {
+    static bench::Reader r;
+    return r;
+  }
+  static void setup(benchmark::State const& state) {
+    reader().start(state.range(0), [] { return subject().read(); });
+  }
+  static void teardown(benchmark::State const&) {
+    reader().stop();
+  }
+};
+
+struct SimplexLoad {
+  simplex<uint64_t, atomicity::full> c;
+  struct writer {
+    writer(SimplexLoad& s) : c(s.c) {}
+    void operator()() { ++c; }
+    simplex<uint64_t, atomicity::full>& c;
+  };
+  uint64_t read() { return c.load(); }
+};
+
+struct SimplexExchange : SimplexLoad {
+  using writer = SimplexLoad::writer;
+  uint64_t read() { return c.exchange(0); }
+};
+
+template<typename Duplex, typename Broker>
+struct DuplexLoad {
+  Duplex c;
+  struct writer {
+    writer(DuplexLoad& s) : b(s.c) {}
+    void operator()() { ++b; }
+    Broker b;
+  };
+  uint64_t read() { return c.load(); }
+};
+
+struct StrongDuplexExchange {
+  strong_duplex<uint64_t> c;
+  struct writer {
+    writer(StrongDuplexExchange& s) : b(s.c) {}
+    void operator()() { ++b; }
+    strong_broker<uint64_t> b;
+  };
+  uint64_t read() { return c.exchange(0); }
+};
+
+struct StrongDuplexArrayExchange {
+  StrongDuplexArrayExchange() : c(contentionBuckets) {}
+  strong_duplex_array<uint64_t> c;
+  struct writer {
+    writer(StrongDuplexArrayExchange& s) : b(s.c), i(0) {}
+    void operator()() { ++b[i++ % contentionBuckets]; }
+    strong_broker_array<uint64_t> b;
+    size_t i;
+  };
+  uint64_t read() {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < c.size(); ++i) {
+      sum += c.exchange(i, 0);
+    }
+    return sum;
+  }
+};
+
+struct CounterPrometheus {
+  CounterPrometheus() : c(0, "scrape", "scraped counter") {}
+  Counter c;
+  struct writer {
+    writer(CounterPrometheus& s) : c(s.c) {}
+    void operator()() { c.count(); }
+    Counter& c;
+  };
+  uint64_t read() {
+    std::string out;
+    c.toPrometheus(out);
+    return out.size();
+  }
+};
+
+struct HistogramPrometheus {
+  HistogramPrometheus()
+    : h(logr_scale_t<double>(2.0, 0., 65536., contentionBuckets), "scrape", "scraped histogram") {}
+  Histogram<logr_scale_t<double>> h;
+  struct writer {
+    writer(HistogramPrometheus& s) : h(s.h), v(1.) {}
+    void operator()() {
+      h.count(v);
+      v = (v > 65536.) ? 1. : v * 2.;
+    }
+    Histogram<logr_scale_t<double>>& h;
+    double v;
+  };
+  uint64_t read() {
+    std::string out;
+    h.toPrometheus(out);
+    return out.size();
+  }
+};
+
+// A registry of exportSeries counters scraped through MetricsExporter.
+// Synchronous: the scrape itself refreshes, i.e. serializes every series.
+// Background: an exporter thread refreshes every 100ms and the scrape only
+// pins the published buffer, read latency no longer grows with the series.
+
+constexpr size_t exportSeries = 5000;
+
+template<bool Background>
+struct ExportSubject {
+  ExportSubject() {
+    for (size_t i = 0; i < exportSeries; ++i) {
+      c.emplace_back(std::make_unique<Counter>(
+        0, "export_" + std::to_string(i), "exported counter"));
+      e.add(*c.back());
+    }
+    if (Background) {
+      e.start(std::chrono::milliseconds(100));
+    }
+  }
+  ~ExportSubject() { e.stop(); }
+  std::vector<std::unique_ptr<Counter>> c;
+  MetricsExporter e;
+  struct writer {
+    writer(ExportSubject& s) : c(s.c), i(0) {}
+    void operator()() { c[i++ % exportSeries]->count(); }
+    std::vector<std::unique_ptr<Counter>>& c;
+    size_t i;
+  };
+  uint64_t read() {
+    if (!Background) {
+      e.refresh();
+    }
+    return e.scrape().text().size();
+  }
+};
+
+template<typename Subject>
+static void BM_scrape(benchmark::State& state) {
+  typename Subject::writer w(Scrape<Subject>::subject());
+  bench::Throughput t;
+  bench::PerfCounters perf;
+  for (auto _ : t.loop(state)) {
+    w();
+  }
+  perf.report(state);
+  t.report(state);
+  if (state.thread_index() == 0) {
+    Scrape<Subject>::reader().report(state);
+  }
+}
+
+#define SCRAPE_BENCHMARK(...)                                            \
+  BENCHMARK_TEMPLATE(BM_scrape, __VA_ARGS__)                             \
+    ->ArgNames({"interval_us"})->Arg(0)->Arg(1000)->Arg(100)->Arg(10)    \
+    ->ThreadRange(1, bench::maxThreads())->UseRealTime()                 \
+    ->Setup(Scrape<__VA_ARGS__>::setup)->Teardown(Scrape<__VA_ARGS__>::teardown)
+
+SCRAPE_BENCHMARK(SimplexLoad);
+SCRAPE_BENCHMARK(SimplexExchange);
+SCRAPE_BENCHMARK(DuplexLoad<strong_duplex<uint64_t>, strong_broker<uint64_t>>);
+SCRAPE_BENCHMARK(StrongDuplexExchange);
+SCRAPE_BENCHMARK(DuplexLoad<weak_duplex<uint64_t>, weak_broker<uint64_t>>);
+SCRAPE_BENCHMARK(StrongDuplexArrayExchange);
+SCRAPE_BENCHMARK(CounterPrometheus);
+SCRAPE_BENCHMARK(HistogramPrometheus);
+SCRAPE_BENCHMARK(ExportSubject<false>);
+SCRAPE_BENCHMARK(ExportSubject<true>);
+
+// 100k series, 1000 metric names times 100 label sets, one histogram
+// (30 buckets) per 20 counters, rendered in scrape order. HeapLayout
+// allocates every metric on its own, in an order unrelated to the scrape
+// order as when metrics are created all over a server. ArenaLayout creates
+// them in scrape order into one MetricsArena, histogram buckets included.
+// bytes_per_series is the heap growth (plus arena) per series, including
+// the metadata strings. The heap is only measured with glibc, elsewhere
+// bytes_per_series counts the arena alone.
+
+static constexpr size_t seriesNames = 1000;
+static constexpr size_t seriesLabels = 100;
+
+struct HeapLayout {
+  static constexpr bool scrapeOrder = false;
+  using storage = Metrics::hist_type;
+  template<typename M, typename... Args>
+  M* make(Args&&... args) {
+    return new M(std::forward<Args>(args)...);
+  }
+  template<typename M>
+  void destroy(M* m) {
+    delete m;
+  }
+  size_t bytes() const { return 0; }
+};
+
+struct ArenaLayout {
+  static constexpr bool scrapeOrder = true;
+  using storage = ArenaBuckets;
+  ArenaLayout() : arena(size_t(64) << 20, true) {}
+  template<typename M, typename... Args>
+  M* make(Args&&... args) {
+    return arena.create<M>(std::forward<Args>(args)...);
+  }
+  template<typename M>
+  void destroy(M*) {}
+  size_t bytes() const { return arena.used(); }
+  MetricsArena arena;
+};
+
+static size_t heapInUse() {
+#if defined BENCHMETRICS_MALLINFO2
+  return mallinfo2().uordblks;
+#else
+  return 0;
+#endif
+}
+
+template<typename Layout>
+static void BM_series_scrape(benchmark::State& state) {
+  using Hist = Histogram<logr_scale_t<double>, typename Layout::storage>;
+  size_t const n = seriesNames * seriesLabels;
+  // creation order: a fixed shuffle of the scrape order
+  std::vector<size_t> order(n);
+  for (size_t i = 0; i < n; ++i) {
+    order[i] = i;
+  }
+  if (!Layout::scrapeOrder) {
+    std::shuffle(order.begin(), order.end(), std::mt19937_64(42));
+  }
+  std::vector<Metric*> series(n);
+  // the layout destroys its metrics and they release their interned
+  // strings, so every run starts from the same string table
+  size_t const before = heapInUse();
+  auto layout = std::make_unique<Layout>();
+  for (size_t i : order) {
+    size_t name = i / seriesLabels;
+    std::string const metric = "arangodb_subsystem_operation_" + std::to_string(name);
+    std::string const help = "Number of operations of kind " + std::to_string(name) +
+      " handled by this subsystem since server start";
+    std::string const labels = "shard=\"s" + std::to_string(i % seriesLabels) + "\",role=\"dbserver\"";
+    if (name % 20 == 0) {
+      series[i] = layout->template make<Hist>(
+        logr_scale_t<double>(2.0, 0., 65536., 30), metric, help, labels);
+    } else {
+      series[i] = layout->template make<Counter>(uint64_t(i), metric, help, labels);
+    }
+  }
+  size_t const bytes = heapInUse() - before + layout->bytes();
+  std::string out;
+  out.reserve(64 << 20);
+  for (auto _ : state) {
+    out.clear();
+    for (auto const* m : series) {
+      m->toPrometheus(out);
+    }
+    benchmark::DoNotOptimize(out.data());
+  }
+  state.counters["bytes_per_series"] = static_cast<double>(bytes) / static_cast<double>(n);
+  state.counters["series"] = static_cast<double>(n);
+  state.SetBytesProcessed(state.iterations() * out.size());
+  for (auto* m : series) {
+    layout->destroy(m);
+  }
+}
+BENCHMARK_TEMPLATE(BM_series_scrape, HeapLayout)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_series_scrape, ArenaLayout)->Unit(benchmark::kMillisecond);
+
+// The /metrics endpoint under load over loopback: every benchmark thread
+// keeps conns keep-alive connections with one request in flight each, so
+// the single server thread sees threads * conns concurrent scrapers. One
+// iteration is one round of conns scrapes; the exporter refreshes the 5000
+// counters of ExportSubject<true> every 100ms in the background.
+
+static MetricsServer& metricsServer() {
+  static MetricsServer server(Scrape<ExportSubject<true>>::subject().e);
+  static bool const started = server.start();
+  (void) started;
+  return server;
+}
+
+static void BM_metrics_server(benchmark::State& state) {
+  bool const gzip = state.range(0) != 0;
+  size_t const conns = static_cast<size_t>(state.range(1));
+  uint16_t const port = metricsServer().port();
+  std::vector<bench::HttpClient> clients(conns);
+  for (auto& c : clients) {
+    if (port == 0 || !c.connect(port)) {
+      // no return, every thread has to reach the start barrier in the loop
+      state.SkipWithError("cannot connect to the metrics server");
+      break;
+    }
+  }
+  size_t bytes = 0;
+  bench::Throughput t;
+  bench::PerfCounters perf;
+  for (auto _ : t.loop(state)) {
+    for (auto& c : clients) {
+      c.send("/metrics", gzip);
+    }
+    for (auto& c : clients) {
+      size_t n = c.receive();
+      if (n == 0) {
+        state.SkipWithError("scrape failed");
+        break;
+      }
+      bytes += n;
+    }
+  }
+  perf.report(state);
+  t.report(state);
+  state.SetItemsProcessed(state.iterations() * conns);
+  state.SetBytesProcessed(bytes);
+}
+BENCHMARK(BM_metrics_server)->ArgNames({"gzip", "conns"})
+  ->ArgsProduct({{0, 1}, {1, 16, 128}})
+  ->ThreadRange(1, bench::maxThreads())->UseRealTime();
+
+// Histogram storage policies, at 1 and hardware_concurrency threads. The
+// single writer policies (atomicity none and semi) only run single threaded.
+
+template<typename Storage>
+static Histogram<logr_scale_t<double>, Storage>& policyHistogram() {
+  static Histogram<logr_scale_t<double>, Storage> h(
+    logr_scale_t<double>(2.0, 0., 100000000., 30), "policy", "");
+  return h;
+}
+
+template<typename Storage>
+static void BM_histogram_storage(benchmark::State& state) {
+  auto& h = policyHistogram<Storage>();
+  bench::Values<double> data(bench::Dist::LogNormal, 0., 1e8, state.thread_index());
+  bench::Throughput t;
+  bench::PerfCounters perf;
+  for (auto _ : t.loop(state)) {
+    h.count(data.next());
+  }
+  perf.report(state);
+  t.report(state);
+  dummy += h.load(0);
+}
+BENCHMARK_TEMPLATE(BM_histogram_storage, simplex_array<uint64_t, atomicity::none>)
+  ->Threads(1)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_histogram_storage, simplex_array<uint64_t, atomicity::semi>)
+  ->Threads(1)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_histogram_storage, simplex_array<uint64_t, atomicity::full>)
+  ->Apply(bench::oneAndAllThreads);
+BENCHMARK_TEMPLATE(BM_histogram_storage, strong_duplex_array<uint64_t>)
+  ->Apply(bench::oneAndAllThreads);
+BENCHMARK_TEMPLATE(BM_histogram_storage, weak_duplex_array<uint64_t>)
+  ->Apply(bench::oneAndAllThreads);
+BENCHMARK_TEMPLATE(BM_histogram_storage, Metrics::numa_hist_type)
+  ->Apply(bench::oneAndAllThreads);
+
+// Loading all of 1M buckets (8MB) like a scrape does, per allocator of the
+// bucket array, in order and in a random order that lands on another 4k page
+// on almost every load. With huge pages the random sweep misses the TLB far
+// less (see dtlb_misses).
+
+static constexpr size_t sweepBuckets = size_t(1) << 20;
+
+template<typename Allocator>
+static void BM_bucket_sweep(benchmark::State& state) {
+  simplex_array<uint64_t, atomicity::full, Allocator> buckets(sweepBuckets);
+  std::vector<uint32_t> order(sweepBuckets);
+  for (size_t i = 0; i < sweepBuckets; ++i) {
+    order[i] = static_cast<uint32_t>(i);
+  }
+  if (state.range(0) != 0) {
+    std::shuffle(order.begin(), order.end(), std::mt19937_64(42));
+  }
+  for (size_t i = 0; i < sweepBuckets; ++i) {
+    buckets[i] += i;
+  }
+  uint64_t sum = 0;
+  bench::PerfCounters perf;
+  for (auto _ : state) {
+    for (uint32_t i : order) {
+      sum += buckets.load(i);
+    }
+  }
+  perf.report(state);
+  dummy += sum;
+  state.SetItemsProcessed(state.iterations() * sweepBuckets);
+  state.SetBytesProcessed(state.iterations() * sweepBuckets * sizeof(uint64_t));
+}
+BENCHMARK_TEMPLATE(BM_bucket_sweep, std::allocator<uint64_t>)
+  ->ArgName("random")->Arg(0)->Arg(1);
+BENCHMARK_TEMPLATE(BM_bucket_sweep, aligned_allocator<uint64_t>)
+  ->ArgName("random")->Arg(0)->Arg(1);
+BENCHMARK_TEMPLATE(BM_bucket_sweep, huge_page_allocator<uint64_t>)
+  ->ArgName("random")->Arg(0)->Arg(1);
+BENCHMARK_TEMPLATE(BM_bucket_sweep, huge_page_allocator<uint64_t, true>)
+  ->ArgName("random")->Arg(0)->Arg(1);
+
+template<typename Storage, typename Proxy>
+static void BM_histogram_proxy(benchmark::State& state) {
+  auto& h = policyHistogram<Storage>();
+  bench::Values<double> data(bench::Dist::LogNormal, 0., 1e8, state.thread_index());
+  bench::Throughput t;
+  {
+    Proxy p(h.storage());
+    bench::PerfCounters perf;
+    for (auto _ : t.loop(state)) {
+      h.count(p, data.next());
+    }
+    perf.report(state);
+  }
+  t.report(state);
+  dummy += h.load(0);
+}
+BENCHMARK_TEMPLATE(BM_histogram_proxy, simplex_array<uint64_t, atomicity::full>,
+                   buffer_array<uint64_t, atomicity::full, atomicity::none>)
+  ->Apply(bench::oneAndAllThreads);
+BENCHMARK_TEMPLATE(BM_histogram_proxy, strong_duplex_array<uint64_t>,
+                   strong_broker_array<uint64_t>)
+  ->Apply(bench::oneAndAllThreads);
+BENCHMARK_TEMPLATE(BM_histogram_proxy, weak_duplex_array<uint64_t>,
+                   weak_broker_array<uint64_t>)
+  ->Apply(bench::oneAndAllThreads);
+
+// Interval snapshots: thread 0 exchanges the whole histogram into a
+// snapshot and merges it into a cumulative total, all other threads keep
+// writing until it is done. range(0) is the number of buckets.
+
+template<typename Storage, typename Proxy>
+struct ExchangeFixture {
+  using histogram_type = Histogram<lin_scale_t<double>, Storage>;
+  static std::unique_ptr<histogram_type> h;
+  static std::atomic<bool> done;
+  static void setup(benchmark::State const& state) {
+    h = std::make_unique<histogram_type>(
+      lin_scale_t<double>(0., 1000000., state.range(0)), "interval", "");
+    done.store(false);
+  }
+  static void teardown(benchmark::State const&) {
+    h.reset();
+  }
+};
+template<typename Storage, typename Proxy>
+std::unique_ptr<typename ExchangeFixture<Storage, Proxy>::histogram_type>
+  ExchangeFixture<Storage, Proxy>::h;
+template<typename Storage, typename Proxy>
+std::atomic<bool> ExchangeFixture<Storage, Proxy>::done;
+
+template<typename Storage, typename Proxy>
+static void BM_histogram_exchange(benchmark::State& state) {
+  using fixture = ExchangeFixture<Storage, Proxy>;
+  auto& h = *fixture::h;
+  if (state.thread_index() == 0) {
+    HistogramSnapshot total;
+    auto start = std::chrono::steady_clock::now();
+    bench::PerfCounters perf;
+    for (auto _ : state) {
+      HistogramSnapshot interval(h.size());
+      h.exchange(interval);
+      total.merge(interval);
+    }
+    perf.report(state);
+    std::chrono::duration<double, std::nano> ns = std::chrono::steady_clock::now() - start;
+    fixture::done.store(true);
+    state.counters["snapshot_ns"] = ns.count() / state.iterations();
+    dummy += total.count();
+    return;
+  }
+  // values below high, lin_scale_t::pos does not clamp
+  bench::Values<double> data(bench::Dist::Uniform, 0., 999999., state.thread_index());
+  Proxy p(h.storage());
+  for (auto _ : state) {
+    h.count(p, data.next());
+  }
+  while (!fixture::done.load(std::memory_order_relaxed)) {
+    h.count(p, data.next());
+  }
+}
+
+// buffer-less writers counting straight into the storage
+template<typename Storage>
+struct Direct {
+  using value_type = typename Storage::value_type;
+  Direct(Storage& s) : s(s) {}
+  typename Storage::value_type& operator[](size_t i) { return s[i]; }
+  Storage& s;
+};
+
+#define EXCHANGE_BENCHMARK(...)                                          \
+  BENCHMARK_TEMPLATE(BM_histogram_exchange, __VA_ARGS__)                 \
+    ->ArgName("buckets")->Arg(10)->Arg(100)->Arg(1000)                   \
+    ->ThreadRange(1, bench::maxThreads())->UseRealTime()                 \
+    ->Setup(ExchangeFixture<__VA_ARGS__>::setup)                         \
+    ->Teardown(ExchangeFixture<__VA_ARGS__>::teardown)
+
+EXCHANGE_BENCHMARK(simplex_array<uint64_t, atomicity::full>,
+                   Direct<simplex_array<uint64_t, atomicity::full>>);
+EXCHANGE_BENCHMARK(strong_duplex_array<uint64_t>, strong_broker_array<uint64_t>);
+
+// Bucket counter layouts: range(0) histograms of 30 buckets each, counted
+// into at random. Direct counts atomically into the 64 bit buckets, the
+// others through a thread-local buffer of 64, 32 or 16 bit counters which
+// is the only memory touched while counting.
+
+static constexpr size_t layoutBuckets = 30;
+
+template<typename Local>
+static void BM_bucket_layout(benchmark::State& state) {
+  size_t const n = state.range(0);
+  std::vector<std::unique_ptr<simplex_array<uint64_t, atomicity::full>>> primes;
+  std::vector<std::unique_ptr<Local>> locals;
+  for (size_t i = 0; i < n; ++i) {
+    primes.emplace_back(
+      std::make_unique<simplex_array<uint64_t, atomicity::full>>(layoutBuckets));
+    locals.emplace_back(std::make_unique<Local>(*primes.back()));
+  }
+  logr_scale_t<double> scale(2.0, 0., 100000000., layoutBuckets);
+  bench::Values<double> values(bench::Dist::LogNormal, 0., 1e8);
+  // unclamped ranks, those beyond n are rejected rather than piled onto
+  // the last histogram
+  bench::Values<uint64_t> which(bench::Dist::Zipf, 10., 1e7);
+  std::vector<std::pair<uint32_t, uint32_t>> pool(values.size);
+  for (auto& p : pool) {
+    uint64_t rank;
+    while ((rank = which.next() / 10) > n) {
+    }
+    p = {static_cast<uint32_t>(rank - 1), static_cast<uint32_t>(scale.pos(values.next()))};
+  }
+  size_t i = 0;
+  bench::PerfCounters perf;
+  for (auto _ : state) {
+    auto const& p = pool[i++ & (values.size - 1)];
+    ++(*locals[p.first])[p.second];
+  }
+  perf.report(state);
+  locals.clear();
+  uint64_t total = 0;
+  for (auto const& p : primes) {
+    for (size_t b = 0; b < layoutBuckets; ++b) {
+      total += p->load(b);
+    }
+  }
+  if (total != static_cast<uint64_t>(state.iterations())) {
+    state.SkipWithError("counts lost");
+  }
+  size_t hot = sizeof(typename Local::value_type) * layoutBuckets;
+  state.counters["hot_bytes_per_histogram"] = hot;
+  state.counters["bytes_per_histogram"] =
+    (std::is_same_v<Local, Direct<simplex_array<uint64_t, atomicity::full>>> ? 0 : hot) +
+    sizeof(simplex_array<uint64_t, atomicity::full>::value_type) * layoutBuckets;
+}
+BENCHMARK_TEMPLATE(BM_bucket_layout, Direct<simplex_array<uint64_t, atomicity::full>>)
+  ->ArgName("histograms")->Arg(1000)->Arg(50000);
+BENCHMARK_TEMPLATE(BM_bucket_layout, buffer_array<uint64_t, atomicity::full, atomicity::none>)
+  ->ArgName("histograms")->Arg(1000)->Arg(50000);
+BENCHMARK_TEMPLATE(BM_bucket_layout, spill_array<uint32_t, uint64_t>)
+  ->ArgName("histograms")->Arg(1000)->Arg(50000);
+BENCHMARK_TEMPLATE(BM_bucket_layout, spill_array<uint16_t, uint64_t>)
+  ->ArgName("histograms")->Arg(1000)->Arg(50000);
+
+// Auto-ranging sparse histogram against a 64 bucket logr_scale_t one,
+// same distributions as the other bucketing benchmarks.
+
+template<typename T>
+static void BM_sparse_histogram(benchmark::State& state) {
+  SparseHistogram<T> h("sparse", "");
+  bench::Values<T> data(state, 0., 1000000000.);
+  bench::PerfCounters perf;
+  for (auto _ : state) {
+    for (int j = 0; j < state.range(1); ++j) {
+      h.count(data.next());
+    }
+  }
+  perf.report(state);
+  state.counters["bytes"] = h.memory();
+  state.counters["items"] = benchmark::Counter(
+    state.iterations() * state.range(1), benchmark::Counter::kIsRate);
+}
+BENCHMARK_TEMPLATE(BM_sparse_histogram, uint64_t)
+  ->ArgNames({"dist", "batch"})->ArgsProduct({bench::distributions(), {1024}});
+BENCHMARK_TEMPLATE(BM_sparse_histogram, double)
+  ->ArgNames({"dist", "batch"})->ArgsProduct({bench::distributions(), {1024}});
+
+template<typename T>
+static void BM_logr64_histogram(benchmark::State& state) {
+  auto h = Histogram(logr_scale_t<T>(2.0, 0., 1000000000., 64), "logr64", "");
+  bench::Values<T> data(state, 0., 1000000000.);
+  bench::PerfCounters perf;
+  for (auto _ : state) {
+    for (int j = 0; j < state.range(1); ++j) {
+      h.count(data.next());
+    }
+  }
+  perf.report(state);
+  state.counters["bytes"] = sizeof(h) + h.size() * sizeof(uint64_t) +
+    h.scale().delims().size() * sizeof(T);
+  state.counters["items"] = benchmark::Counter(
+    state.iterations() * state.range(1), benchmark::Counter::kIsRate);
+}
+BENCHMARK_TEMPLATE(BM_logr64_histogram, uint64_t)
+  ->ArgNames({"dist", "batch"})->ArgsProduct({bench::distributions(), {1024}});
+BENCHMARK_TEMPLATE(BM_logr64_histogram, double)
+  ->ArgNames({"dist", "batch"})->ArgsProduct({bench::distributions(), {1024}});
+
+int main(int argc, char** argv) {
+  return bench::runBenchmarks(argc, argv);
+}
 
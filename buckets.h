@@ -0,0 +1,36 @@
+#ifndef BENCHLOG_BUCKETS_H
+#define BENCHLOG_BUCKETS_H 1
+
+#include <cstddef>
+
+// Fixed decimal bucket bounds 1 to 1e8 and two searches over them, the
+// plain loop and the branch free chain. Benchmarked in benchlog.cpp,
+// verified in correct.cpp.
+
+static double table[9] = {1.0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8 };
+
+static inline size_t findBucket(double d) {
+  for (size_t i = 0; i < 9; ++i) {
+    if (d <= table[i]) {
+      return i;
+    }
+  }
+  return 9;
+}
+
+static inline size_t findBucket2(double d) {
+  // from the top, so that the smallest matching bound wins
+  size_t r = 9;
+  r = (d <= table[8]) ? 8 : r;
+  r = (d <= table[7]) ? 7 : r;
+  r = (d <= table[6]) ? 6 : r;
+  r = (d <= table[5]) ? 5 : r;
+  r = (d <= table[4]) ? 4 : r;
+  r = (d <= table[3]) ? 3 : r;
+  r = (d <= table[2]) ? 2 : r;
+  r = (d <= table[1]) ? 1 : r;
+  r = (d <= table[0]) ? 0 : r;
+  return r;
+}
+
+#endif
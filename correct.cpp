@@ -1,32 +1,577 @@
-#include <iostream>
+// Differential verification of the fast bucketing kernels.
+//
+// Every kernel is run against an exact reference: long double (or 128 bit
+// integer) arithmetic of what the kernel is meant to compute. For scales
+// that is the number of delimiters below the value, the bucket its le label
+// promises. The inputs
+// are all 2^32 float bit patterns (widened for double kernels), all 2^32
+// uint32 values for 32 bit integer kernels, and the 64 values on either
+// side of every boundary. Inputs a kernel is not defined for (NaN, or
+// non-normal values for log2rough) are skipped and counted. The batch
+// kernels of every instruction set level the CPU has must agree with the
+// scalar functions on all floats. Mismatches are counted per kernel with
+// the first few printed; the exit code is 1 if there are any.
+//
+// The same harness runs accounting checks of the metrics built on top:
+// SparseHistogram must print le labels that parse back to its bounds,
+// MetricsRecorder must count or drop every sample, MetricsRetention must
+// decode what it sampled.
+//
+// usage: correct [filter [threads [stride]]]
+//   filter   only kernels whose name contains it
+//   threads  default hardware_concurrency
+//   stride   check every stride-th input of the 2^32 spaces, default 1
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cmath>
 #include <cstdint>
-#include <string.h>
-#include <time.h>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Metrics.h"
+#include "MetricsRecorder.h"
+#include "MetricsRetention.h"
+#include "buckets.h"
+
+namespace {
+
+constexpr size_t skip = SIZE_MAX;
+constexpr size_t examples = 5;
+constexpr uint64_t chunk = uint64_t(1) << 20;
+
+std::string filter;
+unsigned threads = 1;
+uint64_t stride = 1;
+bool failed = false;
+
+struct Tally {
+  uint64_t checked = 0;
+  uint64_t skipped = 0;
+  uint64_t mismatches = 0;
+  std::vector<std::string> first;
+};
+
+template<typename T>
+std::string show(T v) {
+  std::ostringstream o;
+  if constexpr (std::is_floating_point<T>::value) {
+    o.precision(std::numeric_limits<T>::max_digits10);
+  }
+  o << +v;
+  return o.str();
+}
+
+/**
+ * @brief run body(begin, end, tally) over [0, count) in chunks on all
+ * threads and report the summed tally
+ */
+template<typename Body>
+void run(std::string const& name, uint64_t count, Body body) {
+  if (name.find(filter) == std::string::npos) {
+    return;
+  }
+  auto const start = std::chrono::steady_clock::now();
+  std::atomic<uint64_t> next(0);
+  std::mutex mutex;
+  Tally total;
+  auto work = [&] {
+    Tally t;
+    uint64_t begin;
+    while ((begin = next.fetch_add(chunk)) < count) {
+      body(begin, std::min(count, begin + chunk), t);
+    }
+    std::lock_guard<std::mutex> guard(mutex);
+    total.checked += t.checked;
+    total.skipped += t.skipped;
+    total.mismatches += t.mismatches;
+    for (auto& s : t.first) {
+      if (total.first.size() < examples) {
+        total.first.push_back(std::move(s));
+      }
+    }
+  };
+  std::vector<std::thread> pool;
+  for (unsigned i = 1; i < threads; ++i) {
+    pool.emplace_back(work);
+  }
+  work();
+  for (auto& t : pool) {
+    t.join();
+  }
+  double const s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  std::cout << (total.mismatches == 0 ? "ok   " : "FAIL ") << name << ": "
+            << total.checked << " checked, " << total.skipped << " skipped, "
+            << total.mismatches << " mismatches, " << s << " s" << std::endl;
+  for (auto const& e : total.first) {
+    std::cout << "       " << e << std::endl;
+  }
+  failed = failed || total.mismatches != 0;
+}
+
+template<typename T>
+void mismatch(Tally& t, T v, size_t f, size_t e) {
+  if (++t.mismatches <= examples) {
+    t.first.push_back(show(v) + ": fast " + std::to_string(f) +
+                      ", exact " + std::to_string(e));
+  }
+}
+
+/**
+ * @brief compare fast(input(i)) with exact(input(i)) for i < count
+ *
+ * exact returns skip for inputs outside the kernel's domain.
+ */
+template<typename Input, typename Fast, typename Exact>
+void check(std::string const& name, uint64_t count, uint64_t step,
+           Input input, Fast fast, Exact exact) {
+  run(name, count, [&](uint64_t begin, uint64_t end, Tally& t) {
+    // stay on the global grid of step
+    for (uint64_t i = (begin + step - 1) / step * step; i < end; i += step) {
+      auto const v = input(i);
+      size_t const e = exact(v);
+      if (e == skip) {
+        ++t.skipped;
+        continue;
+      }
+      ++t.checked;
+      size_t const f = fast(v);
+      if (f != e) {
+        mismatch(t, v, f, e);
+      }
+    }
+  });
+}
+
+uint64_t const space = uint64_t(1) << 32;
+
+float floatOf(uint64_t i) {
+  uint32_t bits = static_cast<uint32_t>(i);
+  float f;
+  memcpy(&f, &bits, 4);
+  return f;
+}
+
+/**
+ * @brief check over all floats, widened to T
+ */
+template<typename T, typename Fast, typename Exact>
+void allFloats(std::string const& name, Fast fast, Exact exact) {
+  check(name + " all floats", space, stride,
+        [](uint64_t i) { return static_cast<T>(floatOf(i)); }, fast, exact);
+}
+
+/**
+ * @brief check the 64 values on either side of every boundary
+ */
+template<typename T, typename Fast, typename Exact>
+void nearBounds(std::string const& name, std::vector<T> const& bounds, Fast fast, Exact exact) {
+  std::vector<T> values;
+  for (T b : bounds) {
+    T lo = b, hi = b;
+    values.push_back(b);
+    for (int i = 0; i < 64; ++i) {
+      if constexpr (std::is_integral<T>::value) {
+        lo = (lo == std::numeric_limits<T>::lowest()) ? lo : T(lo - 1);
+        hi = (hi == std::numeric_limits<T>::max()) ? hi : T(hi + 1);
+      } else {
+        lo = std::nextafter(lo, -std::numeric_limits<T>::infinity());
+        hi = std::nextafter(hi, std::numeric_limits<T>::infinity());
+      }
+      values.push_back(lo);
+      values.push_back(hi);
+    }
+  }
+  check(name + " near bounds", values.size(), 1,
+        [&values](uint64_t i) { return values[i]; }, fast, exact);
+}
 
-static inline uint32_t log2rough(double x) {
-  uint64_t y;
-  memcpy(&y, &x, 8);
-  std::cout << "1: " << y << std::endl;
-  std::cout << "2: " << (y >> 52) << std::endl;
-  std::cout << "3: " << (uint32_t)(y >> 52) << std::endl;
-  std::cout << "4: " << ((uint32_t)(y >> 52) & 0x7ff) << std::endl;
-  std::cout << "5: " << ((uint32_t)(y >> 52) & 0x7ff - 1023) << std::endl;
-  std::cout << "6: " << (((uint32_t)(y >> 52) & 0x7ff) - 1023) << std::endl;
-  return ((uint32_t)(y >> 52) & 0x7ff) - 1023;
+/**
+ * @brief floor(log2(y)) for finite y > 0, exactly
+ */
+int floorLog2(long double y) {
+  int e;
+  frexpl(y, &e);
+  return e - 1;
 }
 
+/**
+ * @brief number of bounds below v, compared in long double
+ */
+template<typename T>
+size_t countBelow(std::vector<T> const& bounds, T v) {
+  if constexpr (std::is_floating_point<T>::value) {
+    if (std::isnan(v)) {
+      return skip;
+    }
+  }
+  auto below = std::partition_point(bounds.begin(), bounds.end(), [v](T b) {
+    return static_cast<long double>(b) < static_cast<long double>(v);
+  });
+  return static_cast<size_t>(below - bounds.begin());
+}
+
+template<typename T>
+void log2roughChecks(std::string const& name) {
+  allFloats<T>(name,
+    [](T v) { return static_cast<size_t>(log2rough(v) + 2048); },
+    [](T v) {
+      return (std::isnormal(v) && v > 0) ? static_cast<size_t>(floorLog2(v) + 2048) : skip;
+    });
+}
+
+/**
+ * @brief a floating point scale: number of its delimiters below v
+ */
+template<typename Scale>
+void scaleChecks(std::string const& name, Scale const& s) {
+  using T = typename Scale::value_type;
+  std::vector<T> const bounds = s.delims();
+  auto fast = [&s](T v) { return s.pos(v); };
+  auto exact = [&bounds](T v) { return countBelow(bounds, v); };
+  allFloats<T>(name, fast, exact);
+  nearBounds<T>(name, bounds, fast, exact);
+}
+
+template<typename T>
+void logrChecks(std::string const& name, T base, T low, T high, size_t n) {
+  scaleChecks(name, logr_scale_t<T>(base, low, high, n));
+}
+
+/**
+ * @brief the batch kernels of every level this CPU has against the scalar
+ * log2rough and logr_scale_t::pos, in blocks so the vector loops run
+ */
+template<typename T>
+void batchChecks(std::string const& name, T base, T low, T high, size_t n) {
+  logr_scale_t<T> s(base, low, high, n);
+  for (int l = 0; l <= static_cast<int>(cpuLevel()); ++l) {
+    BucketKernels const& k = bucketKernelsFor(static_cast<CpuLevel>(l));
+    run(name + " batch " + cpuLevelName(k.level) + " all floats", space,
+        [&](uint64_t begin, uint64_t end, Tally& t) {
+      std::vector<T> in;
+      for (uint64_t i = (begin + stride - 1) / stride * stride; i < end; i += stride) {
+        in.push_back(static_cast<T>(floatOf(i)));
+      }
+      std::vector<int32_t> rough(in.size());
+      std::vector<uint32_t> pos(in.size());
+      if constexpr (std::is_same<T, double>::value) {
+        k.log2roughDouble(in.data(), in.size(), rough.data());
+        k.logrDouble(s.params(), in.data(), in.size(), pos.data());
+      } else {
+        k.log2roughFloat(in.data(), in.size(), rough.data());
+        k.logrFloat(s.params(), in.data(), in.size(), pos.data());
+      }
+      for (size_t j = 0; j < in.size(); ++j) {
+        ++t.checked;
+        int32_t const r = log2rough(in[j]);
+        if (rough[j] != r) {
+          mismatch(t, in[j], static_cast<size_t>(rough[j] + 2048), static_cast<size_t>(r + 2048));
+        }
+        size_t const p = s.pos(in[j]);
+        if (pos[j] != p) {
+          mismatch(t, in[j], pos[j], p);
+        }
+      }
+    });
+  }
+}
+
+/**
+ * @brief int_lin_scale_t: floor((v - low) * n / (high - low)), clamped
+ */
+template<typename T>
+void intLinChecks(std::string const& name, T low, T high, size_t n) {
+  int_lin_scale_t<T> s(low, high, n);
+  using u128 = unsigned __int128;
+  auto fast = [&s](T v) { return s.pos(v); };
+  auto exact = [=](T v) {
+    if (v < low) {
+      return size_t(0);
+    }
+    if (v >= high) {
+      return n - 1;
+    }
+    u128 x = static_cast<uint64_t>(v) - static_cast<uint64_t>(low);
+    return static_cast<size_t>(x * n / (static_cast<uint64_t>(high) - static_cast<uint64_t>(low)));
+  };
+  if (sizeof(T) <= 4) {
+    check(name + " all uint32", space, stride,
+          [](uint64_t i) { return static_cast<T>(i); }, fast, exact);
+  }
+  nearBounds<T>(name, s.delims(), fast, exact);
+}
+
+/**
+ * @brief auto_scale_t: number of bounds below v
+ */
+template<typename T>
+void autoChecks(std::string const& name, std::vector<T> const& bounds) {
+  auto s = make_scale(bounds);
+  std::string const label = name + " (" + s.kernelName() + ")";
+  auto fast = [&s](T v) { return s.pos(v); };
+  auto exact = [&bounds](T v) { return countBelow(bounds, v); };
+  if constexpr (std::is_floating_point<T>::value) {
+    allFloats<T>(label, fast, exact);
+  } else if (sizeof(T) <= 4) {
+    check(label + " all uint32", space, stride,
+          [](uint64_t i) { return static_cast<T>(i); }, fast, exact);
+  }
+  nearBounds<T>(label, bounds, fast, exact);
+}
+
+template<typename T>
+std::vector<T> irregular(T start, unsigned gap) {
+  std::mt19937_64 gen(7);
+  std::vector<T> b;
+  T x = start;
+  for (int i = 0; i < 40; ++i) {
+    x += static_cast<T>(1 + gen() % gap);
+    b.push_back(x);
+  }
+  return b;
+}
+
+template<typename T>
+void autoSuite(std::string const& type) {
+  std::vector<T> linear, powers, powers8, prom;
+  for (int i = 1; i <= 100; ++i) {
+    linear.push_back(std::is_integral<T>::value ? T(1000 * i + 7) : T(0.1 * i));
+  }
+  for (int i = 0; i < 31; ++i) {
+    powers.push_back(std::is_integral<T>::value ? T(uint64_t(1) << i) : T(std::ldexp(1., i - 10)));
+  }
+  for (int i = 0; i < 10; ++i) {
+    powers8.push_back(T(3 * (uint64_t(1) << (3 * i))));
+  }
+  if constexpr (std::is_integral<T>::value) {
+    prom = {5, 10, 25, 50, 100, 250, 500, 1000};
+  } else {
+    prom = {.005, .01, .025, .05, .1, .25, .5, 1, 2.5, 5, 10};
+  }
+  autoChecks<T>("auto_scale_t<" + type + "> linear", linear);
+  autoChecks<T>("auto_scale_t<" + type + "> powers of 2", powers);
+  autoChecks<T>("auto_scale_t<" + type + "> 3 * powers of 8", powers8);
+  autoChecks<T>("auto_scale_t<" + type + "> prometheus", prom);
+  autoChecks<T>("auto_scale_t<" + type + "> irregular", irregular<T>(T(1), 2500));
+}
+
+/**
+ * @brief one checked fact of the accounting checks below
+ */
+void expect(Tally& t, std::string const& what, double got, double want) {
+  ++t.checked;
+  bool const same = (got == want) || (std::isnan(got) && std::isnan(want));
+  if (!same && ++t.mismatches <= examples) {
+    t.first.push_back(what + ": got " + show(got) + ", expected " + show(want));
+  }
+}
+
+/**
+ * @brief SparseHistogram: every le label parses back to its bucket's upper
+ * bound, and the bound itself is counted in that bucket
+ */
+template<unsigned Precision>
+void sparseChecks(std::string const& name, size_t step) {
+  run(name, 1, [step](uint64_t, uint64_t, Tally& t) {
+    using Sparse = SparseHistogram<double, Precision>;
+    Sparse h("correct_sparse", "");
+    std::vector<double> bounds;
+    for (size_t idx = 0; std::isfinite(Sparse::upper(idx)); idx += step) {
+      h.count(Sparse::upper(idx));
+      bounds.push_back(Sparse::upper(idx));
+    }
+    std::string out;
+    h.toPrometheus(out);
+    std::vector<double> printed;
+    std::string const key = "le=\"";
+    for (size_t pos = out.find(key); pos != std::string::npos; pos = out.find(key, pos)) {
+      pos += key.size();
+      printed.push_back(std::strtod(out.c_str() + pos, nullptr));
+    }
+    expect(t, "buckets", static_cast<double>(printed.size()),
+           static_cast<double>(bounds.size()));
+    for (size_t i = 0; i < std::min(printed.size(), bounds.size()); ++i) {
+      expect(t, "le of bucket " + std::to_string(i), printed[i], bounds[i]);
+    }
+  });
+}
+
+/**
+ * @brief MetricsRecorder: every sample is either counted or dropped
+ *
+ * Four producers record into small rings while the aggregator drains every
+ * millisecond, so both paths are hit. The producers exit before the final
+ * drain, which exercises the retired rings' drop counts as well.
+ */
+void recorderChecks(std::string const& name) {
+  run(name, 1, [](uint64_t, uint64_t, Tally& t) {
+    constexpr int producers = 4;
+    constexpr uint64_t samples = 1000000;
+    Histogram<logr_scale_t<double>> h(logr_scale_t<double>(2, 0, 1024, 8), "correct_recorder", "");
+    MetricsRecorder<decltype(h)> r(h, 256);
+    std::atomic<uint64_t> recorded(0);
+    r.start(std::chrono::milliseconds(1));
+    std::vector<std::thread> pool;
+    for (int k = 0; k < producers; ++k) {
+      pool.emplace_back([&r, &recorded] {
+        auto p = r.producer();
+        uint64_t n = 0;
+        for (uint64_t i = 0; i < samples; ++i) {
+          n += p.record(1.0 + i % 1000) ? 1 : 0;
+        }
+        recorded.fetch_add(n);
+      });
+    }
+    for (auto& p : pool) {
+      p.join();
+    }
+    r.stop();
+    r.drain();
+    uint64_t counted = 0;
+    for (auto v : h.load()) {
+      counted += v;
+    }
+    expect(t, "recorded + dropped", double(recorded.load() + r.dropped()),
+           double(producers * samples));
+    expect(t, "drained", double(r.drained()), double(recorded.load()));
+    expect(t, "histogram count", double(counted), double(recorded.load()));
+  });
+}
+
+/**
+ * @brief MetricsRetention: query() returns what tick() sampled
+ *
+ * A thousand ticks at irregular intervals with a retention of a hundred
+ * seconds, so blocks roll over and expire. The retained window sees a
+ * counter wrap past 2^64 and reset, a NaN gauge, a 64 bit integral gauge
+ * and the wall clock going back five seconds. Points carry doubles, the
+ * expected values are converted the same way.
+ */
+void retentionChecks(std::string const& name) {
+  run(name, 1, [](uint64_t, uint64_t, Tally& t) {
+    constexpr size_t ticks = 1000;
+    constexpr size_t retention = 100;
+    MetricsRetention r(std::chrono::seconds(retention), std::chrono::seconds(1));
+    Counter c(0, "correct_retention_counter", "", "a=\"1\"");
+    Gauge<double> g(0., "correct_retention_gauge", "");
+    Gauge<uint64_t> gi(0, "correct_retention_int_gauge", "");
+    Histogram<logr_scale_t<double>> h(logr_scale_t<double>(2, 0, 1024, 4),
+                                      "correct_retention_histogram", "");
+    MetricsRetention::SeriesId const ids[] = {r.add(c), r.add(g), r.add(gi), r.add(h) + 1};
+    std::vector<double> expected[4];
+    std::vector<int64_t> times;
+    std::mt19937_64 gen(1);
+    int64_t ms = 1700000000000;
+    for (size_t i = 0; i < ticks; ++i) {
+      c += (gen() % 3 == 0) ? gen() % 1000 : 5;
+      if (i % 97 == 0) {
+        c += uint64_t(1) << 40;
+      }
+      if (i == ticks - 60) {
+        c = ~uint64_t(0) - 3;
+      } else if (i == ticks - 20) {
+        c = 0;
+      }
+      if (i == ticks - 30) {
+        g = std::numeric_limits<double>::quiet_NaN();
+      } else if (i % 5 != 0) {
+        g = static_cast<double>(gen() % 100000) / 7. * ((gen() & 1) ? 1 : -1);
+      }
+      gi = gen();
+      h.count(static_cast<double>(gen() % 2000));
+      expected[0].push_back(static_cast<double>(c.load()));
+      expected[1].push_back(g.load());
+      expected[2].push_back(static_cast<double>(gi.load()));
+      expected[3].push_back(static_cast<double>(h.load(1)));
+      ms += (i == ticks - 50) ? -5000 : 1000 + static_cast<int64_t>(gen() % 50);
+      times.push_back(ms);
+      r.tick(MetricsRetention::clock::time_point(std::chrono::milliseconds(ms)));
+    }
+    expect(t, "blocks rolled over", r.blockMemory() > r.series() * MetricsRetention::blockSize, true);
+    for (size_t k = 0; k < 4; ++k) {
+      std::string const series = "series " + std::to_string(k);
+      std::vector<MetricsRetention::Point> p;
+      r.query(ids[k], INT64_MIN, INT64_MAX, p);
+      expect(t, series + " retained at least", p.size() >= retention, true);
+      expect(t, series + " expired", p.size() < ticks, true);
+      size_t const skipped = ticks - std::min(p.size(), ticks);
+      for (size_t j = 0; j < p.size(); ++j) {
+        std::string const at = series + " tick " + std::to_string(skipped + j);
+        expect(t, at + " time", static_cast<double>(p[j].time),
+               static_cast<double>(times[skipped + j]));
+        expect(t, at + " value", p[j].value, expected[k][skipped + j]);
+      }
+    }
+    // the range around the jump holds ticks from before and after it
+    std::vector<MetricsRetention::Point> p;
+    r.query(ids[0], times[ticks - 50], times[ticks - 51], p);
+    expect(t, "points in range across the jump", static_cast<double>(p.size()),
+           static_cast<double>(std::count_if(times.end() - retention, times.end(), [&](int64_t x) {
+             return times[ticks - 50] <= x && x <= times[ticks - 51];
+           })));
+  });
+}
+
+}  // namespace
+
 int main(int argc, char* argv[]) {
-  double v = atof(argv[1]);
-  std::cout << "v=" << v << std::endl;
-  uint32_t r = log2rough(v);
-  std::cout << "result is: " << r << std::endl;
-  struct timespec ts;
-  clock_getres(CLOCK_MONOTONIC, &ts);
-  std::cout << "Accuracy monotonic clock_gettime: " << ts.tv_sec << " s + " << ts.tv_nsec << " ns" << std::endl;
-  clock_getres(CLOCK_MONOTONIC_COARSE, &ts);
-  std::cout << "Accuracy monotonic clock_gettime coarse: " << ts.tv_sec << " s + " << ts.tv_nsec << " ns" << std::endl;
-  clock_getres(CLOCK_MONOTONIC_RAW, &ts);
-  std::cout << "Accuracy monotonic clock_gettime raw: " << ts.tv_sec << " s + " << ts.tv_nsec << " ns" << std::endl;
-  return 0;
+  filter = (argc > 1) ? argv[1] : "";
+  threads = (argc > 2) ? std::atoi(argv[2]) : std::thread::hardware_concurrency();
+  threads = std::max(threads, 1u);
+  stride = (argc > 3) ? std::strtoull(argv[3], nullptr, 10) : 1;
+  stride = std::max<uint64_t>(stride, 1);
+
+  log2roughChecks<float>("log2rough<float>");
+  log2roughChecks<double>("log2rough<double>");
+
+  logrChecks<double>("logr_scale_t<double>(2, 0, 65536, 30)", 2., 0., 65536., 30);
+  logrChecks<double>("logr_scale_t<double>(2, 0, 1e8, 30)", 2., 0., 1e8, 30);
+  logrChecks<double>("logr_scale_t<double>(8, 0, 1e8, 10)", 8., 0., 1e8, 10);
+  logrChecks<float>("logr_scale_t<float>(2, 1, 1e6, 20)", 2.f, 1.f, 1e6f, 20);
+
+  scaleChecks("lin_scale_t<double>(0, 1e6, 100)", lin_scale_t<double>(0., 1e6, 100));
+  scaleChecks("lin_scale_t<double>(-1, 1, 30)", lin_scale_t<double>(-1., 1., 30));
+  scaleChecks("lin_scale_t<float>(0, 1000, 7)", lin_scale_t<float>(0.f, 1000.f, 7));
+  scaleChecks("log_scale_t<double>(2, 0, 1e8, 10)", log_scale_t<double>(2., 0., 1e8, 10));
+  scaleChecks("log_scale_t<double>(10, 1, 1e9, 10)", log_scale_t<double>(10., 1., 1e9, 10));
+  scaleChecks("log_scale_t<float>(2, 0, 1e6, 20)", log_scale_t<float>(2.f, 0.f, 1e6f, 20));
+
+  batchChecks<double>("logr_scale_t<double>(2, 0, 1e8, 30)", 2., 0., 1e8, 30);
+  batchChecks<double>("logr_scale_t<double>(8, 0, 1e8, 10)", 8., 0., 1e8, 10);
+  batchChecks<float>("logr_scale_t<float>(2, 1, 1e6, 20)", 2.f, 1.f, 1e6f, 20);
+
+  intLinChecks<uint32_t>("int_lin_scale_t<uint32_t>(0, 2^20, 1024)", 0, 1u << 20, 1024);
+  intLinChecks<uint32_t>("int_lin_scale_t<uint32_t>(0, 1e6, 100)", 0, 1000000, 100);
+  intLinChecks<uint32_t>("int_lin_scale_t<uint32_t>(7, 4e9, 30)", 7, 4000000000u, 30);
+  intLinChecks<int32_t>("int_lin_scale_t<int32_t>(-1e9, 1e9, 77)", -1000000000, 1000000000, 77);
+  intLinChecks<uint64_t>("int_lin_scale_t<uint64_t>(1, 1e15 + 3, 97)", 1, 1000000000000003ull, 97);
+
+  autoSuite<uint32_t>("uint32_t");
+  autoSuite<uint64_t>("uint64_t");
+  autoSuite<float>("float");
+  autoSuite<double>("double");
+
+  std::vector<double> decimal(table, table + 9);
+  allFloats<double>("findBucket2",
+    [](double v) { return findBucket2(v); },
+    [&decimal](double v) { return countBelow(decimal, v); });
+  nearBounds<double>("findBucket2", decimal,
+    [](double v) { return findBucket2(v); },
+    [&decimal](double v) { return countBelow(decimal, v); });
+
+  sparseChecks<3>("SparseHistogram<double, 3> le labels", 1);
+  sparseChecks<10>("SparseHistogram<double, 10> le labels", 97);
+  recorderChecks("MetricsRecorder 4 producers");
+  retentionChecks("MetricsRetention round trip");
+
+  return failed ? 1 : 0;
 }
@@ -16,7 +16,24 @@
 #include <unordered_set>
 
 #include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <limits>
 #include <mutex>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#if defined __linux__
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 namespace gcl {
 
@@ -209,6 +226,35 @@ Consequently, red_count.load() will not reflect any counts in buffers.
 Those counts will not be lost, though.
 
 
+SELF-FLUSHING BUFFERS
+
+A long-lived buffer, e.g. a thread_local one,
+hides its counts until somebody calls push.
+A flush buffer pushes by itself
+once its count reaches a threshold (default 1024, either sign)
+or once the coarse epoch of a flush_registry has advanced
+since its last push.
+The epoch is one shared word that counting only reads;
+there is no clock read when counting.
+Something periodic, e.g. the metrics exporter, advances the epoch.
+
+    counter::simplex<int> red_count;
+    thread_local counter::flush_buffer<int> local_red( red_count, 256 );
+
+    // on a timer or before a scrape
+    counter::flush_registry::global().flush();
+
+The flush operation advances the epoch,
+so each live buffer pushes on its next count,
+and immediately pushes all buffers with atomicity::full,
+which register with the registry for that purpose.
+A buffer that does not count any more keeps its counts
+until it is destroyed or pushed explicitly,
+unless it has atomicity::full.
+The flush_buffer_array does the same per array,
+its epoch check pushes the whole array.
+
+
 COUNTER ARRAYS
 
 Counter arrays provide a means to handle many counters with one name.
@@ -222,11 +268,57 @@ E.g. ++ctr_ary[i].
 
 The load and exchange operations take an additional index parameter.
 
+Spill arrays are buffer arrays whose counters are narrower
+than the prime, e.g. 16 or 32 bits against 64.
+They keep the counting working set small
+and transfer a count to the prime on push,
+on destruction, or when it reaches half of the narrow range.
+Like the other thread-local buffers they have a single writer,
+their buffer atomicity is none or semi.
+
+    counter::simplex_array<uint64_t> buckets( 30 );
+    thread_local counter::spill_array<uint16_t, uint64_t> local( buckets );
+    ++local[ 7 ];
+
+The simplex_array takes an allocator for its counters
+as last template parameter, std::allocator by default.
+The aligned_allocator puts the counters on a fresh cache line.
+The huge_page_allocator puts large arrays on transparent huge pages,
+or on pages from the hugetlb pool if its Explicit flag is set,
+so that sweeping a large array costs few TLB misses.
+Buffer, spill and flush buffer arrays name the prime allocator
+as an extra last template parameter.
+
+    counter::simplex_array<uint64_t, counter::atomicity::full,
+                           counter::huge_page_allocator<uint64_t>> big( 1 << 20 );
+
 Do we want to initialize a counter array with an initializer list?
 Do we want to return a dynarray for the load operation?
 Do we want to pass and return a dynarray for the exchange operation?
 
 
+NUMA SHARDS
+
+On machines with several NUMA nodes,
+even an uncontended atomic increment is slow
+when the counter lives in the memory of another node,
+and every contended one moves the cache line across the interconnect.
+The numa_simplex and numa_simplex_array counters
+keep one shard per node, placed in that node's memory,
+and increment the shard of the node the calling thread runs on.
+Only load and exchange visit all shards.
+
+    counter::numa_simplex_array<uint64_t> buckets( 30 );
+    ++buckets[ 7 ];            // node-local
+    uint64_t n = buckets.load( 7 );  // sum over nodes
+
+Each shard occupies whole pages,
+so numa_simplex is meant for a few very hot counters.
+On a single node there is one shard and no node lookup,
+so they behave like simplex and simplex_array.
+A numa_simplex_array can serve as histogram storage.
+
+
 ATOMICITY
 
 In the course of program evolution, debugging and tuning,
@@ -392,11 +484,12 @@ protected:
     Integral exchange( Integral to )
         { Integral tmp = value_; value_ = to; return tmp; }
     Integral value_;
-    template< typename, atomicity >
+    template< typename, atomicity, typename >
     friend class bumper_array;
-    template< typename, atomicity, atomicity >
+    template< typename, atomicity, atomicity, typename >
     friend class buffer_array;
-    friend struct std::dynarray< bumper >;
+    template< class, class >
+    friend struct std::dynarray;
 };
 
 template< typename Integral >
@@ -423,11 +516,12 @@ protected:
         { Integral tmp = value_.load( std::memory_order_relaxed );
           value_.store( to, std::memory_order_relaxed ); return tmp; }
     std::atomic< Integral > value_;
-    template< typename, atomicity >
+    template< typename, atomicity, typename >
     friend class bumper_array;
-    template< typename, atomicity, atomicity >
+    template< typename, atomicity, atomicity, typename >
     friend class buffer_array;
-    friend struct std::dynarray< bumper >;
+    template< class, class >
+    friend struct std::dynarray;
 };
 
 template< typename Integral >
@@ -451,11 +545,14 @@ protected:
     Integral exchange( Integral to )
         { return value_.exchange( to, std::memory_order_relaxed ); }
     std::atomic< Integral > value_;
-    template< typename, atomicity >
+    template< typename, atomicity, typename >
     friend class bumper_array;
-    template< typename, atomicity, atomicity >
+    template< typename, atomicity, atomicity, typename >
     friend class buffer_array;
-    friend struct std::dynarray< bumper >;
+    template< class, class >
+    friend struct std::dynarray;
+    template< typename >
+    friend class numa_shards;
 };
 
 /*
@@ -507,6 +604,109 @@ private:
     prime_type& prime_;
 };
 
+/*
+   The flush registry provides the coarse epoch of the self-flushing buffers
+   and pushes the buffers that other threads may push, i.e. those with
+   atomicity::full, on request.
+   The epoch has a cache line of its own, as counting threads read it.
+*/
+
+class flush_registry
+{
+public:
+    typedef void ( *push_type )( void* );
+    flush_registry() : epoch_( 0 ) {}
+    flush_registry( const flush_registry& ) = delete;
+    flush_registry& operator=( const flush_registry& ) = delete;
+    static flush_registry& global()
+        { static flush_registry registry; return registry; }
+    unsigned epoch() const { return epoch_.load( std::memory_order_relaxed ); }
+    void tick() { epoch_.fetch_add( 1, std::memory_order_relaxed ); }
+    void flush();
+    void insert( void* buffer, push_type push );
+    void erase( void* buffer );
+private:
+    alignas( 64 ) std::atomic< unsigned > epoch_;
+    alignas( 64 ) std::mutex mutex_;
+    std::unordered_map< void*, push_type > buffers_;
+};
+
+inline void flush_registry::flush()
+{
+    tick();
+    std::lock_guard< std::mutex > _( mutex_ );
+    for ( auto const& b : buffers_ )
+        b.second( b.first );
+}
+
+inline void flush_registry::insert( void* buffer, push_type push )
+{
+    std::lock_guard< std::mutex > _( mutex_ );
+    bool inserted = buffers_.emplace( buffer, push ).second;
+    assert( inserted );
+    (void) inserted;
+}
+
+inline void flush_registry::erase( void* buffer )
+{
+    std::lock_guard< std::mutex > _( mutex_ );
+    bool erased = buffers_.erase( buffer ) == 1;
+    assert( erased );
+    (void) erased;
+}
+
+/*
+   Flush buffers are buffers that push by themselves
+   when their count reaches the threshold (in magnitude)
+   or when the registry epoch has advanced since their last push.
+*/
+
+template< typename Integral,
+          atomicity PrimeAtomicity = atomicity::full,
+          atomicity BufferAtomicity = atomicity::none >
+class flush_buffer
+: public bumper< Integral, BufferAtomicity >
+{
+    typedef bumper< Integral, PrimeAtomicity > prime_type;
+    typedef bumper< Integral, BufferAtomicity > base_type;
+    static constexpr bool remote = BufferAtomicity == atomicity::full;
+public:
+    flush_buffer() = delete;
+    flush_buffer( prime_type& p, Integral threshold = 1024,
+                  flush_registry& r = flush_registry::global() )
+    : base_type( 0 ), prime_( p ), registry_( r ),
+      threshold_( threshold ), epoch_( r.epoch() )
+        { if ( remote ) registry_.insert( this, &push_thunk ); }
+    flush_buffer( const flush_buffer& ) = delete;
+    flush_buffer& operator=( const flush_buffer& ) = delete;
+    void operator +=( Integral by ) { base_type::operator +=( by ); check(); }
+    void operator -=( Integral by ) { base_type::operator -=( by ); check(); }
+    void operator ++() { *this += 1; }
+    void operator ++(int) { *this += 1; }
+    void operator --() { *this -= 1; }
+    void operator --(int) { *this -= 1; }
+    void push()
+        { epoch_.store( registry_.epoch(), std::memory_order_relaxed );
+          Integral value = base_type::exchange( 0 );
+          if ( value != 0 ) prime_ += value; }
+    ~flush_buffer()
+        { if ( remote ) registry_.erase( this );
+          push(); }
+private:
+    static void push_thunk( void* b )
+        { static_cast< flush_buffer* >( b )->push(); }
+    void check()
+        { Integral value = base_type::load();
+          if ( value >= threshold_
+               || ( std::is_signed< Integral >::value && value <= -threshold_ )
+               || registry_.epoch() != epoch_.load( std::memory_order_relaxed ) )
+              push(); }
+    prime_type& prime_;
+    flush_registry& registry_;
+    Integral threshold_;
+    std::atomic< unsigned > epoch_;
+};
+
 /*
    Duplex counters enable a "pull" model of counting.
    Each counter, the prime, may have one or more brokers.
@@ -561,7 +761,9 @@ template< typename Integral >
 void strong_duplex< Integral >::insert( broker_type* child )
 {
     std::lock_guard< std::mutex > _( serializer_ );
-    assert( children_.insert( child ).second );
+    bool inserted = children_.insert( child ).second;
+    assert( inserted );
+    (void) inserted;
 }
 
 template< typename Integral >
@@ -569,13 +771,15 @@ void strong_duplex< Integral >::erase( broker_type* child, Integral by )
 {
     this->operator +=( by );
     std::lock_guard< std::mutex > _( serializer_ );
-    assert( children_.erase( child ) == 1 );
+    size_t erased = children_.erase( child );
+    assert( erased == 1 );
+    (void) erased;
 }
 
 template< typename Integral >
 Integral strong_duplex< Integral >::load() const
 {
-    typedef typename set_type::iterator iterator;
+    typedef typename set_type::const_iterator iterator;
     Integral tmp = 0;
     {
         std::lock_guard< std::mutex > _( serializer_ );
@@ -666,7 +870,9 @@ template< typename Integral >
 void weak_duplex< Integral >::insert( broker_type* child )
 {
     std::lock_guard< std::mutex > _( serializer_ );
-    assert( children_.insert( child ).second );
+    bool inserted = children_.insert( child ).second;
+    assert( inserted );
+    (void) inserted;
 }
 
 template< typename Integral >
@@ -674,13 +880,15 @@ void weak_duplex< Integral >::erase( broker_type* child, Integral by )
 {
     std::lock_guard< std::mutex > _( serializer_ );
     this->operator +=( by );
-    assert( children_.erase( child ) == 1 );
+    size_t erased = children_.erase( child );
+    assert( erased == 1 );
+    (void) erased;
 }
 
 template< typename Integral >
 Integral weak_duplex< Integral >::load() const
 {
-    typedef typename set_type::iterator iterator;
+    typedef typename set_type::const_iterator iterator;
     Integral tmp = 0;
     {
         std::lock_guard< std::mutex > _( serializer_ );
@@ -717,19 +925,132 @@ weak_broker< Integral >::~weak_broker()
 
 // Counter arrays.
 
+/*
+   Allocators for the storage of counter arrays.
+   The aligned_allocator starts the array on a cache line.
+   The huge_page_allocator maps arrays of at least one huge page
+   separately and 2MB aligned, asking for transparent huge pages,
+   or with Explicit first for pages from the hugetlb pool;
+   smaller arrays fall back to cache line aligned heap memory.
+   Outside Linux it is std::allocator.
+*/
+
+template< typename T, std::size_t Alignment = 64 >
+struct aligned_allocator
+{
+    typedef T value_type;
+    template< typename U >
+    struct rebind { typedef aligned_allocator< U, Alignment > other; };
+    aligned_allocator() = default;
+    template< typename U >
+    aligned_allocator( const aligned_allocator< U, Alignment >& ) {}
+    T* allocate( std::size_t n )
+        { std::size_t bytes = ( n * sizeof( T ) + Alignment - 1 )
+                              / Alignment * Alignment;
+          void* p = std::aligned_alloc( Alignment, bytes ? bytes : Alignment );
+          if ( p == nullptr ) throw std::bad_alloc();
+          return static_cast< T* >( p ); }
+    void deallocate( T* p, std::size_t ) { std::free( p ); }
+};
+
+template< typename T, typename U, std::size_t A >
+bool operator ==( const aligned_allocator< T, A >&, const aligned_allocator< U, A >& )
+    { return true; }
+template< typename T, typename U, std::size_t A >
+bool operator !=( const aligned_allocator< T, A >&, const aligned_allocator< U, A >& )
+    { return false; }
+
+template< typename T, bool Explicit = false >
+struct huge_page_allocator
+{
+    typedef T value_type;
+    static constexpr std::size_t huge_page = std::size_t( 2 ) << 20;
+    template< typename U >
+    struct rebind { typedef huge_page_allocator< U, Explicit > other; };
+    huge_page_allocator() = default;
+    template< typename U >
+    huge_page_allocator( const huge_page_allocator< U, Explicit >& ) {}
+#if defined __linux__
+    T* allocate( std::size_t n )
+        { std::size_t bytes = n * sizeof( T );
+          if ( bytes < huge_page ) return aligned_allocator< T >().allocate( n );
+          return static_cast< T* >( map( round( bytes ) ) ); }
+    void deallocate( T* p, std::size_t n )
+        { std::size_t bytes = n * sizeof( T );
+          if ( bytes < huge_page ) aligned_allocator< T >().deallocate( p, n );
+          else munmap( p, round( bytes ) ); }
+private:
+    static std::size_t round( std::size_t bytes )
+        { return ( bytes + huge_page - 1 ) / huge_page * huge_page; }
+    static void* map( std::size_t length );
+#else
+    T* allocate( std::size_t n ) { return std::allocator< T >().allocate( n ); }
+    void deallocate( T* p, std::size_t n )
+        { std::allocator< T >().deallocate( p, n ); }
+#endif
+};
+
+// stateless, so dynarray's empty base costs nothing
+static_assert( std::is_empty< huge_page_allocator< std::uint64_t > >::value,
+               "huge_page_allocator must be empty" );
+
+#if defined __linux__
+template< typename T, bool Explicit >
+void* huge_page_allocator< T, Explicit >::map( std::size_t length )
+{
+    if ( Explicit ) {
+        // without MAP_NORESERVE, a short hugetlb pool fails here
+        // instead of raising SIGBUS on first touch
+        void* p = mmap( nullptr, length, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0 );
+        if ( p != MAP_FAILED )
+            return p;
+    }
+    // over-map by one huge page and trim to a 2MB aligned range
+    void* p = mmap( nullptr, length + huge_page, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+    if ( p == MAP_FAILED )
+        throw std::bad_alloc();
+    char* raw = static_cast< char* >( p );
+    char* start = reinterpret_cast< char* >(
+        ( reinterpret_cast< std::uintptr_t >( raw ) + huge_page - 1 )
+        & ~( huge_page - 1 ) );
+    if ( start != raw )
+        munmap( raw, start - raw );
+    std::size_t tail = ( raw + length + huge_page ) - ( start + length );
+    if ( tail != 0 )
+        munmap( start + length, tail );
+#if defined MADV_HUGEPAGE
+    madvise( start, length, MADV_HUGEPAGE );
+#endif
+    return start;
+}
+#endif
+
+template< typename T, typename U, bool E >
+bool operator ==( const huge_page_allocator< T, E >&, const huge_page_allocator< U, E >& )
+    { return true; }
+template< typename T, typename U, bool E >
+bool operator !=( const huge_page_allocator< T, E >&, const huge_page_allocator< U, E >& )
+    { return false; }
 
 template< typename Integral,
-          atomicity Atomicity = atomicity::full >
+          atomicity Atomicity = atomicity::full,
+          typename Allocator = std::allocator< Integral > >
 class bumper_array
 {
 public:
     typedef bumper< Integral, Atomicity > value_type;
+    typedef Allocator allocator_type;
 private:
-    typedef std::dynarray< value_type > storage_type;
+    typedef typename std::allocator_traits< Allocator >
+        ::template rebind_alloc< value_type > storage_allocator;
+    typedef std::dynarray< value_type, storage_allocator > storage_type;
 public:
     typedef typename storage_type::size_type size_type;
     bumper_array() = delete;
-    bumper_array( size_type size ) : storage( size ) {}
+    bumper_array( size_type size, const allocator_type& a = allocator_type() )
+      : storage( size, storage_allocator( a ) ) {}
     bumper_array( const bumper_array& ) = delete;
     bumper_array& operator=( const bumper_array& ) = delete;
     value_type& operator[]( size_type idx ) { return storage[ idx ]; }
@@ -743,16 +1064,19 @@ private:
 };
 
 template< typename Integral,
-          atomicity Atomicity = atomicity::full >
+          atomicity Atomicity = atomicity::full,
+          typename Allocator = std::allocator< Integral > >
 class simplex_array
-: public bumper_array< Integral, Atomicity >
+: public bumper_array< Integral, Atomicity, Allocator >
 {
-    typedef bumper_array< Integral, Atomicity > base_type;
+    typedef bumper_array< Integral, Atomicity, Allocator > base_type;
 public:
     typedef typename base_type::value_type value_type;
     typedef typename base_type::size_type size_type;
+    typedef typename base_type::allocator_type allocator_type;
     simplex_array() = delete;
-    constexpr simplex_array( size_type size ) : base_type( size ) {}
+    simplex_array( size_type size, const allocator_type& a = allocator_type() )
+      : base_type( size, a ) {}
     simplex_array( const simplex_array& ) = delete;
     simplex_array& operator=( const simplex_array& ) = delete;
     Integral load( size_type idx ) const{ return base_type::load( idx ); }
@@ -764,12 +1088,13 @@ public:
 
 template< typename Integral,
           atomicity PrimeAtomicity = atomicity::full,
-          atomicity BufferAtomicity = atomicity::full >
+          atomicity BufferAtomicity = atomicity::full,
+          typename PrimeAllocator = std::allocator< Integral > >
 class buffer_array
 : public bumper_array< Integral, BufferAtomicity >
 {
     typedef bumper_array< Integral, BufferAtomicity > base_type;
-    typedef bumper_array< Integral, PrimeAtomicity > prime_type;
+    typedef bumper_array< Integral, PrimeAtomicity, PrimeAllocator > prime_type;
 public:
     typedef typename base_type::value_type value_type;
     typedef typename base_type::size_type size_type;
@@ -788,15 +1113,147 @@ private:
 };
 
 template< typename Integral,
-          atomicity BufferAtomicity, atomicity PrimeAtomicity >
+          atomicity BufferAtomicity, atomicity PrimeAtomicity,
+          typename PrimeAllocator >
 void
-buffer_array< Integral, BufferAtomicity, PrimeAtomicity >::push()
+buffer_array< Integral, BufferAtomicity, PrimeAtomicity, PrimeAllocator >::push()
 {
     int size = base_type::size();
     for ( int i = 0; i < size; ++i )
         push( i );
 }
 
+/*
+   Spill arrays are buffer arrays with narrow counters.
+   A narrow counter transfers its count to the wide prime
+   once it passes half of its range, so it cannot overflow.
+   Indexing yields a reference proxy that checks for the spill.
+   The add, check and push sequence is not atomic,
+   so the buffer allows a single writer only.
+*/
+
+template< typename Narrow, typename Integral,
+          atomicity PrimeAtomicity = atomicity::full,
+          atomicity BufferAtomicity = atomicity::none,
+          typename PrimeAllocator = std::allocator< Integral > >
+class spill_array
+: public bumper_array< Narrow, BufferAtomicity >
+{
+    typedef bumper_array< Narrow, BufferAtomicity > base_type;
+    typedef bumper_array< Integral, PrimeAtomicity, PrimeAllocator > prime_type;
+    static_assert( sizeof( Narrow ) < sizeof( Integral ),
+                   "spill_array needs a narrower buffer type" );
+    static_assert( BufferAtomicity != atomicity::full,
+                   "spill_array buffers allow a single writer only" );
+public:
+    typedef typename base_type::size_type size_type;
+    static constexpr Narrow threshold
+      = std::numeric_limits< Narrow >::max() / 2 + 1;
+    class reference
+    {
+    public:
+        void operator +=( Integral by ) { array_.add( idx_, by ); }
+        void operator ++() { array_.add( idx_, 1 ); }
+        void operator ++(int) { array_.add( idx_, 1 ); }
+    private:
+        friend class spill_array;
+        reference( spill_array& a, size_type idx ) : array_( a ), idx_( idx ) {}
+        spill_array& array_;
+        size_type idx_;
+    };
+    spill_array() = delete;
+    spill_array( prime_type& p ) : base_type( p.size() ), prime_( p ) {}
+    spill_array( const spill_array& ) = delete;
+    spill_array& operator=( const spill_array& ) = delete;
+    reference operator[]( size_type idx ) { return reference( *this, idx ); }
+    void add( size_type idx, Integral by )
+        { if ( by >= threshold ) { prime_[ idx ] += by; return; }
+          // below threshold before and by < threshold: at most max
+          assert( base_type::load( idx ) < threshold );
+          base_type::operator[]( idx ) += static_cast< Narrow >( by );
+          if ( base_type::load( idx ) >= threshold ) push( idx ); }
+    void push( size_type idx )
+        { Narrow value = base_type::exchange( idx, 0 );
+          if ( value != 0 ) prime_[ idx ] += value; }
+    void push()
+        { size_type size = base_type::size();
+          for ( size_type i = 0; i < size; ++i )
+              push( i ); }
+    size_type size() const { return base_type::size(); }
+    ~spill_array() { push(); }
+private:
+    prime_type& prime_;
+};
+
+/*
+   Flush buffer arrays check the threshold of the indexed counter
+   and push the whole array when the registry epoch has advanced.
+   Indexing yields a reference proxy that does the checks.
+*/
+
+template< typename Integral,
+          atomicity PrimeAtomicity = atomicity::full,
+          atomicity BufferAtomicity = atomicity::none,
+          typename PrimeAllocator = std::allocator< Integral > >
+class flush_buffer_array
+: public bumper_array< Integral, BufferAtomicity >
+{
+    typedef bumper_array< Integral, BufferAtomicity > base_type;
+    typedef bumper_array< Integral, PrimeAtomicity, PrimeAllocator > prime_type;
+    static constexpr bool remote = BufferAtomicity == atomicity::full;
+public:
+    typedef typename base_type::size_type size_type;
+    class reference
+    {
+    public:
+        void operator +=( Integral by ) { array_.add( idx_, by ); }
+        void operator -=( Integral by ) { array_.add( idx_, -by ); }
+        void operator ++() { array_.add( idx_, 1 ); }
+        void operator ++(int) { array_.add( idx_, 1 ); }
+    private:
+        friend class flush_buffer_array;
+        reference( flush_buffer_array& a, size_type idx ) : array_( a ), idx_( idx ) {}
+        flush_buffer_array& array_;
+        size_type idx_;
+    };
+    flush_buffer_array() = delete;
+    flush_buffer_array( prime_type& p, Integral threshold = 1024,
+                        flush_registry& r = flush_registry::global() )
+    : base_type( p.size() ), prime_( p ), registry_( r ),
+      threshold_( threshold ), epoch_( r.epoch() )
+        { if ( remote ) registry_.insert( this, &push_thunk ); }
+    flush_buffer_array( const flush_buffer_array& ) = delete;
+    flush_buffer_array& operator=( const flush_buffer_array& ) = delete;
+    reference operator[]( size_type idx ) { return reference( *this, idx ); }
+    void add( size_type idx, Integral by )
+        { base_type::operator[]( idx ) += by;
+          if ( registry_.epoch() != epoch_.load( std::memory_order_relaxed ) )
+              { push(); return; }
+          Integral value = base_type::load( idx );
+          if ( value >= threshold_
+               || ( std::is_signed< Integral >::value && value <= -threshold_ ) )
+              push( idx ); }
+    void push( size_type idx )
+        { Integral value = base_type::exchange( idx, 0 );
+          if ( value != 0 ) prime_[ idx ] += value; }
+    void push()
+        { epoch_.store( registry_.epoch(), std::memory_order_relaxed );
+          size_type size = base_type::size();
+          for ( size_type i = 0; i < size; ++i )
+              push( i ); }
+    size_type size() const { return base_type::size(); }
+    ~flush_buffer_array()
+        { if ( remote ) registry_.erase( this );
+          push(); }
+private:
+    static void push_thunk( void* b )
+        { static_cast< flush_buffer_array* >( b )->push(); }
+    prime_type& prime_;
+    flush_registry& registry_;
+    Integral threshold_;
+    std::atomic< unsigned > epoch_;
+};
+
 // Duplex arrays
 
 template< typename Integral > class strong_broker_array;
@@ -815,21 +1272,23 @@ public:
       : base_type( size ) {}
     strong_duplex_array( const strong_duplex_array& ) = delete;
     strong_duplex_array& operator=( const strong_duplex_array& ) = delete;
+    Integral load( size_type idx ) const;
+    Integral exchange( size_type idx, Integral to );
     value_type& operator[]( size_type idx ) { return base_type::operator[]( idx ); }
     size_type size() const { return base_type::size(); }
     ~strong_duplex_array();
 private:
     void insert( broker_type* child );
-    void erase( broker_type* child, Integral by );
+    void erase( broker_type* child );
     mutable std::mutex serializer_;
     typedef std::unordered_set< broker_type* > set_type;
     set_type children_;
 };
 
 template< typename Integral > class strong_broker_array
-: public bumper_array< Integral, atomicity::semi >
+: public bumper_array< Integral, atomicity::full >
 {
-    typedef bumper_array< Integral, atomicity::semi > base_type;
+    typedef bumper_array< Integral, atomicity::full > base_type;
     typedef strong_duplex_array< Integral > duplex_type;
     friend class strong_duplex_array< Integral >;
 public:
@@ -842,13 +1301,62 @@ public:
     size_type size() const { return base_type::size(); }
     ~strong_broker_array();
 private:
-    Integral poll( size_type idx )
-      { return base_type::operator[]( idx ).load(); }
+    Integral poll( size_type idx ) const
+      { return base_type::load( idx ); }
     Integral drain( size_type idx )
-      { return base_type::operator[]( idx ).exchange( 0 ); }
+      { return base_type::exchange( idx, 0 ); }
     duplex_type& prime_;
 };
 
+template< typename Integral >
+void strong_duplex_array< Integral >::insert( broker_type* child )
+{
+    std::lock_guard< std::mutex > _( serializer_ );
+    bool inserted = children_.insert( child ).second;
+    assert( inserted );
+    (void) inserted;
+}
+
+template< typename Integral >
+void strong_duplex_array< Integral >::erase( broker_type* child )
+{
+    std::lock_guard< std::mutex > _( serializer_ );
+    size_type size = base_type::size();
+    for ( size_type i = 0; i < size; ++i )
+        base_type::operator[]( i ) += child->drain( i );
+    size_t erased = children_.erase( child );
+    assert( erased == 1 );
+    (void) erased;
+}
+
+template< typename Integral >
+Integral strong_duplex_array< Integral >::load( size_type idx ) const
+{
+    typedef typename set_type::const_iterator iterator;
+    Integral tmp = 0;
+    {
+        std::lock_guard< std::mutex > _( serializer_ );
+        iterator rollcall = children_.begin();
+        for ( ; rollcall != children_.end(); ++rollcall )
+            tmp += (*rollcall)->poll( idx );
+    }
+    return tmp + base_type::load( idx );
+}
+
+template< typename Integral >
+Integral strong_duplex_array< Integral >::exchange( size_type idx, Integral to )
+{
+    typedef typename set_type::iterator iterator;
+    Integral tmp = 0;
+    {
+        std::lock_guard< std::mutex > _( serializer_ );
+        iterator rollcall = children_.begin();
+        for ( ; rollcall != children_.end(); ++rollcall )
+            tmp += (*rollcall)->drain( idx );
+    }
+    return tmp + base_type::exchange( idx, to );
+}
+
 template< typename Integral >
 strong_duplex_array< Integral >::~strong_duplex_array()
 {
@@ -868,7 +1376,7 @@ strong_broker_array< Integral >::strong_broker_array( duplex_type& p )
 template< typename Integral >
 strong_broker_array< Integral >::~strong_broker_array()
 {
-    prime_.erase( this, base_type::load() );
+    prime_.erase( this );
 }
 
 
@@ -888,12 +1396,13 @@ public:
       : base_type( size ) {}
     weak_duplex_array( const weak_duplex_array& ) = delete;
     weak_duplex_array& operator=( const weak_duplex_array& ) = delete;
+    Integral load( size_type idx ) const;
     value_type& operator[]( size_type idx ) { return base_type::operator[]( idx ); }
     size_type size() const { return base_type::size(); }
     ~weak_duplex_array();
 private:
     void insert( broker_type* child );
-    void erase( broker_type* child, Integral by );
+    void erase( broker_type* child );
     mutable std::mutex serializer_;
     typedef std::unordered_set< broker_type* > set_type;
     set_type children_;
@@ -915,11 +1424,47 @@ public:
     size_type size() const { return base_type::size(); }
     ~weak_broker_array();
 private:
-    Integral poll( size_type idx )
-      { return base_type::operator[]( idx ).load(); }
+    Integral poll( size_type idx ) const
+      { return base_type::load( idx ); }
     duplex_type& prime_;
 };
 
+template< typename Integral >
+void weak_duplex_array< Integral >::insert( broker_type* child )
+{
+    std::lock_guard< std::mutex > _( serializer_ );
+    bool inserted = children_.insert( child ).second;
+    assert( inserted );
+    (void) inserted;
+}
+
+template< typename Integral >
+void weak_duplex_array< Integral >::erase( broker_type* child )
+{
+    std::lock_guard< std::mutex > _( serializer_ );
+    size_type size = base_type::size();
+    for ( size_type i = 0; i < size; ++i )
+        base_type::operator[]( i ) += child->poll( i );
+    size_t erased = children_.erase( child );
+    assert( erased == 1 );
+    (void) erased;
+}
+
+template< typename Integral >
+Integral weak_duplex_array< Integral >::load( size_type idx ) const
+{
+    typedef typename set_type::const_iterator iterator;
+    Integral tmp = 0;
+    {
+        std::lock_guard< std::mutex > _( serializer_ );
+        iterator rollcall = children_.begin();
+        for ( ; rollcall != children_.end(); ++rollcall )
+            tmp += (*rollcall)->poll( idx );
+        tmp += base_type::load( idx );
+    }
+    return tmp;
+}
+
 template< typename Integral >
 weak_duplex_array< Integral >::~weak_duplex_array()
 {
@@ -939,9 +1484,229 @@ weak_broker_array< Integral >::weak_broker_array( duplex_type& p )
 template< typename Integral >
 weak_broker_array< Integral >::~weak_broker_array()
 {
-    prime_.erase( this, base_type::load() );
+    prime_.erase( this );
+}
+
+
+
+// NUMA shards
+
+/*
+   The NUMA topology is read once from sysfs.
+   Without sysfs, or on other systems, there is a single node.
+   Memory for a node is bound with a preferred policy before first touch,
+   so it still works when that node runs out of memory.
+*/
+
+class numa_topology
+{
+public:
+    static const numa_topology& get()
+        { static const numa_topology topology; return topology; }
+    unsigned nodes() const { return nodes_; }
+    unsigned node() const
+        { if ( nodes_ == 1 ) return 0;
+#if defined __linux__
+          int cpu = sched_getcpu();
+          if ( cpu >= 0 && static_cast< size_t >( cpu ) < cpu_node_.size() )
+              return cpu_node_[ cpu ];
+#endif
+          return 0; }
+    const std::vector< int >& cpus( unsigned node ) const
+        { return node_cpus_[ node ]; }
+    void* allocate( std::size_t bytes, unsigned node ) const;
+    static void deallocate( void* p, std::size_t bytes );
+    static std::size_t round( std::size_t bytes );
+private:
+    numa_topology();
+    static std::vector< int > parse( const std::string& list );
+    unsigned nodes_;
+    std::vector< unsigned > cpu_node_;
+    std::vector< std::vector< int > > node_cpus_;
+};
+
+inline std::vector< int > numa_topology::parse( const std::string& list )
+{
+    // e.g. "0-3,8-11"
+    std::vector< int > result;
+    const char* p = list.c_str();
+    while ( *p != '\0' && *p != '\n' ) {
+        char* end;
+        long lo = strtol( p, &end, 10 );
+        if ( end == p ) break;
+        long hi = lo;
+        p = end;
+        if ( *p == '-' ) {
+            hi = strtol( p + 1, &end, 10 );
+            p = end;
+        }
+        for ( long i = lo; i <= hi; ++i )
+            result.push_back( static_cast< int >( i ) );
+        if ( *p == ',' ) ++p;
+    }
+    return result;
+}
+
+inline numa_topology::numa_topology()
+: nodes_( 1 )
+{
+    std::string line;
+    std::ifstream online( "/sys/devices/system/node/online" );
+    std::vector< int > ids;
+    if ( std::getline( online, line ) )
+        ids = parse( line );
+    for ( int id : ids ) {
+        std::ifstream cpulist( "/sys/devices/system/node/node"
+                               + std::to_string( id ) + "/cpulist" );
+        std::vector< int > cpus;
+        if ( std::getline( cpulist, line ) )
+            cpus = parse( line );
+        if ( node_cpus_.size() <= static_cast< size_t >( id ) )
+            node_cpus_.resize( id + 1 );
+        node_cpus_[ id ] = cpus;
+        for ( int cpu : cpus ) {
+            if ( cpu_node_.size() <= static_cast< size_t >( cpu ) )
+                cpu_node_.resize( cpu + 1, 0 );
+            cpu_node_[ cpu ] = id;
+        }
+    }
+    if ( node_cpus_.size() > 1 )
+        nodes_ = static_cast< unsigned >( node_cpus_.size() );
+    else
+        node_cpus_.resize( 1 );
+}
+
+inline std::size_t numa_topology::round( std::size_t bytes )
+{
+#if defined __linux__
+    std::size_t page = static_cast< std::size_t >( sysconf( _SC_PAGESIZE ) );
+#else
+    std::size_t page = 4096;
+#endif
+    return ( bytes + page - 1 ) / page * page;
 }
 
+inline void* numa_topology::allocate( std::size_t bytes, unsigned node ) const
+{
+#if defined __linux__
+    void* p = mmap( nullptr, bytes, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+    if ( p == MAP_FAILED ) throw std::bad_alloc();
+    if ( nodes_ > 1 ) {
+        const int mpol_preferred = 1;
+        const std::size_t bits = 8 * sizeof( unsigned long );
+        std::vector< unsigned long > mask( nodes_ / bits + 1, 0 );
+        mask[ node / bits ] |= 1UL << ( node % bits );
+        // best effort, without it the pages land where they are touched
+        syscall( SYS_mbind, p, bytes, mpol_preferred, mask.data(),
+                 mask.size() * bits + 1, 0 );
+    }
+    return p;
+#else
+    (void) node;
+    return ::operator new( bytes, std::align_val_t( 4096 ) );
+#endif
+}
+
+inline void numa_topology::deallocate( void* p, std::size_t bytes )
+{
+#if defined __linux__
+    munmap( p, bytes );
+#else
+    (void) bytes;
+    ::operator delete( p, std::align_val_t( 4096 ) );
+#endif
+}
+
+/*
+   The shards hold one page-aligned block of size counters per node.
+*/
+
+template< typename Integral >
+class numa_shards
+{
+public:
+    typedef bumper< Integral, atomicity::full > value_type;
+    typedef std::size_t size_type;
+    explicit numa_shards( size_type size )
+    : size_( size ), bytes_( numa_topology::round( size * sizeof( value_type ) ) )
+        { const numa_topology& topology = numa_topology::get();
+          shards_.reserve( topology.nodes() );
+          for ( unsigned node = 0; node < topology.nodes(); ++node ) {
+              value_type* shard = static_cast< value_type* >(
+                  topology.allocate( bytes_, node ) );
+              for ( size_type i = 0; i < size_; ++i )
+                  new ( shard + i ) value_type( 0 );
+              shards_.push_back( shard );
+          } }
+    numa_shards( const numa_shards& ) = delete;
+    numa_shards& operator=( const numa_shards& ) = delete;
+    ~numa_shards()
+        { for ( value_type* shard : shards_ ) {
+              for ( size_type i = 0; i < size_; ++i )
+                  shard[ i ].~value_type();
+              numa_topology::deallocate( shard, bytes_ );
+          } }
+    value_type* local()
+        { return shards_[ numa_topology::get().node() ]; }
+    Integral load( size_type idx ) const
+        { Integral sum = 0;
+          for ( value_type* shard : shards_ )
+              sum += shard[ idx ].load();
+          return sum; }
+    Integral exchange( size_type idx, Integral to )
+        { Integral sum = shards_[ 0 ][ idx ].exchange( to );
+          for ( size_type s = 1; s < shards_.size(); ++s )
+              sum += shards_[ s ][ idx ].exchange( 0 );
+          return sum; }
+    size_type size() const { return size_; }
+    unsigned count() const { return static_cast< unsigned >( shards_.size() ); }
+private:
+    size_type size_;
+    size_type bytes_;
+    std::vector< value_type* > shards_;
+};
+
+template< typename Integral >
+class numa_simplex
+{
+public:
+    numa_simplex() : shards_( 1 ) {}
+    numa_simplex( Integral in ) : shards_( 1 ) { *shards_.local() += in; }
+    numa_simplex( const numa_simplex& ) = delete;
+    numa_simplex& operator=( const numa_simplex& ) = delete;
+    void operator +=( Integral by ) { *shards_.local() += by; }
+    void operator -=( Integral by ) { *shards_.local() -= by; }
+    void operator ++() { *this += 1; }
+    void operator ++(int) { *this += 1; }
+    void operator --() { *this -= 1; }
+    void operator --(int) { *this -= 1; }
+    Integral load() const { return shards_.load( 0 ); }
+    Integral exchange( Integral to ) { return shards_.exchange( 0, to ); }
+    unsigned shards() const { return shards_.count(); }
+private:
+    numa_shards< Integral > shards_;
+};
+
+template< typename Integral >
+class numa_simplex_array
+{
+public:
+    typedef typename numa_shards< Integral >::value_type value_type;
+    typedef typename numa_shards< Integral >::size_type size_type;
+    numa_simplex_array() = delete;
+    numa_simplex_array( size_type size ) : shards_( size ) {}
+    numa_simplex_array( const numa_simplex_array& ) = delete;
+    numa_simplex_array& operator=( const numa_simplex_array& ) = delete;
+    value_type& operator[]( size_type idx ) { return shards_.local()[ idx ]; }
+    Integral load( size_type idx ) const { return shards_.load( idx ); }
+    Integral exchange( size_type idx, Integral value )
+        { return shards_.exchange( idx, value ); }
+    size_type size() const { return shards_.size(); }
+    unsigned shards() const { return shards_.count(); }
+private:
+    numa_shards< Integral > shards_;
+};
 
 
 } // namespace counter
@@ -0,0 +1,152 @@
+#ifndef BENCHLOG_DISTRIBUTIONS_H
+#define BENCHLOG_DISTRIBUTIONS_H 1
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <limits>
+#include <random>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+namespace bench {
+
+/**
+ * @brief value distributions for bucketing benchmarks
+ *
+ * The non-uniform ones are shaped like request latencies in microseconds:
+ *   LogNormal  median 1ms, sigma 1.5 (bulk between 50us and 20ms)
+ *   Pareto     minimum 100us, alpha 1.2 (heavy tail)
+ *   Zipf       10us * rank, rank 1 .. 100000 with exponent 1.1, i.e. few
+ *              values repeating very often
+ *   Bimodal    90% around 50us (cache hit), 10% around 5ms (miss)
+ *   Replay     whitespace separated numbers from the file named by
+ *              BENCHLOG_REPLAY, e.g. recorded from production
+ */
+enum class Dist : int64_t { Uniform, LogNormal, Pareto, Zipf, Bimodal, Replay };
+
+inline char const* distName(Dist d) {
+  switch (d) {
+    case Dist::Uniform: return "uniform";
+    case Dist::LogNormal: return "lognormal";
+    case Dist::Pareto: return "pareto";
+    case Dist::Zipf: return "zipf";
+    case Dist::Bimodal: return "bimodal";
+    case Dist::Replay: return "replay";
+  }
+  return "unknown";
+}
+
+/**
+ * @brief distributions to pass to ->ArgsProduct(), Replay only with a file
+ */
+inline std::vector<int64_t> distributions() {
+  std::vector<int64_t> d = {
+    static_cast<int64_t>(Dist::Uniform), static_cast<int64_t>(Dist::LogNormal),
+    static_cast<int64_t>(Dist::Pareto), static_cast<int64_t>(Dist::Zipf),
+    static_cast<int64_t>(Dist::Bimodal)};
+  if (getenv("BENCHLOG_REPLAY") != nullptr) {
+    d.push_back(static_cast<int64_t>(Dist::Replay));
+  }
+  return d;
+}
+
+inline std::vector<double> const& replayed() {
+  static std::vector<double> const v = [] {
+    std::vector<double> r;
+    char const* path = getenv("BENCHLOG_REPLAY");
+    if (path != nullptr) {
+      std::ifstream in(path);
+      double d;
+      while (in >> d) {
+        r.push_back(d);
+      }
+    }
+    return r;
+  }();
+  return v;
+}
+
+/**
+ * @brief fixed pool of pre-generated values, cycled through by next()
+ *
+ * All random numbers are drawn before the timed loop. The pool is large
+ * enough (64k values) that branch predictors cannot learn the sequence.
+ * Values are clamped to [lo, hi] so kernels without range checks are safe.
+ */
+template<typename T>
+class Values {
+ public:
+  static constexpr size_t size = size_t(1) << 16;
+
+  Values(Dist d, double lo, double hi, uint64_t seed = 0x5eed)
+    : _v(size), _i(0) {
+    std::mt19937_64 gen(seed);
+    std::uniform_real_distribution<double> uni(0., 1.);
+    std::lognormal_distribution<double> logn(std::log(1000.), 1.5);
+    std::lognormal_distribution<double> fast(std::log(50.), .3);
+    std::lognormal_distribution<double> slow(std::log(5000.), .5);
+    std::vector<double> zipf;
+    if (d == Dist::Zipf) {
+      zipf.resize(100000);
+      double sum = 0.;
+      for (size_t r = 0; r < zipf.size(); ++r) {
+        sum += 1. / std::pow(static_cast<double>(r + 1), 1.1);
+        zipf[r] = sum;
+      }
+      for (auto& z : zipf) {
+        z /= sum;
+      }
+    }
+    std::vector<double> const& replay = replayed();
+    for (size_t i = 0; i < size; ++i) {
+      double x = 0.;
+      switch (d) {
+        case Dist::Uniform: x = lo + (hi - lo) * uni(gen); break;
+        case Dist::LogNormal: x = logn(gen); break;
+        case Dist::Pareto: x = 100. / std::pow(1. - uni(gen), 1. / 1.2); break;
+        case Dist::Zipf:
+          x = 10. * static_cast<double>(
+            std::lower_bound(zipf.begin(), zipf.end(), uni(gen)) - zipf.begin() + 1);
+          break;
+        case Dist::Bimodal: x = (uni(gen) < .9) ? fast(gen) : slow(gen); break;
+        case Dist::Replay: x = replay.empty() ? lo : replay[i % replay.size()]; break;
+      }
+      x = std::min(std::max(x, lo), hi);
+      if constexpr (std::is_integral_v<T>) {
+        _v[i] = static_cast<T>(std::llround(x));
+      } else {
+        _v[i] = static_cast<T>(x);
+      }
+    }
+  }
+
+  /**
+   * @brief pool for state.range(0) as distribution, labels the run
+   */
+  Values(benchmark::State& state, double lo, double hi)
+    : Values(static_cast<Dist>(state.range(0)), lo, hi) {
+    Dist d = static_cast<Dist>(state.range(0));
+    if (d == Dist::Replay && replayed().empty()) {
+      state.SkipWithError("BENCHLOG_REPLAY names no readable file of numbers");
+    }
+    state.SetLabel(distName(d));
+  }
+
+  T next() { return _v[_i++ & (size - 1)]; }
+
+  std::vector<T> const& all() const { return _v; }
+
+ private:
+  std::vector<T> _v;
+  size_t _i;
+};
+
+}  // namespace bench
+
+#endif
@@ -13,6 +13,7 @@
 // limitations under the License.
 
 #include <iterator>
+#include <memory>
 #include <stdexcept>
 #include <limits>
 
@@ -20,8 +21,10 @@ namespace std {
 
 struct bad_array_length_ { };
 
-template< class T >
-struct dynarray
+// The allocator is a private base, so that stateless allocators take no
+// space (empty base optimization).
+template< class T, class Allocator = std::allocator< T > >
+struct dynarray : private Allocator
 {
     // types:
     typedef       T                               value_type;
@@ -33,46 +36,56 @@ struct dynarray
     typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
     typedef size_t                                size_type;
     typedef ptrdiff_t                             difference_type;
+    typedef       Allocator                       allocator_type;
 
     // fields:
 private:
+    typedef std::allocator_traits< Allocator >    traits;
     T*        store;
     size_type count;
 
     // helper functions:
+    allocator_type&       allocator()       { return *this; }
+    const allocator_type& allocator() const { return *this; }
     void check(size_type n)
         { if ( n >= count ) throw out_of_range("dynarray"); }
     T* alloc(size_type n)
         { if ( n > std::numeric_limits<size_type>::max()/sizeof(T) )
               throw std::bad_array_length_();
-          return reinterpret_cast<T*>( new char[ n*sizeof(T) ] ); }
+          return traits::allocate( allocator(), n ); }
+    void release()
+        { traits::deallocate( allocator(), store, count ); }
 
 public:
     // construct and destruct:
     dynarray() = delete;
     const dynarray operator=(const dynarray&) = delete;
 
-    explicit dynarray(size_type c)
-        : store( alloc( c ) ), count( c )
-        { size_type i;
+    explicit dynarray(size_type c, const allocator_type& a = allocator_type())
+        : allocator_type( a ), store( alloc( c ) ), count( c )
+        { size_type i = 0;
           try {
-              for ( size_type i = 0; i < count; ++i )
+              for ( ; i < count; ++i )
                   new (store+i) T;
           } catch ( ... ) {
               for ( ; i > 0; --i )
                  (store+(i-1))->~T();
+              release();
               throw;
           } }
 
     dynarray(const dynarray& d)
-        : store( alloc( d.count ) ), count( d.count )
+        : allocator_type( traits::select_on_container_copy_construction( d.allocator() ) ),
+          store( alloc( d.count ) ), count( d.count )
         { try { uninitialized_copy( d.begin(), d.end(), begin() ); }
-          catch ( ... ) { delete store; throw; } }
+          catch ( ... ) { release(); throw; } }
 
     ~dynarray()
         { for ( size_type i = 0; i < count; ++i )
               (store+i)->~T();
-          delete[] store; }
+          release(); }
+
+    allocator_type get_allocator() const { return allocator(); }
 
     // iterators:
     iterator       begin()        { return store; }
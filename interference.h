@@ -0,0 +1,101 @@
+#ifndef BENCHLOG_INTERFERENCE_H
+#define BENCHLOG_INTERFERENCE_H 1
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+namespace bench {
+
+/**
+ * @brief background reader scraping a metric while benchmark threads write
+ *
+ * Started from a benchmark's Setup and stopped from its Teardown, the reader
+ * calls its function every interval_us microseconds (state.range(0), 0 means
+ * no reader at all) and records the latency of every call. If a call takes
+ * longer than the interval the next one starts right away, there is no
+ * catching up in bursts.
+ */
+class Reader {
+ public:
+  Reader() : _stop(false), _sink(0) {}
+  Reader(Reader const&) = delete;
+  ~Reader() { stop(); }
+
+  void start(int64_t intervalUs, std::function<uint64_t()> fn) {
+    stop();
+    {
+      std::lock_guard<std::mutex> guard(_mutex);
+      _latencies.clear();
+    }
+    if (intervalUs <= 0) {
+      return;
+    }
+    _stop.store(false, std::memory_order_relaxed);
+    _thread = std::thread([this, intervalUs, fn = std::move(fn)] {
+      using clock = std::chrono::steady_clock;
+      auto const interval = std::chrono::microseconds(intervalUs);
+      auto next = clock::now();
+      while (!_stop.load(std::memory_order_relaxed)) {
+        auto t0 = clock::now();
+        _sink += fn();
+        auto t1 = clock::now();
+        {
+          std::lock_guard<std::mutex> guard(_mutex);
+          _latencies.push_back(std::chrono::duration<double, std::nano>(t1 - t0).count());
+        }
+        next = std::max(next + interval, t1);
+        std::this_thread::sleep_until(next);
+      }
+    });
+  }
+
+  void stop() {
+    if (_thread.joinable()) {
+      _stop.store(true, std::memory_order_relaxed);
+      _thread.join();
+    }
+  }
+
+  /**
+   * @brief reader latency percentiles (ns) and call count so far,
+   *        to be called by a single benchmark thread after its loop
+   */
+  void report(benchmark::State& state) {
+    std::vector<double> lat;
+    {
+      std::lock_guard<std::mutex> guard(_mutex);
+      lat = _latencies;
+    }
+    if (lat.empty()) {
+      return;
+    }
+    std::sort(lat.begin(), lat.end());
+    auto pct = [&lat](double p) {
+      return lat[std::min(lat.size() - 1, static_cast<size_t>(p * lat.size()))];
+    };
+    state.counters["reads"] = benchmark::Counter(static_cast<double>(lat.size()));
+    state.counters["read_p50_ns"] = benchmark::Counter(pct(0.5));
+    state.counters["read_p99_ns"] = benchmark::Counter(pct(0.99));
+    state.counters["read_p999_ns"] = benchmark::Counter(pct(0.999));
+    state.counters["read_max_ns"] = benchmark::Counter(lat.back());
+  }
+
+ private:
+  std::thread _thread;
+  std::atomic<bool> _stop;
+  std::mutex _mutex;
+  std::vector<double> _latencies;
+  uint64_t _sink;
+};
+
+}  // namespace bench
+
+#endif
@@ -0,0 +1,107 @@
+#ifndef BENCHLOG_LOADGEN_H
+#define BENCHLOG_LOADGEN_H 1
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace bench {
+
+/**
+ * @brief blocking keep-alive HTTP/1.1 client for loopback load generation
+ *
+ * send() and receive() are split so that one benchmark thread can keep many
+ * requests in flight: send on all connections, then receive on all.
+ * receive() returns the body size, 0 on any failure.
+ */
+class HttpClient {
+ public:
+  HttpClient() : _fd(-1) {}
+  HttpClient(HttpClient&& other) noexcept : _fd(other._fd), _in(std::move(other._in)) {
+    other._fd = -1;
+  }
+  HttpClient(HttpClient const&) = delete;
+  ~HttpClient() {
+    if (_fd >= 0) {
+      close(_fd);
+    }
+  }
+
+  bool connect(uint16_t port) {
+    _fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (_fd < 0) {
+      return false;
+    }
+    int one = 1;
+    setsockopt(_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    return ::connect(_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0;
+  }
+
+  bool send(std::string const& path, bool gzip) {
+    std::string req = "GET " + path + " HTTP/1.1\r\nHost: localhost\r\n";
+    if (gzip) {
+      req += "Accept-Encoding: gzip\r\n";
+    }
+    req += "\r\n";
+    size_t done = 0;
+    while (done < req.size()) {
+      ssize_t n = ::send(_fd, req.data() + done, req.size() - done, MSG_NOSIGNAL);
+      if (n <= 0) {
+        return false;
+      }
+      done += static_cast<size_t>(n);
+    }
+    return true;
+  }
+
+  size_t receive() {
+    size_t end;
+    while ((end = _in.find("\r\n\r\n")) == std::string::npos) {
+      if (!fill()) {
+        return 0;
+      }
+    }
+    size_t cl = _in.find("Content-Length: ");
+    if (cl == std::string::npos || cl > end) {
+      return 0;
+    }
+    size_t length = strtoull(_in.c_str() + cl + 16, nullptr, 10);
+    size_t total = end + 4 + length;
+    while (_in.size() < total) {
+      if (!fill()) {
+        return 0;
+      }
+    }
+    _in.erase(0, total);
+    return length;
+  }
+
+ private:
+  bool fill() {
+    char buf[65536];
+    ssize_t n = recv(_fd, buf, sizeof(buf), 0);
+    if (n <= 0) {
+      return false;
+    }
+    _in.append(buf, static_cast<size_t>(n));
+    return true;
+  }
+
+  int _fd;
+  std::string _in;
+};
+
+}  // namespace bench
+
+#endif
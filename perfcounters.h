@@ -0,0 +1,163 @@
+#ifndef BENCHLOG_PERFCOUNTERS_H
+#define BENCHLOG_PERFCOUNTERS_H 1
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#if defined __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <benchmark/benchmark.h>
+
+namespace bench {
+
+/**
+ * @brief hardware performance counters of the calling thread
+ *
+ * Construct right before the benchmark loop and call report() right after
+ * it, like bench::Throughput. The events are opened as one perf_event_open
+ * group (user space only, so perf_event_paranoid <= 2 suffices) and attached
+ * as per-iteration user counters: cycles, instructions, branch_misses,
+ * l1d_misses, llc_misses and dtlb_misses. Events the machine does not support are left
+ * out; if perf_event_open is not permitted at all (or BENCHLOG_PERF=0) this
+ * is a no-op and a single note is printed to stderr.
+ */
+class PerfCounters {
+ public:
+#if defined __linux__
+  PerfCounters() : _leader(-1) {
+    if (!enabled()) {
+      return;
+    }
+    for (auto const& e : events()) {
+      int fd = open(e, _leader);
+      if (fd < 0) {
+        if (_leader < 0) {
+          // without cycles there is no group to attach the others to
+          return;
+        }
+        continue;
+      }
+      uint64_t id = 0;
+      ioctl(fd, PERF_EVENT_IOC_ID, &id);
+      _fds.push_back(fd);
+      _ids.push_back(id);
+      _names.push_back(e.name);
+      if (_leader < 0) {
+        _leader = fd;
+      }
+    }
+    ioctl(_leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(_leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  }
+
+  ~PerfCounters() {
+    for (int fd : _fds) {
+      close(fd);
+    }
+  }
+
+  void report(benchmark::State& state) {
+    if (_leader < 0) {
+      return;
+    }
+    ioctl(_leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    // nr, time_enabled, time_running, then {value, id} per event
+    std::vector<uint64_t> buf(3 + 2 * _fds.size());
+    ssize_t n = read(_leader, buf.data(), buf.size() * sizeof(uint64_t));
+    if (n < static_cast<ssize_t>(3 * sizeof(uint64_t)) || buf[2] == 0) {
+      return;
+    }
+    // scale up if the kernel had to multiplex the group
+    double scale = static_cast<double>(buf[1]) / static_cast<double>(buf[2]);
+    for (uint64_t i = 0; i < buf[0] && i < _fds.size(); ++i) {
+      uint64_t value = buf[3 + 2 * i];
+      uint64_t id = buf[4 + 2 * i];
+      for (size_t j = 0; j < _ids.size(); ++j) {
+        if (_ids[j] == id) {
+          state.counters[_names[j]] =
+            benchmark::Counter(value * scale, benchmark::Counter::kAvgIterations);
+        }
+      }
+    }
+  }
+
+ private:
+  struct Event {
+    char const* name;
+    uint32_t type;
+    uint64_t config;
+  };
+
+  static std::vector<Event> const& events() {
+    static std::vector<Event> const e = {
+      {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+      {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+      {"branch_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+      {"l1d_misses", PERF_TYPE_HW_CACHE,
+       PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+       (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+      {"llc_misses", PERF_TYPE_HW_CACHE,
+       PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+       (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+      {"dtlb_misses", PERF_TYPE_HW_CACHE,
+       PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+       (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)}};
+    return e;
+  }
+
+  static int open(Event const& e, int leader) {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = e.type;
+    attr.config = e.config;
+    attr.disabled = (leader < 0) ? 1 : 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_ID |
+      PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0));
+  }
+
+  /**
+   * @brief probe once whether counting is possible at all
+   */
+  static bool enabled() {
+    static bool const ok = [] {
+      char const* env = getenv("BENCHLOG_PERF");
+      if (env != nullptr && strcmp(env, "0") == 0) {
+        return false;
+      }
+      int fd = open(events().front(), -1);
+      if (fd < 0) {
+        std::cerr << "perf counters unavailable (" << strerror(errno)
+                  << "), see /proc/sys/kernel/perf_event_paranoid" << std::endl;
+        return false;
+      }
+      close(fd);
+      return true;
+    }();
+    return ok;
+  }
+
+  int _leader;
+  std::vector<int> _fds;
+  std::vector<uint64_t> _ids;
+  std::vector<char const*> _names;
+#else
+  void report(benchmark::State&) {}
+#endif
+};
+
+}  // namespace bench
+
+#endif
@@ -0,0 +1,168 @@
+#ifndef BENCHLOG_SCALING_H
+#define BENCHLOG_SCALING_H 1
+
+#include <chrono>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include <benchmark/benchmark.h>
+
+namespace bench {
+
+/**
+ * @brief largest thread count for ->ThreadRange(1, maxThreads())
+ */
+inline int maxThreads() {
+  unsigned n = std::thread::hardware_concurrency();
+  return n == 0 ? 1 : static_cast<int>(n);
+}
+
+/**
+ * @brief for ->Apply(): run with 1 and with maxThreads() threads only
+ */
+inline void oneAndAllThreads(benchmark::internal::Benchmark* b) {
+  b->Threads(1);
+  if (maxThreads() > 1) {
+    b->Threads(maxThreads());
+  }
+  b->UseRealTime();
+}
+
+/**
+ * @brief per-thread wall clock, started when the benchmark loop starts
+ *
+ * Google benchmark derives rates from the cpu time summed over all threads,
+ * which hides contention. Every thread therefore measures its own wall time
+ * and reports its own rate, the counters are summed up afterwards. Iterate
+ * over t.loop(state) instead of state: the clock starts after the threads
+ * have passed the start barrier, so thread startup skew is not counted.
+ */
+class Throughput {
+ public:
+  Throughput() : _start(std::chrono::steady_clock::now()) {}
+
+  class Loop {
+   public:
+    Loop(benchmark::State& state, Throughput& t) : _state(state), _t(t) {}
+    benchmark::State::StateIterator begin() { return _state.begin(); }
+    // a range-for calls end() once, before the first iteration, and
+    // State::end() is where the threads wait for each other
+    benchmark::State::StateIterator end() {
+      benchmark::State::StateIterator e = _state.end();
+      _t._start = std::chrono::steady_clock::now();
+      return e;
+    }
+   private:
+    benchmark::State& _state;
+    Throughput& _t;
+  };
+
+  Loop loop(benchmark::State& state) { return Loop(state, *this); }
+
+  /**
+   * @brief sets "ops" (all threads) and "ops_per_thread" counters
+   */
+  void report(benchmark::State& state) const {
+    std::chrono::duration<double> secs = std::chrono::steady_clock::now() - _start;
+    double rate = secs.count() > 0 ? state.iterations() / secs.count() : 0.;
+    state.counters["ops"] = benchmark::Counter(rate);
+    state.counters["ops_per_thread"] =
+      benchmark::Counter(rate, benchmark::Counter::kAvgThreads);
+  }
+
+ private:
+  std::chrono::steady_clock::time_point _start;
+};
+
+/**
+ * @brief console reporter adding scaling efficiency
+ *
+ * For every run with an "ops_per_thread" counter the efficiency is the
+ * per-thread rate divided by the rate of the single threaded run of the
+ * same benchmark, 1.0 means perfect scaling.
+ *
+ * Runs whose first argument is named "interval_us" (see interference.h) are
+ * also compared against the run with interval_us:0, i.e. without a reader,
+ * and get a "degradation" counter: the fraction of writer throughput lost.
+ */
+class ScalingReporter : public benchmark::ConsoleReporter {
+ public:
+  ScalingReporter()
+    : benchmark::ConsoleReporter(isatty(STDOUT_FILENO) ? OO_ColorTabular : OO_Tabular) {}
+
+  void ReportRuns(std::vector<Run> const& reports) override {
+    std::vector<Run> runs(reports);
+    for (auto& run : runs) {
+      auto rate = run.counters.find("ops_per_thread");
+      if (rate == run.counters.end() ||
+          (run.run_type == Run::RT_Aggregate &&
+           run.aggregate_name != "mean" && run.aggregate_name != "median")) {
+        continue;
+      }
+      std::string key = run.run_name.function_name + "/" + run.run_name.args +
+        "/" + run.aggregate_name;
+      if (run.threads == 1) {
+        _single[key] = rate->second.value;
+      }
+      auto single = _single.find(key);
+      if (single != _single.end() && single->second > 0.) {
+        run.counters["efficiency"] = benchmark::Counter(rate->second.value / single->second);
+      }
+      std::string const& args = run.run_name.args;
+      if (args.rfind("interval_us:", 0) == 0) {
+        size_t sep = args.find('/');
+        std::string rest = (sep == std::string::npos) ? "" : args.substr(sep);
+        std::string quietKey = run.run_name.function_name + rest + "/" +
+          std::to_string(run.threads) + "/" + run.aggregate_name;
+        if (args.substr(0, sep) == "interval_us:0") {
+          _quiet[quietKey] = rate->second.value;
+        } else {
+          auto quiet = _quiet.find(quietKey);
+          if (quiet != _quiet.end() && quiet->second > 0.) {
+            run.counters["degradation"] =
+              benchmark::Counter(1. - rate->second.value / quiet->second);
+          }
+        }
+      }
+    }
+    benchmark::ConsoleReporter::ReportRuns(runs);
+  }
+
+ private:
+  std::map<std::string, double> _single;
+  std::map<std::string, double> _quiet;
+};
+
+/**
+ * @brief main for benchmark binaries using the scaling reporter,
+ *        --benchmark_format other than console keeps the stock reporter
+ */
+inline int runBenchmarks(int argc, char** argv) {
+  bool console = true;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg(argv[i]);
+    if (arg.rfind("--benchmark_format=", 0) == 0) {
+      console = (arg == "--benchmark_format=console");
+    }
+  }
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+    return 1;
+  }
+  if (console) {
+    ScalingReporter reporter;
+    benchmark::RunSpecifiedBenchmarks(&reporter);
+  } else {
+    benchmark::RunSpecifiedBenchmarks();
+  }
+  benchmark::Shutdown();
+  return 0;
+}
+
+}  // namespace bench
+
+#endif